@@ -0,0 +1,513 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// Benchmarks for the fs, title and logging layers against the simulated services.
+// Prints one JSON document with a result per case. Console output of the app code
+// goes to /dev/null so the JSON can be piped somewhere.
+//
+// Usage: bench [-o file] [-f filter] [-p profile]... [-V] [-q] [-k]
+//   -o  Write the JSON to file instead of stdout
+//   -f  Only run cases whose name contains filter
+//   -p  Load a service model profile (see host/profiles) over the default models
+//   -V  Report modeled time instead of wall time (host::SIM_VIRTUAL_TIME)
+//   -q  Quick mode, one iteration per case
+//   -k  Keep the working directory
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <3ds.h>
+#include "console.h"
+#include "error.h"
+#include "fixtures.h"
+#include "fs.h"
+#include "hostctru.h"
+#include "install.h"
+#include "memtrack.h"
+#include "misc.h"
+#include "thread.h"
+#include "title.h"
+
+#define MiB(x) ((x) * 0x100000ULL)
+
+
+// Default service models. Roughly a class 10 SD card and the NAND of an Old 3DS.
+// -p replaces them before the cases are created.
+static host::ServiceModel sdModel = {200, MiB(20)};
+static host::ServiceModel nandModel = {100, MiB(10)};
+static const host::ServiceModel noModel = {0, 0};
+
+
+
+struct Case
+{
+	const char *name;
+	u32 iterations;
+	host::ServiceModel sd;
+	host::ServiceModel nand;
+	std::function<void ()> setup;    // Once before the first iteration, not timed
+	std::function<u64 ()> run;       // Timed. Returns the bytes processed, 0 for no throughput
+	std::function<void ()> cleanup;  // After every iteration, not timed
+	const char *skipReason;          // Case isn't run if set
+};
+
+struct Options
+{
+	const char *output = nullptr;
+	const char *filter = nullptr;
+	std::vector<const char*> profiles;
+	bool virtualTime = false;
+	bool quick = false;
+	bool keep = false;
+};
+
+static FILE *json = nullptr;
+static bool firstResult = true;
+static std::string workDir;
+static std::string sdDir;
+
+
+
+static double nowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const std::vector<double>& sorted, u32 p)
+{
+	size_t rank = (sorted.size() * p + 99) / 100;
+	return sorted[rank ? rank - 1 : 0];
+}
+
+static void printModel(const char *name, const host::ServiceModel& model)
+{
+	fprintf(json, "\t\"%s\": {\"latencyUs\": %lu, \"bytesPerSec\": %llu, \"seekUs\": %lu, \"finishUs\": %lu, \"finishTailUs\": %lu, \"finishTailPercent\": %lu},\n",
+	        name, (unsigned long)model.latencyUs, (unsigned long long)model.bytesPerSec, (unsigned long)model.seekUs,
+	        (unsigned long)model.finishUs, (unsigned long)model.finishTailUs, (unsigned long)model.finishTailPercent);
+}
+
+static void beginResult(const char *name)
+{
+	fprintf(json, "%s\n\t\t{\"name\": \"%s\"", (firstResult ? "" : ","), name);
+	firstResult = false;
+}
+
+static void runCase(Case& c, const Options& opts)
+{
+	if(opts.filter && !strstr(c.name, opts.filter)) return;
+
+	fprintf(stderr, "%-32s", c.name);
+	if(c.skipReason)
+	{
+		fprintf(stderr, " skipped (%s)\n", c.skipReason);
+		beginResult(c.name);
+		fprintf(json, ", \"skipped\": \"%s\"}", c.skipReason);
+		return;
+	}
+
+	const u32 iterations = (opts.quick ? 1 : c.iterations);
+	std::vector<double> samples;
+	u64 bytes = 0;
+	host::Counters total = {};
+	u64 allocs = 0, allocSize = 0;
+	std::string error;
+
+	host::setSdModel(noModel);
+	host::setNandModel(noModel);
+	if(c.setup) c.setup();
+	host::setSdModel(c.sd);
+	host::setNandModel(c.nand);
+
+	try
+	{
+		for(u32 i = 0; i<iterations; i++)
+		{
+			host::resetCounters();
+			const mem::Usage memBefore = mem::usage(); // Every heap allocation of the process is counted
+			const double start = nowMs();
+			const u64 clockStart = host::threadClockUs();
+
+			bytes += c.run();
+
+			samples.push_back(opts.virtualTime ? (host::threadClockUs() - clockStart) / 1000.0 : nowMs() - start);
+			const mem::Usage memAfter = mem::usage();
+			allocs += memAfter.allocs - memBefore.allocs;
+			allocSize += memAfter.bytes - memBefore.bytes;
+			const host::Counters cnt = host::counters();
+			total.fsCalls += cnt.fsCalls;
+			total.amCalls += cnt.amCalls;
+			total.fileReads += cnt.fileReads;
+			total.fileWrites += cnt.fileWrites;
+			total.dirReads += cnt.dirReads;
+
+			host::setSdModel(noModel);
+			host::setNandModel(noModel);
+			if(c.cleanup) c.cleanup();
+			host::setSdModel(c.sd);
+			host::setNandModel(c.nand);
+		}
+	}
+	catch(std::exception& e)
+	{
+		error = e.what();
+	}
+
+	host::setSdModel(noModel);
+	host::setNandModel(noModel);
+
+	beginResult(c.name);
+	if(!error.empty() || samples.empty())
+	{
+		fprintf(stderr, " failed: %s\n", error.c_str());
+		fprintf(json, ", \"error\": \"%s\"}", error.c_str());
+		return;
+	}
+
+	const u32 n = samples.size();
+	double sum = 0;
+	for(double s : samples) sum += s;
+	std::vector<double> sorted(samples);
+	std::sort(sorted.begin(), sorted.end());
+
+	fprintf(json, ", \"iterations\": %lu,\n\t\t \"ms\": {\"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f}",
+	        (unsigned long)n, sorted.front(), percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99), sorted.back(), sum / n);
+	if(bytes && sum>0) fprintf(json, ",\n\t\t \"throughputMBps\": %.2f", (bytes / 1048576.0) / (sum / 1000.0));
+	// Per iteration
+	fprintf(json, ",\n\t\t \"ipc\": {\"fs\": %llu, \"am\": %llu, \"fileReads\": %llu, \"fileWrites\": %llu, \"dirReads\": %llu}",
+	        (unsigned long long)(total.fsCalls / n), (unsigned long long)(total.amCalls / n), (unsigned long long)(total.fileReads / n),
+	        (unsigned long long)(total.fileWrites / n), (unsigned long long)(total.dirReads / n));
+	fprintf(json, ",\n\t\t \"allocs\": {\"count\": %llu, \"bytes\": %llu}}", (unsigned long long)(allocs / n), (unsigned long long)(allocSize / n));
+
+	fprintf(stderr, " p50 %9.3f ms\n", percentile(sorted, 50));
+}
+
+
+
+// Case helpers
+static std::string sdPath(const char *path) {return sdDir + path;}
+
+// What main.cpp does per title while installing: one line plus progress updates.
+// Only the callers are timed, the renderer catches up in the cleanup.
+static u64 consoleWorkload()
+{
+	for(u32 title = 1; title<=50; title++)
+	{
+		logging->logprintf("Installing title %lu...", (unsigned long)title);
+		for(u32 percent = 0; percent<=100; percent += 5)
+			console::progress(1, "\r%3lu/%-3lu %3lu%%", (unsigned long)title, 50ul, (unsigned long)percent);
+		logging->logprintf(" Done\n");
+	}
+	return 0;
+}
+
+// Installed titles are one version behind the pack so everything gets updated
+static void installPackPredecessors(const std::vector<fixtures::PackTitle>& titles)
+{
+	host::clearTitles();
+	for(auto& title : titles) host::addTitle(title.titleID, title.version - 1, title.size);
+}
+
+// installUpdates() on a generated pack in /updates. The hash DB goes through a file like mkpack's output.
+// With changed the pack is deltas against a base pack in /base that differs in changed percent of the content.
+// With store it's in the CIA store with /updates.manifest.
+static Case packCase(const char *name, u32 iterations, const host::ServiceModel& sd, const host::ServiceModel& nand, const fixtures::PackSpec& spec, int changed=-1, bool store=false)
+{
+	std::shared_ptr<FirmwareDb> db(new FirmwareDb);
+	std::shared_ptr<std::vector<fixtures::PackTitle>> titles(new std::vector<fixtures::PackTitle>);
+
+	return {name, iterations, sd, nand,
+		[=]() {
+			FirmwareDb generated;
+			fixtures::removeTree(sdPath("/updates"));
+			fixtures::makeDirs(sdPath("/updates"));
+			if(changed>=0)
+			{
+				fixtures::removeTree(sdPath("/base"));
+				fixtures::makeDirs(sdPath("/base"));
+				*titles = fixtures::makeDeltaPack(sdPath("/updates"), sdPath("/base"), "/base", spec, changed, generated);
+			}
+			else *titles = fixtures::makePack(sdPath("/updates"), spec, generated);
+			fixtures::removeTree(sdPath("/cias"));
+			remove(sdPath("/updates.manifest").c_str());
+			if(store)
+			{
+				if(!fixtures::writeStore(sdPath("/updates.manifest"), sdPath("/cias"), sdPath("/updates")))
+					throw std::runtime_error("Can't write the store");
+				fixtures::removeTree(sdPath("/updates"));
+			}
+			fixtures::writeFirmwareDb(workDir + "/hashes.db", generated);
+			if(!fixtures::readFirmwareDb(workDir + "/hashes.db", *db)) throw std::runtime_error("Can't read back the hash DB");
+			host::setNew3DS(spec.n3ds);
+			host::setRegion(spec.region);
+			installPackPredecessors(*titles);
+		},
+		[=]() -> u64 {
+			InstallMsg msg;
+			std::string error;
+			u64 bytes = 0;
+
+			setFirmwareDb(db.get());
+			{
+				Installer installer(false);
+				for(bool finished = false; !finished; )
+				{
+					finished = installer.finished();
+					while(installer.poll(msg))
+					{
+						if(msg.type==INSTALL_MSG_PROMPT) installer.answer(false);
+						else if(msg.type==INSTALL_MSG_FAILED) error = msg.text;
+					}
+					if(!finished) usleep(1000);
+				}
+			}
+			setFirmwareDb(nullptr);
+
+			if(!error.empty()) throw std::runtime_error(error);
+			for(auto& title : *titles) bytes += title.size;
+			return bytes;
+		},
+		[=]() {installPackPredecessors(*titles);}, nullptr};
+}
+
+static std::vector<Case> makeCases()
+{
+	std::vector<Case> cases;
+
+	cases.push_back({"listDirContents/5000", 20, sdModel, noModel,
+		[]() {
+			fixtures::makeDirs(sdPath("/list"));
+			for(u32 i = 0; i<5000; i++)
+			{
+				char name[32];
+				snprintf(name, sizeof(name), "/list/title%04lu.%s", (unsigned long)i, (i & 1 ? "bin" : "cia"));
+				fixtures::writeFile(sdPath(name), 0);
+			}
+		},
+		[]() -> u64 {
+			std::vector<fs::DirEntry> entries = fs::listDirContents(u"/list", u".cia;");
+			if(entries.size()!=2500) throw std::runtime_error("listDirContents() returned the wrong number of entries");
+			return 0;
+		}, nullptr, nullptr});
+
+	cases.push_back({"getDirInfo/10000", 5, sdModel, noModel,
+		[]() {fixtures::makeTree(sdPath("/tree"), 10000, 50, 3, 0);},
+		[]() -> u64 {
+			fs::DirInfo info = fs::getDirInfo(u"/tree");
+			if(info.fileCount!=10000) throw std::runtime_error("getDirInfo() counted the wrong number of files");
+			return 0;
+		}, nullptr, nullptr});
+
+	cases.push_back({"copyFile/8MiB", 5, sdModel, noModel,
+		[]() {fixtures::writeFile(sdPath("/big.bin"), MiB(8), 0x11);},
+		[]() -> u64 {return fs::copyFile(u"/big.bin", u"/big_copy.bin");},
+		[]() {unlink(sdPath("/big_copy.bin").c_str());}, nullptr});
+
+	cases.push_back({"copyDir/200x32KiB", 3, sdModel, noModel,
+		[]() {fixtures::makeTree(sdPath("/copysrc"), 200, 20, 2, 0x8000);},
+		[]() -> u64 {fs::copyDir(u"/copysrc", u"/copydst"); return 200 * 0x8000;},
+		[]() {fixtures::removeTree(sdPath("/copydst"));}, nullptr});
+
+	// Same install with and without the I/O thread overlapping SD reads and NAND writes
+	for(int async = 1; async>=0; async--)
+	{
+		cases.push_back({(async ? "installCia/8MiB/async" : "installCia/8MiB/sync"), 3, sdModel, nandModel,
+			[]() {
+				std::vector<u8> cia = fixtures::makeCia(0x0004013800000002ULL, 0x2C10, MiB(8));
+				fixtures::writeFile(sdPath("/title.cia"), cia.data(), cia.size());
+			},
+			[async]() -> u64 {
+				if(!async) fs::ioQueueExit();
+				installCia(u"/title.cia", MEDIATYPE_NAND);
+				if(!async) fs::ioQueueInit();
+				return MiB(8);
+			},
+			[]() {host::clearTitles();}, nullptr});
+	}
+
+	cases.push_back({"getTitleInfos/300", 10, noModel, nandModel,
+		[]() {
+			host::clearTitles();
+			for(u32 i = 0; i<300; i++) host::addTitle(0x0004013000000000ULL | (i<<8), 0x1000 + i, 0x10000, "CTR-P-BNCH");
+		},
+		[]() -> u64 {
+			std::vector<TitleInfo> infos = getTitleInfos(MEDIATYPE_NAND);
+			if(infos.size()!=300) throw std::runtime_error("getTitleInfos() returned the wrong number of titles");
+			return 0;
+		},
+		nullptr, nullptr});
+
+	// A small pack through the service models and a big one to show how the phases scale
+	cases.push_back(packCase("installUpdates/100", 3, sdModel, nandModel,
+		{100, 0x1000, 0x40000, fixtures::SIZES_SKEWED, 17120, false, CFG_REGION_USA, 1}));
+	cases.push_back(packCase("installUpdates/1000", 1, noModel, noModel,
+		{1000, 0x400, 0x1000, fixtures::SIZES_UNIFORM, 17120, false, CFG_REGION_USA, 2}));
+
+	// The same packs plain and LZ4 compressed. Less to read from the SD card against
+	// decompressing and hashing in software. Give the console's CPU speed with a
+	// profile's cpu.scale and -V, or this only measures the host.
+	cases.push_back(packCase("installUpdates/half", 1, sdModel, nandModel,
+		{40, 0x10000, 0x800000, fixtures::SIZES_SKEWED, 17120, false, CFG_REGION_USA, 3, 50, false}));
+	cases.push_back(packCase("installUpdates/half.lz4", 1, sdModel, nandModel,
+		{40, 0x10000, 0x800000, fixtures::SIZES_SKEWED, 17120, false, CFG_REGION_USA, 3, 50, true}));
+	cases.push_back(packCase("installUpdates/random", 1, sdModel, nandModel,
+		{40, 0x10000, 0x800000, fixtures::SIZES_SKEWED, 17120, false, CFG_REGION_USA, 3, 100, false}));
+	cases.push_back(packCase("installUpdates/random.lz4", 1, sdModel, nandModel,
+		{40, 0x10000, 0x800000, fixtures::SIZES_SKEWED, 17120, false, CFG_REGION_USA, 3, 100, true}));
+	// Same as installUpdates/half but rebuilt from a base pack with 10% of the content changed
+	cases.push_back(packCase("installUpdates/half.delta", 1, sdModel, nandModel,
+		{40, 0x10000, 0x800000, fixtures::SIZES_SKEWED, 17120, false, CFG_REGION_USA, 3, 50, false}, 10));
+	// installUpdates/half from the CIA store
+	cases.push_back(packCase("installUpdates/half.store", 1, sdModel, nandModel,
+		{40, 0x10000, 0x800000, fixtures::SIZES_SKEWED, 17120, false, CFG_REGION_USA, 3, 50, false}, -1, true));
+
+	cases.push_back({"logging/4x5000", 3, noModel, noModel, nullptr,
+		[]() -> u64 {
+			u64 bytes = 0;
+			{
+				std::vector<Worker*> workers;
+				for(u32 t = 0; t<4; t++)
+				{
+					workers.push_back(new Worker([t]() {
+						for(u32 i = 0; i<5000; i++)
+							logging->logprintf("thread %lu line %lu: the quick brown fox jumps over the lazy dog\n", (unsigned long)t, (unsigned long)i);
+					}));
+				}
+				for(Worker *w : workers) delete w;
+				logging->flush();
+				bytes = 4 * 5000 * 64;
+			}
+			return bytes;
+		},
+		nullptr, nullptr});
+
+	cases.push_back({"console/immediate", 3, noModel, noModel, nullptr, consoleWorkload, nullptr, nullptr});
+
+	cases.push_back({"console/renderer", 3, noModel, noModel,
+		[]() {console::init();}, consoleWorkload, []() {console::flush();}, nullptr});
+
+	return cases;
+}
+
+
+
+static bool parseArgs(int argc, char *argv[], Options& opts)
+{
+	for(int i = 1; i<argc; i++)
+	{
+		if(!strcmp(argv[i], "-o") && i + 1<argc) opts.output = argv[++i];
+		else if(!strcmp(argv[i], "-f") && i + 1<argc) opts.filter = argv[++i];
+		else if(!strcmp(argv[i], "-p") && i + 1<argc) opts.profiles.push_back(argv[++i]);
+		else if(!strcmp(argv[i], "-V")) opts.virtualTime = true;
+		else if(!strcmp(argv[i], "-q")) opts.quick = true;
+		else if(!strcmp(argv[i], "-k")) opts.keep = true;
+		else
+		{
+			fprintf(stderr, "Usage: %s [-o file] [-f filter] [-p profile]... [-V] [-q] [-k]\n", argv[0]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	Options opts;
+	if(!parseArgs(argc, argv, opts)) return 1;
+
+	host::setSdModel(sdModel);
+	host::setNandModel(nandModel);
+	for(const char *profile : opts.profiles)
+	{
+		if(!host::loadProfile(profile))
+		{
+			fprintf(stderr, "Can't load profile %s\n", profile);
+			return 1;
+		}
+	}
+	sdModel = host::sdModel();
+	nandModel = host::nandModel();
+	if(opts.virtualTime) host::setSimTime(host::SIM_VIRTUAL_TIME);
+
+	char tmpl[] = "/tmp/sysdg-bench-XXXXXX";
+	if(!mkdtemp(tmpl))
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	workDir = tmpl;
+	sdDir = workDir + "/sdmc";
+	fixtures::makeDirs(sdDir);
+
+	// The JSON keeps the original stdout, the app's console output goes nowhere
+	json = (opts.output ? fopen(opts.output, "w") : fdopen(dup(STDOUT_FILENO), "w"));
+	if(!json)
+	{
+		perror(opts.output);
+		return 1;
+	}
+	fflush(stdout);
+	const int devNull = open("/dev/null", O_WRONLY);
+	dup2(devNull, STDOUT_FILENO);
+	close(devNull);
+
+	// Start the log over in the working directory
+	if(chdir(workDir.c_str())!=0) perror("chdir");
+	delete logging;
+	logging = new Logging();
+
+	host::setSdRoot(sdDir.c_str());
+	sdmcArchiveInit();
+	fs::ioQueueInit();
+	amInit();
+
+	std::vector<Case> cases = makeCases();
+	fprintf(json, "{\n\t\"time\": \"%s\",\n", (opts.virtualTime ? "virtual" : "wall"));
+	printModel("sdModel", sdModel);
+	printModel("nandModel", nandModel);
+	fprintf(json, "\t\"results\": [");
+	for(Case& c : cases) runCase(c, opts);
+	fprintf(json, "\n\t]\n}\n");
+	fclose(json);
+
+	console::exit();
+	amExit();
+	fs::ioQueueExit();
+	sdmcArchiveExit();
+	delete logging;
+	logging = nullptr;
+
+	if(!opts.keep) fixtures::removeTree(workDir);
+	else fprintf(stderr, "Working directory: %s\n", workDir.c_str());
+
+	return 0;
+}
@@ -0,0 +1,671 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include "bundle.h"
+#include "error.h"
+#include "fixtures.h"
+#include "fs.h"
+#include "hostctru.h"
+#include "sha256.h"
+#include "store.h"
+#include "title.h"
+
+
+namespace fixtures
+{
+	static u64 align64(u64 v) {return (v + 63) & ~63ULL;}
+
+	static void putBe(u8 *p, u64 v, u32 bytes)
+	{
+		for(u32 i = 0; i<bytes; i++) p[i] = (u8)(v>>((bytes - 1 - i) * 8));
+	}
+
+	static void putLe(u8 *p, u64 v, u32 bytes)
+	{
+		for(u32 i = 0; i<bytes; i++) p[i] = (u8)(v>>(i * 8));
+	}
+
+
+	std::vector<u8> makeCia(u64 titleID, u16 version, u32 contentSize, u8 fill, u8 entropy, u32 seed)
+	{
+		const u32 certSize = 0xA00, ticketSize = 0x350;
+		const u32 sigSize = 0x100 + 0x3C; // RSA-2048 SHA256
+		const u32 tmdSize = 4 + sigSize + 0xC4 + 64 * 0x24 + 0x30; // One content chunk
+		const u64 tmdOffset = align64(align64(align64(0x2020) + certSize) + ticketSize);
+		const u64 contentOffset = align64(tmdOffset + tmdSize);
+
+		std::vector<u8> cia(contentOffset + contentSize, fill);
+		memset(cia.data(), 0, contentOffset);
+
+		u8 *header = cia.data();
+		putLe(header + 0x00, 0x2020, 4);
+		putLe(header + 0x08, certSize, 4);
+		putLe(header + 0x0C, ticketSize, 4);
+		putLe(header + 0x10, tmdSize, 4);
+		putLe(header + 0x18, contentSize, 8);
+
+		u8 *tmd = cia.data() + tmdOffset;
+		putBe(tmd, 0x10004, 4);
+		u8 *tmdHeader = tmd + 4 + sigSize;
+		putBe(tmdHeader + 0x4C, titleID, 8);
+		putBe(tmdHeader + 0x9C, version, 2);
+		putBe(tmdHeader + 0x9E, 1, 2); // Content count
+
+		if(entropy)
+		{
+			std::mt19937 rng(seed);
+			for(u64 pos = contentOffset; pos<cia.size(); pos += 0x1000)
+			{
+				if(rng() % 100>=entropy) continue;
+				const u64 end = std::min<u64>(pos + 0x1000, cia.size());
+				for(u64 i = pos; i<end; i++) cia[i] = (u8)rng();
+			}
+		}
+
+		return cia;
+	}
+
+
+	static u32 getLe32(const u8 *p) {return (u32)p[0] | (u32)p[1]<<8 | (u32)p[2]<<16 | (u32)p[3]<<24;}
+
+	// Sequence length nibble plus the 255 byte extension
+	static void putLength(std::vector<u8>& out, u32 length)
+	{
+		for(length -= 15; length>=255; length -= 255) out.push_back(255);
+		out.push_back((u8)length);
+	}
+
+	// Greedy single probe hash table matcher. Fast enough for test data, not for ratio.
+	// Follows the end of block rules: the last 5 bytes are literals and no match starts
+	// in the last 12 bytes.
+	static void compressBlock(const u8 *src, u32 size, std::vector<u8>& out)
+	{
+		const u32 hashBits = 16;
+		std::vector<u32> table(1u<<hashBits, 0); // Position + 1, 0 is empty
+		u32 pos = 0, anchor = 0, misses = 0;
+
+		while(size>=LZ4_MFLIMIT + 1 && pos + LZ4_MFLIMIT<=size)
+		{
+			const u32 seq = getLe32(src + pos);
+			const u32 h = (seq * 2654435761U)>>(32 - hashBits);
+			const u32 ref = table[h];
+			table[h] = pos + 1;
+
+			if(!ref || pos - (ref - 1)>0xFFFF || getLe32(src + ref - 1)!=seq)
+			{
+				pos += 1 + (misses++>>6); // Skip faster through data that doesn't compress
+				continue;
+			}
+
+			const u32 match = ref - 1;
+			u32 length = LZ4_MIN_MATCH;
+			while(pos + length<size - LZ4_LAST_LITERALS && src[pos + length]==src[match + length]) length++;
+
+			const u32 literals = pos - anchor, matchLength = length - LZ4_MIN_MATCH;
+			out.push_back((u8)((literals<15 ? literals : 15)<<4 | (matchLength<15 ? matchLength : 15)));
+			if(literals>=15) putLength(out, literals);
+			out.insert(out.end(), src + anchor, src + pos);
+			out.push_back((u8)(pos - match));
+			out.push_back((u8)((pos - match)>>8));
+			if(matchLength>=15) putLength(out, matchLength);
+
+			pos += length;
+			anchor = pos;
+			misses = 0;
+		}
+
+		const u32 literals = size - anchor;
+		out.push_back((u8)((literals<15 ? literals : 15)<<4));
+		if(literals>=15) putLength(out, literals);
+		out.insert(out.end(), src + anchor, src + size);
+	}
+
+	std::vector<u8> compressLz4(const u8 *data, size_t size, u32 blockSize)
+	{
+		u32 bd = 4; // 64 KB
+		while((1u<<(8 + 2*bd))<blockSize && bd<7) bd++;
+		blockSize = 1u<<(8 + 2*bd);
+
+		std::vector<u8> out(4 + 2 + 8 + 1);
+		putLe(out.data(), LZ4_FRAME_MAGIC, 4);
+		out[4] = 0x68; // Version 1, independent blocks, content size
+		out[5] = (u8)(bd<<4);
+		putLe(out.data() + 6, size, 8);
+		out[14] = (u8)(lz4::xxh32(out.data() + 4, 10, 0)>>8);
+
+		std::vector<u8> block;
+		for(size_t pos = 0; pos<size; )
+		{
+			const u32 n = (u32)std::min<size_t>(size - pos, (pos ? blockSize : std::min<u32>(blockSize, 0x10000)));
+
+			block.clear();
+			compressBlock(data + pos, n, block);
+			const bool stored = block.size()>=n;
+			const size_t header = out.size();
+			out.resize(header + 4);
+			putLe(out.data() + header, (stored ? n | LZ4_UNCOMPRESSED : (u32)block.size()), 4);
+			if(stored) out.insert(out.end(), data + pos, data + pos + n);
+			else out.insert(out.end(), block.begin(), block.end());
+			pos += n;
+		}
+		out.resize(out.size() + 4); // End mark
+
+		return out;
+	}
+
+
+	u64 homeMenuTitleID(u8 region)
+	{
+		switch(region)
+		{
+			case CFG_REGION_JPN: return 0x0004003000008202ULL;
+			case CFG_REGION_USA: return 0x0004003000008F02ULL;
+			case CFG_REGION_EUR:
+			case CFG_REGION_AUS: return 0x0004003000009802ULL;
+			case CFG_REGION_CHN: return 0x000400300000A102ULL;
+			case CFG_REGION_KOR: return 0x000400300000A902ULL;
+			case CFG_REGION_TWN: return 0x000400300000B102ULL;
+			default: return 0;
+		}
+	}
+
+	// Generates the CIAs of a pack and their hashes. write stores each one
+	static std::vector<PackTitle> generatePack(const PackSpec& spec, FirmwareDb& db, std::function<void (const PackTitle& title, const std::vector<u8>& cia)> write)
+	{
+		// Same title types installUpdates() sorts by, minus System Firmware
+		static const u32 types[6] = {0x00040130, 0x00040030, 0x00040010, 0x0004001B, 0x0004009B, 0x000400DB};
+		const u64 nativeFirm = (spec.n3ds ? 0x0004013820000002ULL : 0x0004013800000002ULL);
+		const u64 homeMenu = homeMenuTitleID(spec.region);
+		const double minSize = (spec.minSize ? spec.minSize : 1);
+		std::mt19937 rng(spec.seed);
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+		TitleHashes& hashes = db[spec.firmVersion][nativeFirm][homeMenu];
+		std::vector<PackTitle> titles;
+
+		for(u32 i = 0; i<spec.titleCount; i++)
+		{
+			PackTitle title;
+
+			if(i==0) title.titleID = nativeFirm;
+			else if(i==1) title.titleID = homeMenu;
+			else // Every 10th title is a SAFE_MODE one
+				title.titleID = ((u64)types[i % 6]<<32) | ((0x100000ULL + i)<<8) | (i % 10==0 ? 0x03 : 0x02);
+			title.version = (i==0 ? spec.firmVersion : (u16)((1 + rng() % 63) * 1024));
+
+			const double u = unit(rng);
+			const u32 contentSize = (spec.sizes==SIZES_SKEWED ? (u32)(minSize * pow(spec.maxSize / minSize, u))
+			                                                  : spec.minSize + (u32)((spec.maxSize - spec.minSize) * u));
+			const u8 fill = (u8)rng();
+			const u32 contentSeed = (spec.entropy ? rng() : 0); // Packs without entropy stay as they were
+			const std::vector<u8> cia = makeCia(title.titleID, title.version, contentSize, fill, spec.entropy, contentSeed);
+
+			Sha256Hash hash;
+			FSUSER_UpdateSha256Context(cia.data(), cia.size(), hash.data());
+			hashes[title.titleID] = hash;
+
+			title.size = cia.size();
+			write(title, cia);
+			titles.push_back(title);
+		}
+
+		return titles;
+	}
+
+	std::vector<PackTitle> makePack(const std::string& dir, const PackSpec& spec, FirmwareDb& db)
+	{
+		char name[32];
+
+		return generatePack(spec, db, [&](const PackTitle& title, const std::vector<u8>& cia) {
+			snprintf(name, sizeof(name), "/%016" PRIX64 "%s", title.titleID, (spec.compress ? ".cia.lz4" : ".cia"));
+			if(spec.compress)
+			{
+				const std::vector<u8> frame = compressLz4(cia.data(), cia.size());
+				writeFile(dir + name, frame.data(), frame.size());
+			}
+			else writeFile(dir + name, cia.data(), cia.size());
+		});
+	}
+
+	std::vector<PackTitle> makeDeltaPack(const std::string& dir, const std::string& baseDir, const std::string& baseSdDir, const PackSpec& spec, u8 changed, FirmwareDb& db)
+	{
+		char name[32];
+
+		return generatePack(spec, db, [&](const PackTitle& title, const std::vector<u8>& cia) {
+			// The base differs in changed percent of the 4 KB content blocks
+			std::vector<u8> base(cia);
+			std::mt19937 rng((u32)title.titleID);
+			const u64 contentOffset = base.size() - inspectCia(cia.data(), cia.size(), cia.size()).contentSize;
+			for(u64 pos = contentOffset; pos<base.size(); pos += 0x1000)
+			{
+				if(rng() % 100>=changed) continue;
+				const u64 end = std::min<u64>(pos + 0x1000, base.size());
+				for(u64 i = pos; i<end; i++) base[i] = (u8)rng();
+			}
+
+			snprintf(name, sizeof(name), "/%016" PRIX64 ".cia", title.titleID);
+			writeFile(baseDir + name, base.data(), base.size());
+			const std::vector<u8> delta = makeDelta(base, cia, baseSdDir + name);
+			writeFile(dir + name + ".delta", delta.data(), delta.size());
+		});
+	}
+
+
+	// Rolling polynomial hash of DELTA_BLOCK bytes, mod 2^64
+	static const u32 DELTA_BLOCK = 32;
+	static const u64 DELTA_HASH_BASE = 0x100000001B3ULL;
+
+	static u64 blockHash(const u8 *p)
+	{
+		u64 h = 0;
+		for(u32 i = 0; i<DELTA_BLOCK; i++) h = h * DELTA_HASH_BASE + p[i];
+		return h;
+	}
+
+	static void putOp(std::vector<u8>& out, u32 type, u64 length, const u8 *data, u64 baseOffset)
+	{
+		while(length)
+		{
+			const u32 n = (u32)std::min<u64>(length, DELTA_MAX_OP_LENGTH);
+			const size_t pos = out.size();
+			out.resize(pos + 4 + (type==DELTA_OP_COPY ? 8 : 0));
+			putLe(out.data() + pos, (u64)type<<30 | n, 4);
+			if(type==DELTA_OP_COPY)
+			{
+				putLe(out.data() + pos + 4, baseOffset, 8);
+				baseOffset += n;
+			}
+			else
+			{
+				out.insert(out.end(), data, data + n);
+				data += n;
+			}
+			length -= n;
+		}
+	}
+
+	std::vector<u8> makeDelta(const std::vector<u8>& base, const std::vector<u8>& target, const std::string& baseSdPath)
+	{
+		const CiaInfo info = inspectCia(target.data(), target.size(), target.size());
+		DeltaHeader header;
+
+		memset(&header, 0, sizeof(DeltaHeader));
+		header.magic = DELTA_MAGIC;
+		header.version = DELTA_VERSION;
+		header.headerSize = sizeof(DeltaHeader);
+		header.titleID = info.titleID;
+		header.titleVersion = info.version;
+		header.baseSize = base.size();
+		header.targetSize = target.size();
+		Sha256::hash(base.data(), base.size(), header.baseSha256);
+		if(baseSdPath.empty() || baseSdPath[0]!='/' || baseSdPath.size()>=DELTA_BASE_PATH_LENGTH)
+			throw std::runtime_error("The base path must be an absolute SD path of less than 128 characters");
+		for(size_t i = 0; i<baseSdPath.size(); i++) header.basePath[i] = (u8)baseSdPath[i];
+
+		std::vector<u8> out((const u8*)&header, (const u8*)&header + sizeof(DeltaHeader));
+
+		// Every aligned block of the base, first one wins
+		std::unordered_map<u64, u64> index;
+		index.reserve(base.size() / DELTA_BLOCK);
+		for(u64 pos = 0; pos + DELTA_BLOCK<=base.size(); pos += DELTA_BLOCK) index.emplace(blockHash(&base[pos]), pos);
+
+		u64 top = 1; // DELTA_HASH_BASE^(DELTA_BLOCK - 1), to roll the first byte out
+		for(u32 i = 1; i<DELTA_BLOCK; i++) top *= DELTA_HASH_BASE;
+
+		const u64 size = target.size();
+		u64 pos = 0, literals = 0, baseEnd = 0;
+		u64 h = (size>=DELTA_BLOCK ? blockHash(target.data()) : 0);
+		while(pos + DELTA_BLOCK<=size)
+		{
+			// Where the base would continue if the literals replaced as many bytes.
+			// Preferred over the index so COPY ops go forward through the base.
+			const u64 expected = baseEnd + (pos - literals);
+			u64 candidate = expected;
+			if(expected + DELTA_BLOCK>base.size() || memcmp(&base[expected], &target[pos], DELTA_BLOCK))
+			{
+				const auto it = index.find(h);
+				candidate = (it!=index.end() && !memcmp(&base[it->second], &target[pos], DELTA_BLOCK) ? it->second : base.size());
+			}
+
+			if(candidate<base.size())
+			{
+				// Grow the match both ways, backwards only into pending literals
+				u64 start = pos, from = candidate, end = pos + DELTA_BLOCK;
+				while(start>literals && from>0 && target[start - 1]==base[from - 1]) {start--; from--;}
+				while(end<size && from + (end - start)<base.size() && target[end]==base[from + (end - start)]) end++;
+
+				putOp(out, DELTA_OP_ADD, start - literals, &target[literals], 0);
+				putOp(out, DELTA_OP_COPY, end - start, nullptr, from);
+				baseEnd = from + (end - start);
+				pos = literals = end;
+				if(pos + DELTA_BLOCK<=size) h = blockHash(&target[pos]);
+				continue;
+			}
+
+			if(pos + DELTA_BLOCK<size) h = (h - target[pos] * top) * DELTA_HASH_BASE + target[pos + DELTA_BLOCK];
+			pos++;
+		}
+		putOp(out, DELTA_OP_ADD, size - literals, &target[literals], 0);
+
+		return out;
+	}
+
+
+	bool writeFirmwareDb(const std::string& path, const FirmwareDb& db)
+	{
+		FILE *f = fopen(path.c_str(), "w");
+		if(!f) return false;
+
+		fprintf(f, "# sysDowngrader firmware hash DB\n");
+		for(auto& version : db)
+			for(auto& device : version.second)
+				for(auto& region : device.second)
+				{
+					fprintf(f, "firm %d %016" PRIX64 " %016" PRIX64 "\n", version.first, device.first, region.first);
+					for(auto& title : region.second)
+					{
+						fprintf(f, "%016" PRIX64 " ", title.first);
+						for(u8 b : title.second) fprintf(f, "%02x", b);
+						fputc('\n', f);
+					}
+				}
+
+		return fclose(f)==0;
+	}
+
+	bool readFirmwareDb(const std::string& path, FirmwareDb& db)
+	{
+		FILE *f = fopen(path.c_str(), "r");
+		if(!f) return false;
+
+		char line[256];
+		TitleHashes *hashes = nullptr;
+		bool ok = true;
+		while(ok && fgets(line, sizeof(line), f))
+		{
+			int version;
+			u64 nativeFirm, homeMenu, titleID;
+			char hex[65];
+
+			if(line[0]=='#' || line[0]=='\n') continue;
+			if(sscanf(line, "firm %d %" SCNx64 " %" SCNx64, &version, &nativeFirm, &homeMenu)==3)
+				hashes = &db[version][nativeFirm][homeMenu];
+			else if(hashes && sscanf(line, "%" SCNx64 " %64[0-9a-fA-F]", &titleID, hex)==2 && strlen(hex)==64)
+			{
+				Sha256Hash& hash = (*hashes)[titleID];
+				for(u32 i = 0; i<32; i++)
+				{
+					unsigned int b;
+					sscanf(hex + i * 2, "%2x", &b);
+					hash[i] = (u8)b;
+				}
+			}
+			else ok = false;
+		}
+
+		fclose(f);
+		return ok;
+	}
+
+
+	bool readFile(const std::string& path, std::vector<u8>& data)
+	{
+		FILE *f = fopen(path.c_str(), "rb");
+		if(!f) return false;
+
+		fseek(f, 0, SEEK_END);
+		data.resize(ftell(f));
+		fseek(f, 0, SEEK_SET);
+		const bool ok = fread(data.data(), 1, data.size(), f)==data.size();
+		fclose(f);
+		return ok;
+	}
+
+	// The .cia files of dir in name order
+	static bool listCias(const std::string& dir, std::vector<std::string>& names)
+	{
+		DIR *d = opendir(dir.c_str());
+		if(!d)
+		{
+			perror(dir.c_str());
+			return false;
+		}
+		while(dirent *e = readdir(d))
+		{
+			const size_t len = strlen(e->d_name);
+			if(e->d_name[0]!='.' && len>4 && !strcasecmp(e->d_name + len - 4, ".cia")) names.push_back(e->d_name);
+		}
+		closedir(d);
+		std::sort(names.begin(), names.end());
+		return true;
+	}
+
+	bool writeBundle(const std::string& path, const std::string& dir, u32 align)
+	{
+		std::vector<std::string> names;
+		if(!listCias(dir, names)) return false;
+		if(names.empty() || names.size()>BUNDLE_MAX_ENTRIES || !align || (align & (align - 1)))
+		{
+			fprintf(stderr, "%s: no CIAs, too many or bad alignment\n", dir.c_str());
+			return false;
+		}
+
+		BundleHeader header = {BUNDLE_MAGIC, BUNDLE_VERSION, sizeof(BundleEntry), (u32)names.size(), align,
+		                       (u32)(sizeof(BundleHeader) + names.size() * sizeof(BundleEntry)), {0, 0, 0}};
+		std::vector<BundleEntry> entries(names.size());
+		u64 offset = header.indexSize;
+
+		const std::string oldRoot = host::sdRoot();
+		host::setSdRoot(dir.c_str());
+		try
+		{
+			for(size_t i = 0; i<names.size(); i++)
+			{
+				fs::File f(fs::Path(std::u16string(u"/") + std::u16string(names[i].begin(), names[i].end())), FS_OPEN_READ);
+				fs::FileView view(f);
+				const CiaInfo info = inspectCia(view);
+
+				BundleEntry& e = entries[i];
+				memset(&e, 0, sizeof(BundleEntry));
+				e.titleID = info.titleID;
+				e.version = info.version;
+				e.size = f.size();
+				e.offset = offset = (offset + align - 1) & ~(u64)(align - 1);
+				offset += e.size;
+			}
+		}
+		catch(ResultException& e)
+		{
+			host::setSdRoot(oldRoot.c_str());
+			fprintf(stderr, "%s\n", e.what());
+			return false;
+		}
+		host::setSdRoot(oldRoot.c_str());
+
+		FILE *out = fopen(path.c_str(), "wb");
+		if(!out)
+		{
+			perror(path.c_str());
+			return false;
+		}
+
+		// The hashes go into the index so it's written last
+		bool ok = true;
+		std::vector<u8> cia;
+		for(size_t i = 0; ok && i<names.size(); i++)
+		{
+			ok = readFile(dir + "/" + names[i], cia) && cia.size()==entries[i].size;
+			FSUSER_UpdateSha256Context(cia.data(), cia.size(), entries[i].sha256);
+			ok = ok && !fseek(out, entries[i].offset, SEEK_SET) && fwrite(cia.data(), 1, cia.size(), out)==cia.size();
+		}
+		ok = ok && !fseek(out, 0, SEEK_SET) && fwrite(&header, sizeof(BundleHeader), 1, out)==1 &&
+		     fwrite(entries.data(), sizeof(BundleEntry), entries.size(), out)==entries.size();
+		if(fclose(out) || !ok)
+		{
+			fprintf(stderr, "Failed to write %s\n", path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	bool writeStore(const std::string& manifestPath, const std::string& storeDir, const std::string& dir, u32 *added)
+	{
+		std::vector<std::string> names;
+		if(!listCias(dir, names)) return false;
+		if(names.empty() || names.size()>STORE_MAX_ENTRIES)
+		{
+			fprintf(stderr, "%s: no CIAs or too many\n", dir.c_str());
+			return false;
+		}
+
+		const ManifestHeader header = {MANIFEST_MAGIC, MANIFEST_VERSION, sizeof(ManifestEntry), (u32)names.size(), 0};
+		std::vector<ManifestEntry> entries(names.size());
+		std::vector<u8> cia;
+		u32 newBlobs = 0;
+
+		makeDirs(storeDir);
+		for(size_t i = 0; i<names.size(); i++)
+		{
+			const std::string path = dir + "/" + names[i];
+			if(!readFile(path, cia))
+			{
+				perror(path.c_str());
+				return false;
+			}
+
+			ManifestEntry& e = entries[i];
+			memset(&e, 0, sizeof(ManifestEntry));
+			try
+			{
+				const CiaInfo info = inspectCia(cia.data(), cia.size(), cia.size());
+				e.titleID = info.titleID;
+				e.version = info.version;
+			}
+			catch(ResultException& ex)
+			{
+				fprintf(stderr, "%s: %s\n", path.c_str(), ex.what());
+				return false;
+			}
+			e.size = cia.size();
+			Sha256::hash(cia.data(), cia.size(), e.sha256);
+
+			// Already there from another pack
+			const std::u16string name = Store::blobName(e.sha256);
+			const std::string blobPath = storeDir + "/" + std::string(name.begin(), name.end());
+			struct stat st;
+			if(!stat(blobPath.c_str(), &st) && (u64)st.st_size==e.size) continue;
+			writeFile(blobPath, cia.data(), cia.size());
+			newBlobs++;
+		}
+
+		FILE *out = fopen(manifestPath.c_str(), "wb");
+		if(!out)
+		{
+			perror(manifestPath.c_str());
+			return false;
+		}
+		bool ok = fwrite(&header, sizeof(ManifestHeader), 1, out)==1 && fwrite(entries.data(), sizeof(ManifestEntry), entries.size(), out)==entries.size();
+		if(fclose(out) || !ok)
+		{
+			fprintf(stderr, "Failed to write %s\n", manifestPath.c_str());
+			return false;
+		}
+
+		if(added) *added = newBlobs;
+		return true;
+	}
+
+
+	void writeFile(const std::string& path, const void *data, size_t size)
+	{
+		FILE *f = fopen(path.c_str(), "wb");
+		if(!f)
+		{
+			perror(path.c_str());
+			return;
+		}
+		fwrite(data, 1, size, f);
+		fclose(f);
+	}
+
+	void writeFile(const std::string& path, size_t size, u8 fill)
+	{
+		std::vector<u8> data(size, fill);
+		writeFile(path, data.data(), size);
+	}
+
+	void makeDirs(const std::string& path)
+	{
+		for(size_t pos = 0; pos!=std::string::npos; )
+		{
+			pos = path.find('/', pos + 1);
+			mkdir(path.substr(0, pos).c_str(), 0755);
+		}
+	}
+
+	static int removeEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+	{
+		return remove(path);
+	}
+
+	void removeTree(const std::string& path)
+	{
+		nftw(path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+	}
+
+
+	void makeTree(const std::string& root, u32 fileCount, u32 filesPerDir, u32 depth, size_t fileSize)
+	{
+		std::vector<u8> data(fileSize, 0x5A);
+		char name[32];
+		std::string dir;
+
+		for(u32 i = 0; i<fileCount; i++)
+		{
+			if(i % filesPerDir==0)
+			{
+				// Each new dir hangs below a path of depth levels, so the tree is wide and deep
+				const u32 dirIndex = i / filesPerDir;
+				dir = root;
+				for(u32 level = 0; level<depth; level++)
+				{
+					snprintf(name, sizeof(name), "/d%u_%u", level, dirIndex % (level + 2));
+					dir += name;
+				}
+				snprintf(name, sizeof(name), "/leaf%u", dirIndex);
+				dir += name;
+				makeDirs(dir);
+			}
+
+			snprintf(name, sizeof(name), "/file%05u.bin", i);
+			writeFile(dir + name, data.data(), fileSize);
+		}
+	}
+}
@@ -0,0 +1,112 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _FIXTURES_H_
+#define _FIXTURES_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "bundleformat.h"
+#include "deltaformat.h"
+#include "install.h"
+#include "lz4.h"
+#include "storeformat.h"
+
+// Test data for the host benchmarks. All paths are host paths.
+namespace fixtures
+{
+	typedef enum
+	{
+		SIZES_UNIFORM = 0,
+		SIZES_SKEWED      // Log-uniform. Many small titles, few big ones like real packs
+	} SizeDistribution;
+
+	// A generated firmware pack. Its hashes are added to a FirmwareDb
+	// so installUpdates() accepts it once set with setFirmwareDb().
+	struct PackSpec
+	{
+		u32 titleCount;       // Including NATIVE_FIRM and Home Menu
+		u32 minSize;          // Content size range
+		u32 maxSize;
+		SizeDistribution sizes;
+		u16 firmVersion;      // NATIVE_FIRM version, the key in the FirmwareDb
+		bool n3ds;
+		u8 region;            // CFG_REGION_*
+		u32 seed;
+		u8 entropy;           // Percent of the content that is random, the rest compresses well
+		bool compress;        // Write <title ID>.cia.lz4 instead
+	};
+
+	struct PackTitle
+	{
+		u64 titleID;
+		u16 version;
+		u64 size;             // CIA size
+	};
+
+	// A CIA with a valid header and TMD for titleID/version followed by contentSize bytes of filler.
+	// entropy percent of the 4 KB content blocks are random instead. Enough for
+	// AM_GetCiaFileInfo(), inspectCia() and the simulated install.
+	std::vector<u8> makeCia(u64 titleID, u16 version, u32 contentSize, u8 fill=0xAB, u8 entropy=0, u32 seed=0);
+
+	// LZ4 frame with independent blocks and the content size, which lz4::FrameReader and
+	// "lz4 -d" read. The first block is 64 KB so finding the CIA header reads little.
+	std::vector<u8> compressLz4(const u8 *data, size_t size, u32 blockSize=LZ4_MAX_BLOCK_SIZE);
+
+	u64 homeMenuTitleID(u8 region); // 0 for unknown regions
+	// Writes spec.titleCount CIAs named <title ID>.cia to dir (which must exist) and adds them to db.
+	// The hashes are of the CIAs, also for compressed packs
+	std::vector<PackTitle> makePack(const std::string& dir, const PackSpec& spec, FirmwareDb& db);
+	// The same pack as <title ID>.cia.delta files in dir. Their bases go to baseDir, which is
+	// baseSdDir on the SD card, and differ from the pack in changed percent of the content
+	std::vector<PackTitle> makeDeltaPack(const std::string& dir, const std::string& baseDir, const std::string& baseSdDir, const PackSpec& spec, u8 changed, FirmwareDb& db);
+
+	// Delta rebuilding target from base, which is at baseSdPath on the SD card. Blocks of 32
+	// bytes found anywhere in the base become COPY ops, everything else ADD ops.
+	// Throws if target isn't a CIA.
+	std::vector<u8> makeDelta(const std::vector<u8>& base, const std::vector<u8>& target, const std::string& baseSdPath);
+
+	// Text format, one "firm <version> <NATIVE_FIRM ID> <Home Menu ID>" line per pack
+	// followed by "<title ID> <SHA-256>" lines. IDs and hashes in hex.
+	bool writeFirmwareDb(const std::string& path, const FirmwareDb& db);
+	bool readFirmwareDb(const std::string& path, FirmwareDb& db);
+
+	// Packs the .cia files of dir into a bundle at path, in name order. Title IDs and versions
+	// come from inspectCia(), so dir is the SD root while this runs. Prints why it failed
+	bool writeBundle(const std::string& path, const std::string& dir, u32 align=BUNDLE_DEFAULT_ALIGN);
+
+	// Copies the .cia files of dir into the store at storeDir as <SHA-256>.cia, skipping the ones
+	// already there, and writes a manifest listing them to manifestPath. added is set to the
+	// number of CIAs that weren't in the store yet. Prints why it failed
+	bool writeStore(const std::string& manifestPath, const std::string& storeDir, const std::string& dir, u32 *added=nullptr);
+
+	bool readFile(const std::string& path, std::vector<u8>& data);
+	void writeFile(const std::string& path, const void *data, size_t size);
+	void writeFile(const std::string& path, size_t size, u8 fill=0);
+	void makeDirs(const std::string& path); // Like mkdir -p
+	void removeTree(const std::string& path);
+
+	// fileCount files of fileSize bytes, spread over dirs of filesPerDir files nested depth levels deep
+	void makeTree(const std::string& root, u32 fileCount, u32 filesPerDir, u32 depth, size_t fileSize);
+}
+
+#endif // _FIXTURES_H_
@@ -0,0 +1,391 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+// Replays a recording of the app's service calls (built with -DENABLE_IPC_RECORD)
+// against the host services. Files and dirs the recorded run found on the SD
+// card are recreated empty, with the size the run saw, in a temporary SD root.
+// Calls are replayed one after another in the order they started, so overlap
+// between threads in the recorded run isn't reproduced.
+//
+// FS calls and CIA install writes run against the host services. The
+// other AM calls, CFGU and FSUSER_UpdateSha256Context() depend on data the
+// recording doesn't have, so they only take time.
+//
+// Usage: ipcreplay [-p profile]... [-v] recording
+//   By default every call takes its recorded duration (real time).
+//   -p  Load a service model profile. FS and CIA install calls then take the
+//       modeled time instead, in virtual time. Other calls keep their recorded duration
+//   -v  Print every call
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <3ds.h>
+#include "fixtures.h"
+#include "hostctru.h"
+#include "ipc.h"
+
+struct Entry
+{
+	IpcRecord r;
+	std::vector<u8> path;
+
+	FS_Path fsPath(u32 offset, u32 size) const {return {(FS_PathType)r.pathType, size, path.data() + offset};}
+	FS_Path fsPath() const {return fsPath(0, path.size());}
+	// Both paths of a rename
+	FS_Path srcPath() const {return fsPath(0, r.arg);}
+	FS_Path dstPath() const {return fsPath(r.arg, path.size() - r.arg);}
+};
+
+struct Replay
+{
+	std::map<u32, Handle> handles;
+	std::map<u64, FS_Archive> archives;
+	std::vector<u8> data;
+	std::vector<FS_DirectoryEntry> entries;
+	u32 mismatches[IPC_CALL_COUNT] = {};
+	u32 calls[IPC_CALL_COUNT] = {};
+	u64 unmodeledUs = 0; // Recorded time of calls that don't run against the host services
+};
+
+
+static bool load(const char *path, std::vector<Entry>& entries, IpcRecordHeader& header)
+{
+	FILE *f = fopen(path, "rb");
+	if(!f) return false;
+
+	bool ok = fread(&header, sizeof(header), 1, f)==1 && header.magic==IPC_RECORD_MAGIC &&
+	          header.version==IPC_RECORD_VERSION && header.recordSize==sizeof(IpcRecord);
+	std::vector<u8> data(ok ? header.bytes : 0);
+	ok = ok && fread(data.data(), 1, data.size(), f)==data.size();
+	fclose(f);
+
+	for(u32 pos = 0; ok && pos + sizeof(IpcRecord)<=data.size(); )
+	{
+		Entry e;
+		memcpy(&e.r, data.data() + pos, sizeof(IpcRecord));
+		pos += sizeof(IpcRecord);
+		if(e.r.call>=IPC_CALL_COUNT || pos + e.r.pathSize>data.size()) return false;
+		e.path.assign(data.data() + pos, data.data() + pos + e.r.pathSize);
+		pos += (e.r.pathSize + 3) & ~3u;
+		entries.push_back(e);
+	}
+
+	// Records are written when calls end. Replay them in the order they started
+	std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {return a.r.start<b.r.start;});
+	return ok;
+}
+
+
+// UTF-8 host path relative to the SD root. Only BMP characters, which is all the app uses.
+static std::string hostPath(const FS_Path& path)
+{
+	std::string out;
+
+	if(path.type==PATH_ASCII) out.assign((const char*)path.data, strnlen((const char*)path.data, path.size));
+	else if(path.type==PATH_UTF16)
+	{
+		const u8 *p = (const u8*)path.data;
+		for(u32 i = 0; i + 1<path.size; i += 2)
+		{
+			const u32 c = p[i] | p[i + 1]<<8;
+			if(!c) break;
+			if(c<0x80) out += (char)c;
+			else if(c<0x800) {out += (char)(0xC0 | c>>6); out += (char)(0x80 | (c & 0x3F));}
+			else {out += (char)(0xE0 | c>>12); out += (char)(0x80 | (c>>6 & 0x3F)); out += (char)(0x80 | (c & 0x3F));}
+		}
+	}
+
+	return out;
+}
+
+static std::string parentDir(const std::string& path)
+{
+	const size_t pos = path.rfind('/');
+	return (pos==std::string::npos ? std::string() : path.substr(0, pos));
+}
+
+// Creates what the recorded run found on the SD card: files it opened without
+// creating them, as big as the run saw them, and dirs it didn't create itself.
+static void prepareSd(const std::string& root, const std::vector<Entry>& entries)
+{
+	std::map<u32, std::string> openFiles;
+	std::map<std::string, u64> fileSizes;
+	std::set<std::string> created, dirs;
+
+	for(const Entry& e : entries)
+	{
+		const IpcRecord& r = e.r;
+		switch(r.call)
+		{
+			case IPC_FSUSER_OPEN_FILE:
+			case IPC_FSUSER_OPEN_FILE_DIRECTLY:
+				if(r.res) break;
+				openFiles[r.handle] = hostPath(e.fsPath());
+				if(r.arg & FS_OPEN_CREATE) created.insert(openFiles[r.handle]);
+				if(!created.count(openFiles[r.handle]))
+				{
+					fileSizes[openFiles[r.handle]];
+					if(!created.count(parentDir(openFiles[r.handle]))) dirs.insert(parentDir(openFiles[r.handle]));
+				}
+				break;
+			case IPC_FSUSER_CREATE_DIRECTORY:
+				created.insert(hostPath(e.fsPath()));
+				break;
+			case IPC_FSUSER_OPEN_DIRECTORY:
+				if(!r.res && !created.count(hostPath(e.fsPath()))) dirs.insert(hostPath(e.fsPath()));
+				break;
+			case IPC_FSFILE_READ:
+			case IPC_FSFILE_GET_SIZE:
+			{
+				auto it = openFiles.find(r.handle);
+				if(it==openFiles.end() || !fileSizes.count(it->second)) break;
+				const u64 size = (r.call==IPC_FSFILE_READ ? r.arg + r.done : r.arg);
+				fileSizes[it->second] = std::max(fileSizes[it->second], size);
+				break;
+			}
+			case IPC_FSFILE_CLOSE:
+				openFiles.erase(r.handle);
+				break;
+		}
+	}
+
+	for(const std::string& dir : dirs) fixtures::makeDirs(root + dir);
+	for(auto& file : fileSizes)
+	{
+		fixtures::makeDirs(root + parentDir(file.first));
+		FILE *f = fopen((root + file.first).c_str(), "wb");
+		if(!f) continue;
+		if(file.second) {fseek(f, file.second - 1, SEEK_SET); fputc(0, f);} // Sparse
+		fclose(f);
+	}
+}
+
+
+static Handle mapped(Replay& replay, u32 handle)
+{
+	auto it = replay.handles.find(handle);
+	return (it==replay.handles.end() ? 0 : it->second);
+}
+
+// Runs one call. Returns false if it only takes time.
+static bool run(Replay& replay, const Entry& e, Result& res)
+{
+	const IpcRecord& r = e.r;
+	Handle handle = 0;
+	u32 n;
+	u64 size;
+
+	switch(r.call)
+	{
+		case IPC_FSUSER_OPEN_ARCHIVE:
+		{
+			FS_Archive archive;
+			res = FSUSER_OpenArchive(&archive, (FS_ArchiveID)r.size, e.fsPath());
+			if(!res) replay.archives[r.arg] = archive;
+			return true;
+		}
+		case IPC_FSUSER_CLOSE_ARCHIVE:
+			res = FSUSER_CloseArchive(replay.archives[r.arg]);
+			replay.archives.erase(r.arg);
+			return true;
+		// The app has only the SD card archive open. Its handle doesn't matter to the host services
+		case IPC_FSUSER_OPEN_FILE:
+			res = FSUSER_OpenFile(&handle, 0, e.fsPath(), r.arg, r.size);
+			break;
+		case IPC_FSUSER_OPEN_FILE_DIRECTLY:
+			res = FSUSER_OpenFileDirectly(&handle, (FS_ArchiveID)r.size, fsMakePath(PATH_EMPTY, ""), e.fsPath(), r.arg, 0);
+			break;
+		case IPC_FSUSER_DELETE_FILE:
+			res = FSUSER_DeleteFile(0, e.fsPath());
+			return true;
+		case IPC_FSUSER_RENAME_FILE:
+			res = FSUSER_RenameFile(0, e.srcPath(), 0, e.dstPath());
+			return true;
+		case IPC_FSUSER_OPEN_DIRECTORY:
+			res = FSUSER_OpenDirectory(&handle, 0, e.fsPath());
+			break;
+		case IPC_FSUSER_CREATE_DIRECTORY:
+			res = FSUSER_CreateDirectory(0, e.fsPath(), r.size);
+			return true;
+		case IPC_FSUSER_RENAME_DIRECTORY:
+			res = FSUSER_RenameDirectory(0, e.srcPath(), 0, e.dstPath());
+			return true;
+		case IPC_FSUSER_DELETE_DIRECTORY_RECURSIVELY:
+			res = FSUSER_DeleteDirectoryRecursively(0, e.fsPath());
+			return true;
+		case IPC_FSFILE_READ:
+			if(replay.data.size()<r.size) replay.data.resize(r.size);
+			res = FSFILE_Read(mapped(replay, r.handle), &n, r.arg, replay.data.data(), r.size);
+			return true;
+		case IPC_FSFILE_WRITE:
+			if(replay.data.size()<r.size) replay.data.resize(r.size);
+			res = FSFILE_Write(mapped(replay, r.handle), &n, r.arg, replay.data.data(), r.size, 0);
+			return true;
+		case IPC_FSFILE_GET_SIZE:
+			res = FSFILE_GetSize(mapped(replay, r.handle), &size);
+			return true;
+		case IPC_FSFILE_SET_SIZE:
+			res = FSFILE_SetSize(mapped(replay, r.handle), r.arg);
+			return true;
+		case IPC_FSFILE_FLUSH:
+			res = FSFILE_Flush(mapped(replay, r.handle));
+			return true;
+		case IPC_FSFILE_CLOSE:
+			res = FSFILE_Close(mapped(replay, r.handle));
+			replay.handles.erase(r.handle);
+			return true;
+		case IPC_FSDIR_READ:
+			if(replay.entries.size()<r.size) replay.entries.resize(r.size);
+			res = FSDIR_Read(mapped(replay, r.handle), &n, r.size, replay.entries.data());
+			return true;
+		case IPC_FSDIR_CLOSE:
+			res = FSDIR_Close(mapped(replay, r.handle));
+			replay.handles.erase(r.handle);
+			return true;
+		case IPC_AM_START_CIA_INSTALL:
+			res = AM_StartCiaInstall((FS_MediaType)r.size, &handle);
+			break;
+		// The written data is gone, so AM can't finish the install. The app closes the handle with FSFILE_Close()
+		case IPC_AM_FINISH_CIA_INSTALL:
+		case IPC_AM_CANCEL_CIA_INSTALL:
+			res = AM_CancelCIAInstall(mapped(replay, r.handle));
+			res = (res ? res : r.res);
+			return true;
+		default:
+			return false;
+	}
+
+	// Calls that created a handle
+	if(!res && !r.res) replay.handles[r.handle] = handle;
+	return true;
+}
+
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-p profile]... [-v] recording\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<const char*> profiles;
+	const char *recording = nullptr;
+	bool verbose = false;
+
+	for(int i = 1; i<argc; i++)
+	{
+		if(!strcmp(argv[i], "-p") && i + 1<argc) profiles.push_back(argv[++i]);
+		else if(!strcmp(argv[i], "-v")) verbose = true;
+		else if(argv[i][0]!='-' && !recording) recording = argv[i];
+		else return usage(argv[0]);
+	}
+	if(!recording) return usage(argv[0]);
+
+	std::vector<Entry> entries;
+	IpcRecordHeader header;
+	if(!load(recording, entries, header))
+	{
+		fprintf(stderr, "%s isn't a valid recording\n", recording);
+		return 1;
+	}
+
+	for(const char *profile : profiles)
+	{
+		if(!host::loadProfile(profile))
+		{
+			fprintf(stderr, "Can't load profile %s\n", profile);
+			return 1;
+		}
+	}
+	const bool modeled = !profiles.empty();
+	if(modeled) host::setSimTime(host::SIM_VIRTUAL_TIME);
+
+	char tmpl[] = "/tmp/sysdg-replay-XXXXXX";
+	if(!mkdtemp(tmpl))
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	const std::string sdDir = std::string(tmpl) + "/sdmc";
+	fixtures::makeDirs(sdDir);
+	prepareSd(sdDir, entries);
+	host::setSdRoot(sdDir.c_str());
+
+	Replay replay;
+	u64 recordedUs = 0, spanUs = 0;
+	const u64 clockStart = host::threadClockUs();
+	const auto wallStart = std::chrono::steady_clock::now();
+
+	for(const Entry& e : entries)
+	{
+		const IpcRecord& r = e.r;
+		const auto start = std::chrono::steady_clock::now();
+		Result res = r.res;
+
+		const bool ran = run(replay, e, res);
+		replay.calls[r.call]++;
+		if(ran && (res==0)!=(r.res==0)) replay.mismatches[r.call]++;
+		recordedUs += r.duration;
+		spanUs = std::max<u64>(spanUs, (u64)r.start + r.duration);
+
+		if(!ran && modeled) replay.unmodeledUs += r.duration;
+		else if(!modeled)
+		{
+			// Take as long as the recorded call did
+			const auto end = start + std::chrono::microseconds(r.duration);
+			if(std::chrono::steady_clock::now()<end) std::this_thread::sleep_until(end);
+		}
+
+		if(verbose)
+		{
+			printf("%10" PRIu32 " %3u %-34s res=%08" PRIX32 " replay=%08" PRIX32 " %8" PRIu32 " us\n",
+			       r.start, r.thread, ipc::callName((IpcCall)r.call), (u32)r.res, (u32)res, r.duration);
+		}
+	}
+
+	const double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+	printf("records:          %zu (%" PRIu32 " dropped while recording)\n", entries.size(), header.dropped);
+	printf("recorded span:    %.3f s\n", spanUs / 1000000.0);
+	printf("recorded service: %.3f s\n", recordedUs / 1000000.0);
+	if(modeled)
+	{
+		const u64 modeledUs = host::threadClockUs() - clockStart;
+		printf("modeled service:  %.3f s (%.3f s modeled, %.3f s recorded for calls that only take time)\n",
+		       (modeledUs + replay.unmodeledUs) / 1000000.0, modeledUs / 1000000.0, replay.unmodeledUs / 1000000.0);
+	}
+	else printf("replay:           %.3f s\n", wallMs / 1000.0);
+
+	for(u32 i = 0; i<IPC_CALL_COUNT; i++)
+	{
+		if(replay.mismatches[i])
+			printf("%s: %" PRIu32 " of %" PRIu32 " results differ\n", ipc::callName((IpcCall)i), replay.mismatches[i], replay.calls[i]);
+	}
+
+	fixtures::removeTree(tmpl);
+	return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Packs a directory of CIAs, like /updates of a firmware pack, into one
+// bundle file. Copy it to /updates.bundle on the SD card and the installer
+// uses it instead of /updates. See include/bundleformat.h for the layout.
+//
+// Usage: mkbundle [-a align] indir out.bundle
+//   -a  Alignment of the CIAs in bytes, a power of 2 (default 65536)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "fixtures.h"
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a align] indir out.bundle\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	u32 align = BUNDLE_DEFAULT_ALIGN;
+	const char *paths[2] = {nullptr, nullptr};
+	int pathCount = 0;
+
+	for(int i = 1; i<argc; i++)
+	{
+		if(!strcmp(argv[i], "-a") && i + 1<argc) align = strtoul(argv[++i], nullptr, 0);
+		else if(argv[i][0]!='-' && pathCount<2) paths[pathCount++] = argv[i];
+		else return usage(argv[0]);
+	}
+	if(pathCount!=2) return usage(argv[0]);
+
+	return (fixtures::writeBundle(paths[1], paths[0], align) ? 0 : 1);
+}
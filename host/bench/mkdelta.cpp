@@ -0,0 +1,85 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Writes a delta that rebuilds a CIA from another one, usually the same title
+// of a pack for another version or region. Copy it to /updates as
+// <title ID>.cia.delta and the base CIA to basepath on the SD card. See
+// include/deltaformat.h for the layout.
+//
+// Usage: mkdelta -b basepath base.cia target.cia out.delta
+//   -b  Absolute SD card path of the base CIA, for example /packs/11.0.0U/0004013800000002.cia
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "error.h"
+#include "fixtures.h"
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s -b basepath base.cia target.cia out.delta\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *baseSdPath = nullptr;
+	const char *paths[3] = {nullptr, nullptr, nullptr};
+	int pathCount = 0;
+
+	for(int i = 1; i<argc; i++)
+	{
+		if(!strcmp(argv[i], "-b") && i + 1<argc) baseSdPath = argv[++i];
+		else if(argv[i][0]!='-' && pathCount<3) paths[pathCount++] = argv[i];
+		else return usage(argv[0]);
+	}
+	if(!baseSdPath || pathCount!=3) return usage(argv[0]);
+
+	std::vector<u8> base, target;
+	for(int i = 0; i<2; i++)
+	{
+		if(!fixtures::readFile(paths[i], (i ? target : base)))
+		{
+			perror(paths[i]);
+			return 1;
+		}
+	}
+
+	std::vector<u8> delta;
+	try
+	{
+		delta = fixtures::makeDelta(base, target, baseSdPath);
+	}
+	catch(ResultException& e)
+	{
+		fprintf(stderr, "%s: %s\n", paths[1], e.what());
+		return 1;
+	}
+	catch(std::runtime_error& e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	fixtures::writeFile(paths[2], delta.data(), delta.size());
+	printf("%s: %zu -> %zu bytes (%zu%%)\n", paths[1], target.size(), delta.size(), (target.size() ? delta.size() * 100 / target.size() : 100));
+
+	return 0;
+}
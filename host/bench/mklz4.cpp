@@ -0,0 +1,69 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Compresses CIAs for /updates. Each file is written next to itself with .lz4
+// appended, so 0004013800000002.cia becomes 0004013800000002.cia.lz4.
+// "lz4 -B6 -BI --content-size" writes frames the installer reads, too.
+//
+// Usage: mklz4 [-B size] file...
+//   -B  Block size in bytes, 65536 to 1048576 (default 1048576)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "fixtures.h"
+#include "lz4.h"
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-B size] file...\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	u32 blockSize = LZ4_MAX_BLOCK_SIZE;
+	std::vector<const char*> files;
+
+	for(int i = 1; i<argc; i++)
+	{
+		if(!strcmp(argv[i], "-B") && i + 1<argc) blockSize = strtoul(argv[++i], nullptr, 0);
+		else if(argv[i][0]!='-') files.push_back(argv[i]);
+		else return usage(argv[0]);
+	}
+	if(files.empty() || blockSize<0x10000 || blockSize>LZ4_MAX_BLOCK_SIZE) return usage(argv[0]);
+
+	for(const char *path : files)
+	{
+		std::vector<u8> data;
+		if(!fixtures::readFile(path, data))
+		{
+			perror(path);
+			return 1;
+		}
+
+		const std::vector<u8> frame = fixtures::compressLz4(data.data(), data.size(), blockSize);
+		fixtures::writeFile(std::string(path) + ".lz4", frame.data(), frame.size());
+		printf("%s: %zu -> %zu bytes (%zu%%)\n", path, data.size(), frame.size(), (data.size() ? frame.size() * 100 / data.size() : 100));
+	}
+
+	return 0;
+}
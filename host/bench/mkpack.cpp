@@ -0,0 +1,154 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// Generates a synthetic firmware pack for scale testing: structurally valid
+// CIAs in <outdir>/updates and the matching hash DB in <outdir>/hashes.db.
+// The CIAs only pass the checks of the host build, they don't install on a 3DS.
+//
+// Usage: mkpack [-n count] [-s min:max] [-d uniform|skewed] [-v version] [-r region] [-N] [-S seed] [-e percent] [-z] [-D percent] [-b] [-t] outdir
+//   -n  Number of titles including NATIVE_FIRM and Home Menu (2 to 5000, default 100)
+//   -s  Content size range in bytes (default 4096:1048576)
+//   -d  Size distribution (default skewed)
+//   -v  NATIVE_FIRM version (default 17120)
+//   -r  CFG_REGION_* number (default 1, USA)
+//   -N  New 3DS pack
+//   -S  Random seed (default 1)
+//   -e  Percent of the content that is random instead of compressible filler (default 0)
+//   -z  Write LZ4 compressed <title ID>.cia.lz4 files, see mklz4
+//   -D  Write <title ID>.cia.delta files against a base pack in <outdir>/base which
+//       differs in percent of the content, see mkdelta
+//   -b  Write <outdir>/updates.bundle instead of <outdir>/updates, see mkbundle
+//   -t  Write <outdir>/updates.manifest and the CIAs to the store in <outdir>/cias
+//       instead of <outdir>/updates, see mkstore
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "fixtures.h"
+#include "install.h"
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-n count] [-s min:max] [-d uniform|skewed] [-v version] [-r region] [-N] [-S seed] [-e percent] [-z] [-D percent] [-b] [-t] outdir\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	fixtures::PackSpec spec = {100, 0x1000, 0x100000, fixtures::SIZES_SKEWED, 17120, false, CFG_REGION_USA, 1};
+	const char *outDir = nullptr;
+	bool bundle = false;
+	bool store = false;
+	int changed = -1;
+
+	for(int i = 1; i<argc; i++)
+	{
+		const bool hasArg = i + 1<argc;
+
+		if(!strcmp(argv[i], "-n") && hasArg) spec.titleCount = strtoul(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-s") && hasArg)
+		{
+			unsigned long minSize, maxSize;
+			if(sscanf(argv[++i], "%lu:%lu", &minSize, &maxSize)!=2 || minSize>maxSize) return usage(argv[0]);
+			spec.minSize = minSize;
+			spec.maxSize = maxSize;
+		}
+		else if(!strcmp(argv[i], "-d") && hasArg)
+		{
+			i++;
+			if(!strcmp(argv[i], "uniform")) spec.sizes = fixtures::SIZES_UNIFORM;
+			else if(!strcmp(argv[i], "skewed")) spec.sizes = fixtures::SIZES_SKEWED;
+			else return usage(argv[0]);
+		}
+		else if(!strcmp(argv[i], "-v") && hasArg) spec.firmVersion = strtoul(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-r") && hasArg) spec.region = strtoul(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-N")) spec.n3ds = true;
+		else if(!strcmp(argv[i], "-S") && hasArg) spec.seed = strtoul(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-e") && hasArg) spec.entropy = strtoul(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-z")) spec.compress = true;
+		else if(!strcmp(argv[i], "-D") && hasArg) changed = strtoul(argv[++i], nullptr, 0);
+		else if(!strcmp(argv[i], "-b")) bundle = true;
+		else if(!strcmp(argv[i], "-t")) store = true;
+		else if(argv[i][0]!='-' && !outDir) outDir = argv[i];
+		else return usage(argv[0]);
+	}
+
+	if(!outDir) return usage(argv[0]);
+	if(spec.titleCount<2 || spec.titleCount>5000)
+	{
+		fprintf(stderr, "Title count must be between 2 and 5000\n");
+		return 1;
+	}
+	if(spec.entropy>100 || changed>100 || (spec.compress + (changed>=0) + bundle + store)>1)
+	{
+		fprintf(stderr, "Entropy and changes are percentages. Bundles, stores, compression and deltas don't mix\n");
+		return 1;
+	}
+	if(!fixtures::homeMenuTitleID(spec.region))
+	{
+		fprintf(stderr, "Unknown region %u\n", spec.region);
+		return 1;
+	}
+
+	const std::string updatesDir = std::string(outDir) + "/updates";
+	fixtures::makeDirs(updatesDir);
+
+	FirmwareDb db;
+	std::vector<fixtures::PackTitle> titles;
+	if(changed>=0)
+	{
+		fixtures::makeDirs(std::string(outDir) + "/base");
+		titles = fixtures::makeDeltaPack(updatesDir, std::string(outDir) + "/base", "/base", spec, changed, db);
+	}
+	else titles = fixtures::makePack(updatesDir, spec, db);
+	if(!fixtures::writeFirmwareDb(std::string(outDir) + "/hashes.db", db))
+	{
+		perror("hashes.db");
+		return 1;
+	}
+
+	if(bundle)
+	{
+		const std::string bundlePath = std::string(outDir) + "/updates.bundle";
+		if(!fixtures::writeBundle(bundlePath, updatesDir)) return 1;
+		fixtures::removeTree(updatesDir);
+		printf("%zu titles in %s\n", titles.size(), bundlePath.c_str());
+		return 0;
+	}
+	if(store)
+	{
+		const std::string manifestPath = std::string(outDir) + "/updates.manifest";
+		u32 added;
+		if(!fixtures::writeStore(manifestPath, std::string(outDir) + "/cias", updatesDir, &added)) return 1;
+		fixtures::removeTree(updatesDir);
+		printf("%zu titles in %s, %u new in the store\n", titles.size(), manifestPath.c_str(), added);
+		return 0;
+	}
+
+	u64 totalSize = 0;
+	for(auto& title : titles) totalSize += title.size;
+	printf("%zu titles, %" PRIu64 " bytes%s in %s\n", titles.size(), totalSize, (spec.compress ? " before compression" : changed>=0 ? " rebuilt from deltas" : ""), updatesDir.c_str());
+
+	return 0;
+}
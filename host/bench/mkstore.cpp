@@ -0,0 +1,47 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+// Adds the CIAs of a directory, like /updates of a firmware pack, to a
+// content-addressed store and writes the pack's manifest. Run it once per
+// pack with the same store: CIAs the packs have in common are stored once.
+// Copy the store to /cias and one manifest to /updates.manifest on the SD
+// card and the installer uses them instead of /updates. See
+// include/storeformat.h for the layout.
+//
+// Usage: mkstore storedir indir out.manifest
+
+#include <cstdio>
+#include "fixtures.h"
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s storedir indir out.manifest\n", name);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	u32 added;
+
+	if(argc!=4 || argv[1][0]=='-') return usage(argv[0]);
+	if(!fixtures::writeStore(argv[3], argv[1], argv[2], &added)) return 1;
+
+	printf("%u new CIAs in %s\n", added, argv[1]);
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+// Predicts how long installing a firmware pack takes with the given service
+// models. Runs installUpdates() in virtual time (host::SIM_VIRTUAL_TIME) on a
+// directory laid out like mkpack's output: the pack in <packdir>/updates and
+// its hash DB in <packdir>/hashes.db. Nothing is installed for real, the NAND
+// title database is simulated and empty at the start.
+//
+// Usage: predict [-p profile]... [-d] [-s] [-r] [-i] [-m] [-b KB] packdir
+//   -p  Load a service model profile, see host/profiles. Later files override earlier ones
+//   -d  Downgrade
+//   -s  Without the I/O thread (fs::ioQueueInit())
+//   -r  Record the service calls to IPC_RECORD_FILE_PATH, see ipcreplay
+//   -i  Print the modeled count, bytes and latency histogram of every service call
+//   -m  Print the heap usage of every install phase. It includes the allocations of the host services
+//   -b  Heap budget in KB above which the install warns (MEM_BUDGET)
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <3ds.h>
+#include "fixtures.h"
+#include "fs.h"
+#include "hostctru.h"
+#include "install.h"
+#include "ipc.h"
+#include "memtrack.h"
+
+
+static int usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-p profile]... [-d] [-s] [-r] [-i] [-m] [-b KB] packdir\n", name);
+	return 1;
+}
+
+// The console and region the pack is for
+static bool packTarget(const FirmwareDb& db, bool& n3ds, u8& region)
+{
+	for(auto& version : db)
+		for(auto& device : version.second)
+			for(auto& regionHashes : device.second)
+				for(u8 r = CFG_REGION_JPN; r<=CFG_REGION_TWN; r++)
+				{
+					if(fixtures::homeMenuTitleID(r)!=regionHashes.first) continue;
+					n3ds = (device.first==0x0004013820000002ULL);
+					region = r;
+					return true;
+				}
+
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<const char*> profiles;
+	bool downgrade = false, ioThread = true, record = false, stats = false, memStats = false;
+	const char *packDir = nullptr;
+
+	for(int i = 1; i<argc; i++)
+	{
+		if(!strcmp(argv[i], "-p") && i + 1<argc) profiles.push_back(argv[++i]);
+		else if(!strcmp(argv[i], "-d")) downgrade = true;
+		else if(!strcmp(argv[i], "-s")) ioThread = false;
+		else if(!strcmp(argv[i], "-r")) record = true;
+		else if(!strcmp(argv[i], "-i")) stats = true;
+		else if(!strcmp(argv[i], "-m")) memStats = true;
+		else if(!strcmp(argv[i], "-b") && i + 1<argc) mem::setBudget(strtoull(argv[++i], nullptr, 0) * 1024);
+		else if(argv[i][0]!='-' && !packDir) packDir = argv[i];
+		else return usage(argv[0]);
+	}
+	if(!packDir) return usage(argv[0]);
+
+	for(const char *profile : profiles)
+	{
+		if(!host::loadProfile(profile))
+		{
+			fprintf(stderr, "Can't load profile %s\n", profile);
+			return 1;
+		}
+	}
+
+	FirmwareDb db;
+	bool n3ds;
+	u8 region;
+	if(!fixtures::readFirmwareDb(std::string(packDir) + "/hashes.db", db) || !packTarget(db, n3ds, region))
+	{
+		fprintf(stderr, "No usable hash DB in %s\n", packDir);
+		return 1;
+	}
+
+	// The app's console output goes nowhere
+	FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+	fflush(stdout);
+	const int devNull = open("/dev/null", O_WRONLY);
+	dup2(devNull, STDOUT_FILENO);
+	close(devNull);
+
+	host::setSdRoot(packDir);
+	host::setNew3DS(n3ds);
+	host::setRegion(region);
+	host::setSimTime(host::SIM_VIRTUAL_TIME);
+	setFirmwareDb(&db);
+	sdmcArchiveInit();
+	if(ioThread) fs::ioQueueInit();
+	amInit();
+
+	ipc::resetStats();
+	if(record) ipc::recordInit();
+	const u64 start = host::threadClockUs();
+	std::string error;
+	{
+		Installer installer(downgrade);
+		InstallMsg msg;
+
+		for(bool finished = false; !finished; )
+		{
+			finished = installer.finished();
+			while(installer.poll(msg))
+			{
+				if(msg.type==INSTALL_MSG_PROMPT) installer.answer(true);
+				else if(msg.type==INSTALL_MSG_FAILED) error = msg.text;
+			}
+			if(!finished) usleep(1000);
+		}
+	}
+	const u64 us = host::threadClockUs() - start; // Joining the installer passed its clock on
+	if(record) ipc::recordExit();
+
+	amExit();
+	fs::ioQueueExit();
+	sdmcArchiveExit();
+	setFirmwareDb(nullptr);
+
+	if(!error.empty())
+	{
+		fprintf(stderr, "Install failed: %s\n", error.c_str());
+		return 1;
+	}
+
+	const host::Counters cnt = host::counters();
+	fprintf(out, "titles installed: %zu\n", host::titles().size());
+	fprintf(out, "SD read:          %" PRIu64 " bytes in %" PRIu64 " calls\n", cnt.bytesRead, cnt.fileReads);
+	fprintf(out, "NAND written:     %" PRIu64 " bytes\n", cnt.bytesInstalled);
+	fprintf(out, "IPC calls:        %" PRIu64 " FS, %" PRIu64 " AM\n", cnt.fsCalls, cnt.amCalls);
+	fprintf(out, "predicted time:   %.3f s\n", us / 1000000.0);
+	if(stats)
+	{
+		fputc('\n', out);
+		ipc::dumpStats(out);
+	}
+	if(memStats)
+	{
+		fputc('\n', out);
+		mem::dumpStats(out);
+	}
+	fclose(out);
+
+	return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// Host stand-in for the parts of libctru sysDowngrader uses. Only the
+// declarations live here. The implementations are in host/source and
+// simulate the services on top of the host OS (see hostctru.h).
+
+#ifndef _HOST_3DS_H_
+#define _HOST_3DS_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+typedef volatile u8  vu8;
+typedef volatile u16 vu16;
+typedef volatile u32 vu32;
+typedef volatile u64 vu64;
+
+typedef s32 Result;
+typedef u32 Handle;
+
+#define BIT(n)            (1U<<(n))
+#define U64_MAX           UINT64_MAX
+#define R_SUCCEEDED(res)  ((res)>=0)
+#define R_FAILED(res)     ((res)<0)
+
+#define SYSCLOCK_ARM11    (268111856)
+#define CUR_THREAD_HANDLE (0xFFFF8000)
+
+
+
+//---------------------------------------------------------------------------------
+// Kernel and threads
+//---------------------------------------------------------------------------------
+typedef enum
+{
+	RESET_ONESHOT = 0,
+	RESET_STICKY  = 1,
+	RESET_PULSE   = 2
+} ResetType;
+
+typedef struct {pthread_mutex_t mutex;} LightLock;
+typedef struct Thread_tag* Thread;
+typedef void (*ThreadFunc)(void*);
+
+Result svcCreateEvent(Handle* event, ResetType reset_type);
+Result svcSignalEvent(Handle handle);
+Result svcClearEvent(Handle handle);
+Result svcCreateSemaphore(Handle* semaphore, s32 initial_count, s32 max_count);
+Result svcReleaseSemaphore(s32* count, Handle semaphore, s32 release_count);
+Result svcWaitSynchronization(Handle handle, s64 nanoseconds);
+Result svcCloseHandle(Handle handle);
+Result svcGetThreadPriority(s32* out, Handle handle);
+Result svcGetThreadId(u32* out, Handle handle);
+void   svcSleepThread(s64 ns);
+u64    svcGetSystemTick(void);
+u64    osGetTime(void);
+
+Thread threadCreate(ThreadFunc entrypoint, void* arg, size_t stack_size, int prio, int affinity, bool detached);
+Result threadJoin(Thread thread, u64 timeout_ns);
+void   threadFree(Thread thread);
+
+void LightLock_Init(LightLock* lock);
+void LightLock_Lock(LightLock* lock);
+void LightLock_Unlock(LightLock* lock);
+
+Result srvGetServiceHandleDirect(Handle* out, const char* name);
+
+
+
+//---------------------------------------------------------------------------------
+// FS
+//---------------------------------------------------------------------------------
+typedef u64 FS_Archive;
+
+typedef enum
+{
+	PATH_INVALID = 0,
+	PATH_EMPTY   = 1,
+	PATH_BINARY  = 2,
+	PATH_ASCII   = 3,
+	PATH_UTF16   = 4
+} FS_PathType;
+
+typedef struct
+{
+	FS_PathType type;
+	u32 size;
+	const void* data;
+} FS_Path;
+
+typedef enum
+{
+	MEDIATYPE_NAND      = 0,
+	MEDIATYPE_SD        = 1,
+	MEDIATYPE_GAME_CARD = 2
+} FS_MediaType;
+
+typedef enum
+{
+	ARCHIVE_SDMC                  = 0x00000009,
+	ARCHIVE_SAVEDATA_AND_CONTENT  = 0x2345678A
+} FS_ArchiveID;
+
+enum
+{
+	FS_OPEN_READ   = BIT(0),
+	FS_OPEN_WRITE  = BIT(1),
+	FS_OPEN_CREATE = BIT(2)
+};
+
+enum
+{
+	FS_WRITE_FLUSH       = BIT(0),
+	FS_WRITE_UPDATE_TIME = BIT(8)
+};
+
+enum
+{
+	FS_ATTRIBUTE_DIRECTORY = BIT(0),
+	FS_ATTRIBUTE_HIDDEN    = BIT(8),
+	FS_ATTRIBUTE_ARCHIVE   = BIT(16),
+	FS_ATTRIBUTE_READ_ONLY = BIT(24)
+};
+
+typedef struct
+{
+	u16 name[0x106];
+	char shortName[0x0A];
+	char shortExt[0x04];
+	u8 valid;
+	u8 reserved;
+	u32 attributes;
+	u64 fileSize;
+} FS_DirectoryEntry;
+
+FS_Path fsMakePath(FS_PathType type, const void* path);
+
+Result FSUSER_OpenArchive(FS_Archive* archive, FS_ArchiveID id, FS_Path path);
+Result FSUSER_CloseArchive(FS_Archive archive);
+Result FSUSER_OpenFile(Handle* out, FS_Archive archive, FS_Path path, u32 openFlags, u32 attributes);
+Result FSUSER_OpenFileDirectly(Handle* out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes);
+Result FSUSER_DeleteFile(FS_Archive archive, FS_Path path);
+Result FSUSER_RenameFile(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath);
+Result FSUSER_OpenDirectory(Handle* out, FS_Archive archive, FS_Path path);
+Result FSUSER_CreateDirectory(FS_Archive archive, FS_Path path, u32 attributes);
+Result FSUSER_RenameDirectory(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath);
+Result FSUSER_DeleteDirectoryRecursively(FS_Archive archive, FS_Path path);
+Result FSUSER_UpdateSha256Context(const void* data, u32 inputSize, u8* hash);
+
+Result FSFILE_Read(Handle handle, u32* bytesRead, u64 offset, void* buffer, u32 size);
+Result FSFILE_Write(Handle handle, u32* bytesWritten, u64 offset, const void* buffer, u32 size, u32 flags);
+Result FSFILE_GetSize(Handle handle, u64* size);
+Result FSFILE_SetSize(Handle handle, u64 size);
+Result FSFILE_Flush(Handle handle);
+Result FSFILE_Close(Handle handle);
+
+Result FSDIR_Read(Handle handle, u32* entriesRead, u32 entryCount, FS_DirectoryEntry* entries);
+Result FSDIR_Close(Handle handle);
+
+
+
+//---------------------------------------------------------------------------------
+// AM
+//---------------------------------------------------------------------------------
+typedef struct
+{
+	u64 titleID;
+	u64 size;
+	u16 version;
+	u8 unk[6];
+} AM_TitleEntry;
+
+Result amInit(void);
+void   amExit(void);
+Result AM_GetTitleCount(FS_MediaType mediatype, u32* count);
+Result AM_GetTitleList(u32* titlesRead, FS_MediaType mediatype, u32 titleCount, u64* titleIds);
+Result AM_GetTitleInfo(FS_MediaType mediatype, u32 titleCount, u64* titleIds, AM_TitleEntry* titleInfo);
+Result AM_GetTitleProductCode(FS_MediaType mediatype, u64 titleId, char* productCode);
+Result AM_GetCiaFileInfo(FS_MediaType mediatype, AM_TitleEntry* titleEntry, Handle fileHandle);
+Result AM_StartCiaInstall(FS_MediaType mediatype, Handle* ciaHandle);
+Result AM_FinishCiaInstall(Handle ciaHandle);
+Result AM_CancelCIAInstall(Handle ciaHandle);
+Result AM_DeleteTitle(FS_MediaType mediatype, u64 titleID);
+Result AM_DeleteAppTitle(FS_MediaType mediatype, u64 titleID);
+Result AM_InstallFirm(u64 titleID);
+
+
+
+//---------------------------------------------------------------------------------
+// CFG, APT, HID, GFX, console
+//---------------------------------------------------------------------------------
+typedef enum
+{
+	CFG_REGION_JPN = 0,
+	CFG_REGION_USA = 1,
+	CFG_REGION_EUR = 2,
+	CFG_REGION_AUS = 3,
+	CFG_REGION_CHN = 4,
+	CFG_REGION_KOR = 5,
+	CFG_REGION_TWN = 6
+} CFG_Region;
+
+typedef enum
+{
+	APPID_HOMEMENU = 0x101
+} NS_APPID;
+
+enum
+{
+	KEY_A      = BIT(0),
+	KEY_B      = BIT(1),
+	KEY_SELECT = BIT(2),
+	KEY_START  = BIT(3),
+	KEY_X      = BIT(10),
+	KEY_Y      = BIT(11)
+};
+
+typedef enum
+{
+	GSP_RGBA8_OES  = 0,
+	GSP_BGR8_OES   = 1,
+	GSP_RGB565_OES = 2
+} GSPGPU_FramebufferFormats;
+
+typedef enum
+{
+	GFX_TOP    = 0,
+	GFX_BOTTOM = 1
+} gfxScreen_t;
+
+typedef struct PrintConsole PrintConsole;
+
+Result cfguInit(void);
+void   cfguExit(void);
+Result CFGU_SecureInfoGetRegion(u8* region);
+
+bool   aptMainLoop(void);
+Result APT_CheckNew3DS(bool* out);
+Result APT_HardwareResetAsync(void);
+Result APT_PrepareToStartSystemApplet(NS_APPID appID);
+Result APT_StartSystemApplet(NS_APPID appID, const void* param, size_t paramSize, Handle handle);
+Result APT_PrepareToDoApplicationJump(u8 flags, u64 programID, u8 mediatype);
+Result APT_DoApplicationJump(const void* param, size_t paramSize, const void* hmac);
+
+void hidScanInput(void);
+u32  hidKeysDown(void);
+
+void gfxInit(GSPGPU_FramebufferFormats topFormat, GSPGPU_FramebufferFormats bottomFormat, bool vrambuffers);
+void gfxExit(void);
+void gfxFlushBuffers(void);
+void gfxSwapBuffers(void);
+void gspWaitForVBlank(void);
+
+PrintConsole* consoleInit(gfxScreen_t screen, PrintConsole* console);
+void consoleClear(void);
+
+#endif // _HOST_3DS_H_
@@ -0,0 +1,120 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _HOSTCTRU_H_
+#define _HOSTCTRU_H_
+
+#include <vector>
+#include <3ds.h>
+
+// Result codes the simulated services return
+#define HOST_ERR_NOT_FOUND      ((Result)0xC8804478)
+#define HOST_ERR_ALREADY_EXISTS ((Result)0xC82044BE)
+#define HOST_ERR_INVALID_HANDLE ((Result)0xD8E007F7)
+#define HOST_ERR_INVALID_CIA    ((Result)0xD8A083FA)
+#define HOST_ERR_TIMEOUT        ((Result)0x09401BFE)
+
+
+
+// Configuration and inspection of the simulated 3DS services.
+// Nothing here exists on the device.
+namespace host
+{
+	// Every call takes latencyUs. Transfers additionally take size / bytesPerSec
+	// while holding the device, so concurrent transfers on the same device are
+	// serialized. A transfer that doesn't continue where the previous one on the
+	// device ended costs seekUs more. 0 disables any part.
+	struct ServiceModel
+	{
+		u32 latencyUs;          // IPC overhead per call
+		u64 bytesPerSec;        // Sequential bandwidth
+		u32 seekUs;
+		u32 finishUs;           // AM_FinishCiaInstall(), NAND only
+		u32 finishTailUs;       // Extra AM_FinishCiaInstall() time for finishTailPercent of the installs
+		u32 finishTailPercent;
+	};
+
+	// SIM_REAL_TIME sleeps for the modeled time. SIM_VIRTUAL_TIME doesn't sleep and
+	// advances a per-thread clock instead. Events, semaphores, thread creation and
+	// joins pass it on like the real waits would, so a whole install can be predicted
+	// in a fraction of its real time. CPU time of the app is only part of the clock
+	// with a CPU scale, see setCpuScale().
+	enum SimTime
+	{
+		SIM_REAL_TIME = 0,
+		SIM_VIRTUAL_TIME
+	};
+
+	struct Counters
+	{
+		u64 fsCalls;      // FSUSER_* and FSFILE_*/FSDIR_* calls
+		u64 amCalls;
+		u64 fileReads;
+		u64 fileWrites;
+		u64 dirReads;
+		u64 bytesRead;    // From the SD card
+		u64 bytesWritten; // To the SD card
+		u64 bytesInstalled;
+	};
+
+	struct TitleRecord
+	{
+		AM_TitleEntry entry;
+		char productCode[16];
+	};
+
+	// SD card. Paths are relative to root. The default root is "sdmc" in the working directory.
+	void setSdRoot(const char *root);
+	const char* sdRoot();
+	void setSdModel(const ServiceModel& model);
+	ServiceModel sdModel();
+
+	// Simulated NAND title database
+	void setNandModel(const ServiceModel& model); // Used for AM calls and CIA writes
+	ServiceModel nandModel();
+	void clearTitles();
+	void addTitle(u64 titleID, u16 version, u64 size, const char *productCode="");
+	bool findTitle(u64 titleID, TitleRecord& record);
+	std::vector<TitleRecord> titles();
+	u64 installedFirm(); // Title ID passed to the last AM_InstallFirm(), 0 if none
+
+	// Modeled time
+	void setSimTime(SimTime mode);
+	u64  threadClockUs(); // Virtual clock of the calling thread
+	// In virtual time the user CPU time a thread uses between service calls is multiplied
+	// by scale and added to its clock. Roughly how much slower the console's CPU is than
+	// the host's. It matters for work like decompression. 0 (the default) disables it.
+	void setCpuScale(u32 scale);
+	u32  cpuScale();
+	// "key = value" lines like "sd.bytesPerSec = 18000000", "nand.finishUs = 40000" or "cpu.scale = 40".
+	// Keys missing from the file keep their value, so console and SD card profiles can
+	// be loaded one after another. See host/profiles. False if the file can't be parsed.
+	bool loadProfile(const char *path);
+
+	// System
+	void setNew3DS(bool isNew3DS);
+	void setRegion(u8 region);
+	void setKeysDown(u32 keys); // Returned by hidKeysDown() until changed
+
+	Counters counters();
+	void resetCounters();
+}
+
+#endif // _HOSTCTRU_H_
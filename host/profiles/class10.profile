@@ -0,0 +1,3 @@
+# Class 10 SD card. Load after a console profile.
+sd.bytesPerSec = 18000000
+sd.seekUs = 800
@@ -0,0 +1,3 @@
+# Class 4 SD card. Load after a console profile.
+sd.bytesPerSec = 5000000
+sd.seekUs = 2500
@@ -0,0 +1,12 @@
+# New 3DS: IPC overhead of both devices and the NAND.
+# Starting points for tuning, not measurements. Replace them with timings
+# from your own console (see the TRACE_* zones of the device build).
+sd.latencyUs = 35
+nand.latencyUs = 35
+nand.bytesPerSec = 10000000
+nand.seekUs = 200
+nand.finishUs = 25000
+nand.finishTailUs = 350000
+nand.finishTailPercent = 5
+# ARM11 at 804 MHz against a 3 GHz desktop core, see o3ds.profile
+cpu.scale = 8
@@ -0,0 +1,13 @@
+# Old 3DS: IPC overhead of both devices and the NAND.
+# Starting points for tuning, not measurements. Replace them with timings
+# from your own console (see the TRACE_* zones of the device build).
+sd.latencyUs = 60
+nand.latencyUs = 60
+nand.bytesPerSec = 7000000
+nand.seekUs = 300
+nand.finishUs = 40000
+nand.finishTailUs = 500000
+nand.finishTailPercent = 5
+# ARM11 at 268 MHz against a 3 GHz desktop core: the clock ratio times 2 for the
+# in-order pipeline. Matters for decompression and software hashing
+cpu.scale = 25
@@ -0,0 +1,315 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// AM on top of an in-memory title database standing in for the NAND
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <3ds.h>
+#include "hostctru.h"
+#include "internal.h"
+
+#define CIA_KEEP_SIZE (0x10000) // Enough of the start of a CIA to find the TMD
+
+
+namespace host
+{
+	struct CiaInstall : public Object
+	{
+		std::mutex mutex;
+		std::vector<u8> head; // Start of the CIA, to read the TMD from on finish
+		u64 size = 0;
+		bool done = false;
+
+		CiaInstall() : Object(OBJ_CIA) {}
+	};
+
+	struct Nand
+	{
+		std::mutex mutex;
+		std::map<u64, TitleRecord> titles;
+		u64 firm = 0;
+	};
+
+	static Nand& nand()
+	{
+		static Nand n;
+		return n;
+	}
+
+
+	void clearTitles()
+	{
+		std::lock_guard<std::mutex> lock(nand().mutex);
+		nand().titles.clear();
+		nand().firm = 0;
+	}
+
+	void addTitle(u64 titleID, u16 version, u64 size, const char *productCode)
+	{
+		TitleRecord record;
+
+		memset(&record, 0, sizeof(record));
+		record.entry.titleID = titleID;
+		record.entry.version = version;
+		record.entry.size = size;
+		strncpy(record.productCode, productCode, sizeof(record.productCode) - 1);
+
+		std::lock_guard<std::mutex> lock(nand().mutex);
+		nand().titles[titleID] = record;
+	}
+
+	bool findTitle(u64 titleID, TitleRecord& record)
+	{
+		std::lock_guard<std::mutex> lock(nand().mutex);
+
+		auto it = nand().titles.find(titleID);
+		if(it==nand().titles.end()) return false;
+		record = it->second;
+		return true;
+	}
+
+	std::vector<TitleRecord> titles()
+	{
+		std::lock_guard<std::mutex> lock(nand().mutex);
+		std::vector<TitleRecord> list;
+
+		for(const auto& it : nand().titles) list.push_back(it.second);
+		return list;
+	}
+
+	u64 installedFirm()
+	{
+		std::lock_guard<std::mutex> lock(nand().mutex);
+		return nand().firm;
+	}
+
+
+	static u32 be32(const u8 *p) {return (u32)p[0]<<24 | (u32)p[1]<<16 | (u32)p[2]<<8 | p[3];}
+	static u32 le32(const u8 *p) {return (u32)p[3]<<24 | (u32)p[2]<<16 | (u32)p[1]<<8 | p[0];}
+
+	static u32 signatureSize(u32 sigType)
+	{
+		switch(sigType)
+		{
+			case 0x10000:
+			case 0x10003:
+				return 0x200 + 0x3C;
+			case 0x10001:
+			case 0x10004:
+				return 0x100 + 0x3C;
+			case 0x10002:
+			case 0x10005:
+				return 0x3C + 0x40;
+		}
+
+		return 0;
+	}
+
+	bool parseCia(std::function<bool (u64 offset, void *buf, u32 size)> read, AM_TitleEntry& entry)
+	{
+		u8 header[0x20], tmd[0x240];
+		auto align = [](u64 v) {return (v + 63) & ~63ULL;};
+
+		if(!read(0, header, sizeof(header))) return false;
+
+		const u32 headerSize = le32(header), certSize = le32(header + 0x8), ticketSize = le32(header + 0xC), tmdSize = le32(header + 0x10);
+		u64 contentSize;
+		memcpy(&contentSize, header + 0x18, 8);
+		if(headerSize!=0x2020 || !tmdSize) return false;
+
+		const u64 tmdOffset = align(align(align(headerSize) + certSize) + ticketSize);
+		if(!read(tmdOffset, tmd, 4)) return false;
+		const u32 sigSize = signatureSize(be32(tmd));
+		if(!sigSize || 4 + sigSize + 0xC4>tmdSize) return false;
+		if(!read(tmdOffset + 4 + sigSize, tmd, 0xC4)) return false;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.titleID = (u64)be32(tmd + 0x4C)<<32 | be32(tmd + 0x50);
+		entry.version = (u16)(tmd[0x9C]<<8 | tmd[0x9D]);
+		entry.size = contentSize;
+		return true;
+	}
+
+
+	Result writeCia(Handle handle, u32 *bytesWritten, u64 offset, const void *buf, u32 size)
+	{
+		auto cia = getHandle<CiaInstall>(handle, OBJ_CIA);
+		if(!cia) return HOST_ERR_INVALID_HANDLE;
+
+		{
+			std::lock_guard<std::mutex> lock(cia->mutex);
+			if(cia->done) return HOST_ERR_INVALID_HANDLE;
+			if(offset<CIA_KEEP_SIZE)
+			{
+				const u64 end = std::min<u64>(offset + size, CIA_KEEP_SIZE);
+				if(cia->head.size()<end) cia->head.resize(end);
+				memcpy(cia->head.data() + offset, buf, end - offset);
+			}
+			cia->size = std::max<u64>(cia->size, offset + size);
+		}
+
+		count(&Counters::amCalls);
+		count(&Counters::bytesInstalled, size);
+		simulate(DEVICE_NAND, size, handle, offset);
+		*bytesWritten = size;
+		return 0;
+	}
+
+
+	static void amCall()
+	{
+		count(&Counters::amCalls);
+		simulate(DEVICE_NAND, 0);
+	}
+}
+
+using namespace host;
+
+
+
+Result amInit(void) {return 0;}
+void amExit(void) {}
+
+Result AM_GetTitleCount(FS_MediaType mediatype, u32* count)
+{
+	amCall();
+	std::lock_guard<std::mutex> lock(nand().mutex);
+	*count = (mediatype==MEDIATYPE_NAND ? nand().titles.size() : 0);
+	return 0;
+}
+
+Result AM_GetTitleList(u32* titlesRead, FS_MediaType mediatype, u32 titleCount, u64* titleIds)
+{
+	u32 n = 0;
+
+	amCall();
+	std::lock_guard<std::mutex> lock(nand().mutex);
+	if(mediatype==MEDIATYPE_NAND)
+	{
+		for(auto it = nand().titles.begin(); it!=nand().titles.end() && n<titleCount; ++it) titleIds[n++] = it->first;
+	}
+	*titlesRead = n;
+	return 0;
+}
+
+Result AM_GetTitleInfo(FS_MediaType mediatype, u32 titleCount, u64* titleIds, AM_TitleEntry* titleInfo)
+{
+	amCall();
+	std::lock_guard<std::mutex> lock(nand().mutex);
+	for(u32 i = 0; i<titleCount; i++)
+	{
+		auto it = nand().titles.find(titleIds[i]);
+		if(it==nand().titles.end()) return HOST_ERR_NOT_FOUND;
+		titleInfo[i] = it->second.entry;
+	}
+	return 0;
+}
+
+Result AM_GetTitleProductCode(FS_MediaType mediatype, u64 titleId, char* productCode)
+{
+	amCall();
+	std::lock_guard<std::mutex> lock(nand().mutex);
+	auto it = nand().titles.find(titleId);
+	if(it==nand().titles.end()) return HOST_ERR_NOT_FOUND;
+	memcpy(productCode, it->second.productCode, 16);
+	return 0;
+}
+
+// AM reads the CIA itself, so the reads show up as SD traffic
+Result AM_GetCiaFileInfo(FS_MediaType mediatype, AM_TitleEntry* titleEntry, Handle fileHandle)
+{
+	amCall();
+	auto read = [fileHandle](u64 offset, void *buf, u32 size)
+	{
+		u32 bytesRead;
+		return !FSFILE_Read(fileHandle, &bytesRead, offset, buf, size) && bytesRead==size;
+	};
+
+	return (parseCia(read, *titleEntry) ? 0 : HOST_ERR_INVALID_CIA);
+}
+
+Result AM_StartCiaInstall(FS_MediaType mediatype, Handle* ciaHandle)
+{
+	amCall();
+	*ciaHandle = createHandle(std::make_shared<CiaInstall>());
+	return 0;
+}
+
+Result AM_FinishCiaInstall(Handle ciaHandle)
+{
+	auto cia = getHandle<CiaInstall>(ciaHandle, OBJ_CIA);
+	AM_TitleEntry entry;
+
+	count(&Counters::amCalls);
+	simulateFinish();
+	if(!cia) return HOST_ERR_INVALID_HANDLE;
+
+	std::lock_guard<std::mutex> lock(cia->mutex);
+	if(cia->done) return HOST_ERR_INVALID_HANDLE;
+	cia->done = true;
+
+	const std::vector<u8>& head = cia->head;
+	auto read = [&head](u64 offset, void *buf, u32 size)
+	{
+		if(offset + size>head.size()) return false;
+		memcpy(buf, head.data() + offset, size);
+		return true;
+	};
+	if(!parseCia(read, entry)) return HOST_ERR_INVALID_CIA;
+
+	addTitle(entry.titleID, entry.version, entry.size);
+	return 0;
+}
+
+Result AM_CancelCIAInstall(Handle ciaHandle)
+{
+	auto cia = getHandle<CiaInstall>(ciaHandle, OBJ_CIA);
+
+	amCall();
+	if(!cia) return HOST_ERR_INVALID_HANDLE;
+
+	std::lock_guard<std::mutex> lock(cia->mutex);
+	cia->done = true;
+	return 0;
+}
+
+Result AM_DeleteTitle(FS_MediaType mediatype, u64 titleID)
+{
+	amCall();
+	std::lock_guard<std::mutex> lock(nand().mutex);
+	return (nand().titles.erase(titleID) ? 0 : HOST_ERR_NOT_FOUND);
+}
+
+Result AM_DeleteAppTitle(FS_MediaType mediatype, u64 titleID)
+{
+	return AM_DeleteTitle(mediatype, titleID);
+}
+
+Result AM_InstallFirm(u64 titleID)
+{
+	amCall();
+	std::lock_guard<std::mutex> lock(nand().mutex);
+	if(!nand().titles.count(titleID)) return HOST_ERR_NOT_FOUND;
+	nand().firm = titleID;
+	return 0;
+}
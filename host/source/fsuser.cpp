@@ -0,0 +1,408 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// FSUSER/FSFILE/FSDIR on top of a host directory standing in for the SD card
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <3ds.h>
+#include "hostctru.h"
+#include "internal.h"
+#include "sha256.h"
+
+
+namespace host
+{
+	struct File : public Object
+	{
+		int fd;
+
+		explicit File(int f) : Object(OBJ_FILE), fd(f) {}
+		~File() {close(fd);}
+	};
+
+	struct Dir : public Object
+	{
+		std::vector<FS_DirectoryEntry> entries;
+		size_t pos = 0;
+
+		Dir() : Object(OBJ_DIR) {}
+	};
+
+
+	static std::string& rootDir()
+	{
+		static std::string root("sdmc");
+		return root;
+	}
+
+	void setSdRoot(const char *root) {rootDir() = root;}
+	const char* sdRoot() {return rootDir().c_str();}
+
+
+	static void appendUtf8(std::string& out, u32 c)
+	{
+		if(c<0x80) out += (char)c;
+		else if(c<0x800)
+		{
+			out += (char)(0xC0 | c>>6);
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else if(c<0x10000)
+		{
+			out += (char)(0xE0 | c>>12);
+			out += (char)(0x80 | (c>>6 & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			out += (char)(0xF0 | c>>18);
+			out += (char)(0x80 | (c>>12 & 0x3F));
+			out += (char)(0x80 | (c>>6 & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	std::string toHostPath(const FS_Path& path)
+	{
+		std::string out(rootDir());
+
+		if(path.type==PATH_ASCII)
+		{
+			out.append((const char*)path.data, strnlen((const char*)path.data, path.size));
+		}
+		else if(path.type==PATH_UTF16)
+		{
+			const u16 *str = (const u16*)path.data;
+			for(u32 i = 0; i<path.size/2 && str[i]; i++)
+			{
+				u32 c = str[i];
+				if(c>=0xD800 && c<0xDC00 && i + 1<path.size/2 && str[i + 1]>=0xDC00 && str[i + 1]<0xE000)
+				{
+					c = 0x10000 + ((c - 0xD800)<<10) + (str[i + 1] - 0xDC00);
+					i++;
+				}
+				appendUtf8(out, c);
+			}
+		}
+
+		return out;
+	}
+
+
+	// Converts one UTF-8 name to UTF-16. Returns false if it doesn't fit.
+	static bool toUtf16(const char *in, u16 *out, u32 maxLen)
+	{
+		u32 len = 0;
+
+		while(*in)
+		{
+			const u8 b = *in++;
+			u32 c, extra;
+
+			if(b<0x80) {c = b; extra = 0;}
+			else if(b<0xE0) {c = b & 0x1F; extra = 1;}
+			else if(b<0xF0) {c = b & 0x0F; extra = 2;}
+			else {c = b & 0x07; extra = 3;}
+			for(; extra && *in; extra--) c = c<<6 | (*in++ & 0x3F);
+
+			if(c>=0x10000)
+			{
+				if(len + 2>=maxLen) return false;
+				c -= 0x10000;
+				out[len++] = 0xD800 + (c>>10);
+				out[len++] = 0xDC00 + (c & 0x3FF);
+			}
+			else
+			{
+				if(len + 1>=maxLen) return false;
+				out[len++] = c;
+			}
+		}
+
+		out[len] = 0;
+		return true;
+	}
+
+
+	static Result errnoToResult(int err)
+	{
+		switch(err)
+		{
+			case ENOENT:
+			case ENOTDIR:
+				return HOST_ERR_NOT_FOUND;
+			case EEXIST:
+			case ENOTEMPTY:
+				return HOST_ERR_ALREADY_EXISTS;
+		}
+
+		return (Result)0xC8804464; // Generic FS failure
+	}
+
+
+	static Result fsCall(u64 bytes=0, Handle handle=0, u64 offset=0)
+	{
+		count(&Counters::fsCalls);
+		simulate(DEVICE_SD, bytes, handle, offset);
+		return 0;
+	}
+}
+
+using namespace host;
+
+
+
+FS_Path fsMakePath(FS_PathType type, const void* path)
+{
+	FS_Path p = {type, 0, path};
+
+	if(type==PATH_ASCII) p.size = strlen((const char*)path) + 1;
+	else if(type==PATH_UTF16)
+	{
+		const u16 *str = (const u16*)path;
+		u32 len = 0;
+		while(str[len]) len++;
+		p.size = (len + 1) * 2;
+	}
+	else if(type==PATH_EMPTY) p.size = 1;
+
+	return p;
+}
+
+Result FSUSER_OpenArchive(FS_Archive* archive, FS_ArchiveID id, FS_Path path)
+{
+	if(id!=ARCHIVE_SDMC) return HOST_ERR_NOT_FOUND;
+
+	*archive = ARCHIVE_SDMC;
+	return fsCall();
+}
+
+Result FSUSER_CloseArchive(FS_Archive archive)
+{
+	return fsCall();
+}
+
+Result FSUSER_OpenFile(Handle* out, FS_Archive archive, FS_Path path, u32 openFlags, u32 attributes)
+{
+	int flags = ((openFlags & FS_OPEN_WRITE) ? O_RDWR : O_RDONLY);
+	struct stat st;
+
+	fsCall();
+	if(openFlags & FS_OPEN_CREATE) flags |= O_CREAT;
+
+	const int fd = open(toHostPath(path).c_str(), flags, 0644);
+	if(fd<0) return errnoToResult(errno);
+	if(fstat(fd, &st) || S_ISDIR(st.st_mode))
+	{
+		close(fd);
+		return HOST_ERR_NOT_FOUND;
+	}
+
+	*out = createHandle(std::make_shared<host::File>(fd));
+	return 0;
+}
+
+// Title content archives don't exist on the host
+Result FSUSER_OpenFileDirectly(Handle* out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes)
+{
+	if(archiveId!=ARCHIVE_SDMC) return HOST_ERR_NOT_FOUND;
+	return FSUSER_OpenFile(out, ARCHIVE_SDMC, filePath, openFlags, attributes);
+}
+
+Result FSUSER_DeleteFile(FS_Archive archive, FS_Path path)
+{
+	fsCall();
+	return (unlink(toHostPath(path).c_str()) ? errnoToResult(errno) : 0);
+}
+
+Result FSUSER_RenameFile(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath)
+{
+	struct stat st;
+	const std::string dst(toHostPath(dstPath));
+
+	fsCall();
+	if(!stat(dst.c_str(), &st)) return HOST_ERR_ALREADY_EXISTS; // FAT doesn't replace
+	return (rename(toHostPath(srcPath).c_str(), dst.c_str()) ? errnoToResult(errno) : 0);
+}
+
+Result FSUSER_OpenDirectory(Handle* out, FS_Archive archive, FS_Path path)
+{
+	const std::string dirPath(toHostPath(path));
+	auto dir = std::make_shared<host::Dir>();
+	std::vector<std::string> names;
+	struct dirent *ent;
+
+	fsCall();
+	DIR *d = opendir(dirPath.c_str());
+	if(!d) return errnoToResult(errno);
+	while((ent = readdir(d)))
+	{
+		if(strcmp(ent->d_name, ".") && strcmp(ent->d_name, "..")) names.push_back(ent->d_name);
+	}
+	closedir(d);
+
+	// readdir() order depends on the host file system. Sorting keeps runs comparable
+	std::sort(names.begin(), names.end());
+	for(const auto& name : names)
+	{
+		FS_DirectoryEntry entry;
+		struct stat st;
+
+		memset(&entry, 0, sizeof(entry));
+		if(!toUtf16(name.c_str(), entry.name, 0x106) || stat((dirPath + "/" + name).c_str(), &st)) continue;
+		entry.valid = 1;
+		entry.attributes = (S_ISDIR(st.st_mode) ? FS_ATTRIBUTE_DIRECTORY : FS_ATTRIBUTE_ARCHIVE);
+		entry.fileSize = (S_ISDIR(st.st_mode) ? 0 : st.st_size);
+		dir->entries.push_back(entry);
+	}
+
+	*out = createHandle(dir);
+	return 0;
+}
+
+Result FSUSER_CreateDirectory(FS_Archive archive, FS_Path path, u32 attributes)
+{
+	fsCall();
+	return (mkdir(toHostPath(path).c_str(), 0755) ? errnoToResult(errno) : 0);
+}
+
+Result FSUSER_RenameDirectory(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath)
+{
+	struct stat st;
+	const std::string dst(toHostPath(dstPath));
+
+	fsCall();
+	if(!stat(dst.c_str(), &st)) return HOST_ERR_ALREADY_EXISTS;
+	return (rename(toHostPath(srcPath).c_str(), dst.c_str()) ? errnoToResult(errno) : 0);
+}
+
+static int removeEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+Result FSUSER_DeleteDirectoryRecursively(FS_Archive archive, FS_Path path)
+{
+	fsCall();
+	return (nftw(toHostPath(path).c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS) ? errnoToResult(errno) : 0);
+}
+
+Result FSUSER_UpdateSha256Context(const void* data, u32 inputSize, u8* hash)
+{
+	fsCall();
+	Sha256::hash(data, inputSize, hash);
+	skipCpu(); // The console hashes in hardware
+	return 0;
+}
+
+
+
+Result FSFILE_Read(Handle handle, u32* bytesRead, u64 offset, void* buffer, u32 size)
+{
+	auto file = getHandle<host::File>(handle, OBJ_FILE);
+	if(!file) return HOST_ERR_INVALID_HANDLE;
+
+	const ssize_t n = pread(file->fd, buffer, size, offset);
+	if(n<0) return errnoToResult(errno);
+
+	fsCall(n, handle, offset);
+	count(&Counters::fileReads);
+	count(&Counters::bytesRead, n);
+	*bytesRead = n;
+	return 0;
+}
+
+Result FSFILE_Write(Handle handle, u32* bytesWritten, u64 offset, const void* buffer, u32 size, u32 flags)
+{
+	auto file = getHandle<host::File>(handle, OBJ_FILE);
+	if(!file) return writeCia(handle, bytesWritten, offset, buffer, size);
+
+	const ssize_t n = pwrite(file->fd, buffer, size, offset);
+	if(n<0) return errnoToResult(errno);
+
+	fsCall(n, handle, offset);
+	count(&Counters::fileWrites);
+	count(&Counters::bytesWritten, n);
+	*bytesWritten = n;
+	return 0;
+}
+
+Result FSFILE_GetSize(Handle handle, u64* size)
+{
+	auto file = getHandle<host::File>(handle, OBJ_FILE);
+	struct stat st;
+
+	if(!file) return HOST_ERR_INVALID_HANDLE;
+	fsCall();
+	if(fstat(file->fd, &st)) return errnoToResult(errno);
+	*size = st.st_size;
+	return 0;
+}
+
+Result FSFILE_SetSize(Handle handle, u64 size)
+{
+	auto file = getHandle<host::File>(handle, OBJ_FILE);
+
+	if(!file) return HOST_ERR_INVALID_HANDLE;
+	fsCall();
+	return (ftruncate(file->fd, size) ? errnoToResult(errno) : 0);
+}
+
+Result FSFILE_Flush(Handle handle)
+{
+	if(!getHandle<host::File>(handle, OBJ_FILE)) return HOST_ERR_INVALID_HANDLE;
+	return fsCall();
+}
+
+// Also closes AM CIA handles like on the device
+Result FSFILE_Close(Handle handle)
+{
+	fsCall();
+	return (closeHandle(handle) ? 0 : HOST_ERR_INVALID_HANDLE);
+}
+
+Result FSDIR_Read(Handle handle, u32* entriesRead, u32 entryCount, FS_DirectoryEntry* entries)
+{
+	auto dir = getHandle<host::Dir>(handle, OBJ_DIR);
+	u32 n = 0;
+
+	if(!dir) return HOST_ERR_INVALID_HANDLE;
+	while(n<entryCount && dir->pos<dir->entries.size()) entries[n++] = dir->entries[dir->pos++];
+
+	fsCall(n * sizeof(FS_DirectoryEntry));
+	count(&Counters::dirReads);
+	*entriesRead = n;
+	return 0;
+}
+
+Result FSDIR_Close(Handle handle)
+{
+	fsCall();
+	return (closeHandle(handle) ? 0 : HOST_ERR_INVALID_HANDLE);
+}
@@ -0,0 +1,91 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// Shared between the simulated services. Not part of the host API.
+
+#ifndef _HOST_INTERNAL_H_
+#define _HOST_INTERNAL_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <3ds.h>
+#include "hostctru.h"
+
+
+namespace host
+{
+	enum ObjectType
+	{
+		OBJ_FILE = 0,
+		OBJ_DIR,
+		OBJ_CIA,
+		OBJ_EVENT,
+		OBJ_SEMAPHORE,
+		OBJ_SERVICE
+	};
+
+	struct Object
+	{
+		const ObjectType type;
+
+		explicit Object(ObjectType t) : type(t) {}
+		virtual ~Object() {}
+	};
+
+	enum Device
+	{
+		DEVICE_SD = 0,
+		DEVICE_NAND
+	};
+
+	// Handle table shared by all object types
+	Handle createHandle(std::shared_ptr<Object> obj);
+	std::shared_ptr<Object> getObject(Handle handle, ObjectType type); // nullptr if closed or of another type
+	bool closeHandle(Handle handle);
+
+	template<class T> std::shared_ptr<T> getHandle(Handle handle, ObjectType type)
+	{
+		return std::static_pointer_cast<T>(getObject(handle, type));
+	}
+
+	// Sleeps or advances the clock of the calling thread as configured for the device.
+	// stream and offset say where a transfer happens, for the seek penalty.
+	void simulate(Device device, u64 bytes, u64 stream=0, u64 offset=0);
+	void simulateFinish(); // AM_FinishCiaInstall()
+
+	// Virtual time. Sync objects and threads carry the clock of whoever signals them.
+	bool virtualTime();
+	void syncClock(u64 us); // The calling thread's clock becomes at least us
+	void advanceClock(u64 us);
+	void chargeCpu(); // Adds the scaled CPU time the thread used since the last charge to its clock
+	void skipCpu();   // Drops it instead. For work the stand-in does that the app doesn't
+	void count(u64 Counters::*counter, u64 n=1);
+
+	std::string toHostPath(const FS_Path& path); // Inside the SD root
+
+	// FSFILE_Write() on a handle from AM_StartCiaInstall(). HOST_ERR_INVALID_HANDLE if it isn't one
+	Result writeCia(Handle handle, u32 *bytesWritten, u64 offset, const void *buf, u32 size);
+
+	// Reads the title ID, version and content size from a CIA
+	bool parseCia(std::function<bool (u64 offset, void *buf, u32 size)> read, AM_TitleEntry& entry);
+}
+
+#endif // _HOST_INTERNAL_H_
@@ -0,0 +1,351 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// Kernel objects, threads, time and the handle table
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <limits.h>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <time.h>
+#include <3ds.h>
+#include "hostctru.h"
+#include "internal.h"
+
+#define HOST_MIN_STACK_SIZE (0x40000) // Host code needs more stack than the 3DS build
+
+
+struct Thread_tag
+{
+	pthread_t thread;
+	ThreadFunc entry;
+	void *arg;
+	u64 clock; // Virtual time at creation, then at exit
+};
+
+
+namespace host
+{
+	struct Sync : public Object
+	{
+		std::mutex mutex;
+		std::condition_variable cond;
+		u64 clock = 0; // Latest virtual time it was signaled at
+
+		explicit Sync(ObjectType t) : Object(t) {}
+	};
+
+	struct Event : public Sync
+	{
+		ResetType resetType;
+		bool signaled = false;
+
+		explicit Event(ResetType rt) : Sync(OBJ_EVENT), resetType(rt) {}
+	};
+
+	struct Semaphore : public Sync
+	{
+		s32 count;
+		s32 maxCount;
+
+		Semaphore(s32 initial, s32 max) : Sync(OBJ_SEMAPHORE), count(initial), maxCount(max) {}
+	};
+
+
+	struct HandleTable
+	{
+		std::mutex mutex;
+		std::map<Handle, std::shared_ptr<Object>> objects;
+		Handle next = 0x100;
+	};
+
+	// Function local so it works from static constructors in other files
+	static HandleTable& handleTable()
+	{
+		static HandleTable table;
+		return table;
+	}
+
+
+	Handle createHandle(std::shared_ptr<Object> obj)
+	{
+		HandleTable& table = handleTable();
+		std::lock_guard<std::mutex> lock(table.mutex);
+
+		const Handle handle = table.next++;
+		table.objects[handle] = obj;
+		return handle;
+	}
+
+
+	std::shared_ptr<Object> getObject(Handle handle, ObjectType type)
+	{
+		HandleTable& table = handleTable();
+		std::lock_guard<std::mutex> lock(table.mutex);
+
+		auto it = table.objects.find(handle);
+		if(it==table.objects.end() || it->second->type!=type) return nullptr;
+		return it->second;
+	}
+
+
+	bool closeHandle(Handle handle)
+	{
+		HandleTable& table = handleTable();
+		std::lock_guard<std::mutex> lock(table.mutex);
+
+		return table.objects.erase(handle)>0;
+	}
+
+
+	static Counters counterValues;
+
+	void count(u64 Counters::*counter, u64 n)
+	{
+		__atomic_fetch_add(&(counterValues.*counter), n, __ATOMIC_RELAXED);
+	}
+
+	#define COUNTER_FIELDS(X) X(fsCalls) X(amCalls) X(fileReads) X(fileWrites) X(dirReads) X(bytesRead) X(bytesWritten) X(bytesInstalled)
+
+	Counters counters()
+	{
+		Counters c;
+		#define LOAD_COUNTER(f) c.f = __atomic_load_n(&counterValues.f, __ATOMIC_RELAXED);
+		COUNTER_FIELDS(LOAD_COUNTER)
+		#undef LOAD_COUNTER
+		return c;
+	}
+
+	void resetCounters()
+	{
+		#define RESET_COUNTER(f) __atomic_store_n(&counterValues.f, 0, __ATOMIC_RELAXED);
+		COUNTER_FIELDS(RESET_COUNTER)
+		#undef RESET_COUNTER
+	}
+}
+
+using namespace host;
+
+
+
+Result svcCreateEvent(Handle* event, ResetType reset_type)
+{
+	*event = createHandle(std::make_shared<host::Event>(reset_type));
+	return 0;
+}
+
+Result svcSignalEvent(Handle handle)
+{
+	auto ev = getHandle<host::Event>(handle, OBJ_EVENT);
+	if(!ev) return HOST_ERR_INVALID_HANDLE;
+
+	std::lock_guard<std::mutex> lock(ev->mutex);
+	ev->clock = std::max(ev->clock, threadClockUs());
+	if(ev->resetType==RESET_PULSE)
+	{
+		ev->cond.notify_all(); // Wakes whoever waits right now
+		return 0;
+	}
+	ev->signaled = true;
+	if(ev->resetType==RESET_ONESHOT) ev->cond.notify_one();
+	else ev->cond.notify_all();
+	return 0;
+}
+
+Result svcClearEvent(Handle handle)
+{
+	auto ev = getHandle<host::Event>(handle, OBJ_EVENT);
+	if(!ev) return HOST_ERR_INVALID_HANDLE;
+
+	std::lock_guard<std::mutex> lock(ev->mutex);
+	ev->signaled = false;
+	return 0;
+}
+
+Result svcCreateSemaphore(Handle* semaphore, s32 initial_count, s32 max_count)
+{
+	*semaphore = createHandle(std::make_shared<host::Semaphore>(initial_count, max_count));
+	return 0;
+}
+
+Result svcReleaseSemaphore(s32* count, Handle semaphore, s32 release_count)
+{
+	auto sem = getHandle<host::Semaphore>(semaphore, OBJ_SEMAPHORE);
+	if(!sem) return HOST_ERR_INVALID_HANDLE;
+
+	std::lock_guard<std::mutex> lock(sem->mutex);
+	*count = sem->count;
+	sem->clock = std::max(sem->clock, threadClockUs());
+	sem->count = std::min(sem->count + release_count, sem->maxCount);
+	sem->cond.notify_all();
+	return 0;
+}
+
+Result svcWaitSynchronization(Handle handle, s64 nanoseconds)
+{
+	std::shared_ptr<host::Sync> sync = getHandle<host::Sync>(handle, OBJ_EVENT);
+	if(!sync) sync = getHandle<host::Sync>(handle, OBJ_SEMAPHORE);
+	if(!sync) return HOST_ERR_INVALID_HANDLE;
+
+	std::unique_lock<std::mutex> lock(sync->mutex);
+	std::function<bool ()> ready;
+	if(sync->type==OBJ_EVENT)
+	{
+		host::Event *ev = static_cast<host::Event*>(sync.get());
+		ready = [ev]() {return ev->signaled;};
+	}
+	else
+	{
+		host::Semaphore *sem = static_cast<host::Semaphore*>(sync.get());
+		ready = [sem]() {return sem->count>0;};
+	}
+
+	if(nanoseconds<0) sync->cond.wait(lock, ready);
+	else if(!sync->cond.wait_for(lock, std::chrono::nanoseconds(nanoseconds), ready)) return HOST_ERR_TIMEOUT;
+
+	if(sync->type==OBJ_EVENT)
+	{
+		host::Event *ev = static_cast<host::Event*>(sync.get());
+		if(ev->resetType==RESET_ONESHOT) ev->signaled = false;
+	}
+	else static_cast<host::Semaphore*>(sync.get())->count--;
+	syncClock(sync->clock);
+
+	return 0;
+}
+
+Result svcCloseHandle(Handle handle)
+{
+	return (closeHandle(handle) ? 0 : HOST_ERR_INVALID_HANDLE);
+}
+
+Result svcGetThreadPriority(s32* out, Handle handle)
+{
+	*out = 0x30; // Main thread priority of a 3DS app
+	return 0;
+}
+
+Result svcGetThreadId(u32* out, Handle handle)
+{
+	static u32 nextId = 1;
+	static __thread u32 threadId = 0;
+
+	if(!threadId) threadId = __atomic_fetch_add(&nextId, 1, __ATOMIC_RELAXED);
+	*out = threadId;
+	return 0;
+}
+
+// Always sleeps so polling loops don't spin in virtual time
+void svcSleepThread(s64 ns)
+{
+	std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+	if(virtualTime()) advanceClock(ns / 1000);
+}
+
+// In virtual time the calling thread's clock, so the app's own timings are modeled too
+u64 svcGetSystemTick(void)
+{
+	timespec ts;
+
+	if(virtualTime()) return threadClockUs() * SYSCLOCK_ARM11 / 1000000;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	const u64 ns = (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	return ns / 1000 * SYSCLOCK_ARM11 / 1000000; // 268 ticks per microsecond
+}
+
+u64 osGetTime(void)
+{
+	timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (u64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+
+static void* threadEntry(void *arg)
+{
+	Thread t = (Thread)arg;
+
+	syncClock(t->clock);
+	t->entry(t->arg);
+	t->clock = threadClockUs();
+	return nullptr;
+}
+
+// Priority and affinity don't exist on the host
+Thread threadCreate(ThreadFunc entrypoint, void* arg, size_t stack_size, int prio, int affinity, bool detached)
+{
+	Thread t = new Thread_tag;
+	pthread_attr_t attr;
+
+	t->entry = entrypoint;
+	t->arg = arg;
+	t->clock = threadClockUs();
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, std::max<size_t>(std::max<size_t>(stack_size, HOST_MIN_STACK_SIZE), PTHREAD_STACK_MIN));
+	if(detached) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	const int err = pthread_create(&t->thread, &attr, threadEntry, t);
+	pthread_attr_destroy(&attr);
+
+	if(err)
+	{
+		delete t;
+		return nullptr;
+	}
+	return t;
+}
+
+Result threadJoin(Thread thread, u64 timeout_ns)
+{
+	pthread_join(thread->thread, nullptr);
+	syncClock(thread->clock);
+	return 0;
+}
+
+void threadFree(Thread thread)
+{
+	delete thread;
+}
+
+void LightLock_Init(LightLock* lock)
+{
+	pthread_mutex_init(&lock->mutex, nullptr);
+}
+
+void LightLock_Lock(LightLock* lock)
+{
+	pthread_mutex_lock(&lock->mutex);
+}
+
+void LightLock_Unlock(LightLock* lock)
+{
+	pthread_mutex_unlock(&lock->mutex);
+}
+
+Result srvGetServiceHandleDirect(Handle* out, const char* name)
+{
+	*out = createHandle(std::make_shared<host::Object>(OBJ_SERVICE));
+	return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+// Service time model of the SD card and the NAND
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <time.h>
+#include <sys/resource.h>
+#include <3ds.h>
+#include "hostctru.h"
+#include "internal.h"
+
+
+namespace host
+{
+	struct DeviceState
+	{
+		ServiceModel model = {};
+		std::mutex busy;         // Held for the duration of a transfer in real time
+		u64 busyUntil = 0;       // Virtual time
+		u64 lastStream = 0;      // Where the previous transfer ended
+		u64 lastEnd = 0;
+		std::mt19937 rng{1};     // For the AM_FinishCiaInstall() tail. Fixed seed so runs repeat
+	};
+
+	static DeviceState& device(Device dev)
+	{
+		static DeviceState devices[2];
+		return devices[dev];
+	}
+
+	static SimTime simTime = SIM_REAL_TIME;
+	static u32 cpuScaleValue = 0;
+	static __thread u64 threadClock = 0;
+	static __thread u64 cpuMark = 0;      // CPU time of the thread when it was last charged, in ns
+	static __thread u64 cpuRemainder = 0; // Scaled ns not yet added to threadClock
+
+	void setSdModel(const ServiceModel& model) {device(DEVICE_SD).model = model;}
+	void setNandModel(const ServiceModel& model) {device(DEVICE_NAND).model = model;}
+	ServiceModel sdModel() {return device(DEVICE_SD).model;}
+	ServiceModel nandModel() {return device(DEVICE_NAND).model;}
+	void setSimTime(SimTime mode) {simTime = mode;}
+	bool virtualTime() {return simTime==SIM_VIRTUAL_TIME;}
+	void setCpuScale(u32 scale) {cpuScaleValue = scale;}
+	u32  cpuScale() {return cpuScaleValue;}
+	u64  threadClockUs() {chargeCpu(); return threadClock;}
+	void syncClock(u64 us) {if(us>threadClock) threadClock = us;}
+	void advanceClock(u64 us) {threadClock += us;}
+
+
+	// User time only. What the kernel spends on the host files isn't the app's work
+	static u64 cpuNs()
+	{
+#ifdef RUSAGE_THREAD
+		struct rusage usage;
+		getrusage(RUSAGE_THREAD, &usage);
+		return (u64)usage.ru_utime.tv_sec * 1000000000ULL + (u64)usage.ru_utime.tv_usec * 1000;
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+	}
+
+	void chargeCpu()
+	{
+		if(!virtualTime() || !cpuScaleValue) return;
+
+		const u64 now = cpuNs();
+		if(cpuMark && now>cpuMark)
+		{
+			cpuRemainder += (now - cpuMark) * cpuScaleValue;
+			threadClock += cpuRemainder / 1000;
+			cpuRemainder %= 1000;
+		}
+		cpuMark = now;
+	}
+
+	void skipCpu()
+	{
+		if(virtualTime() && cpuScaleValue) cpuMark = cpuNs();
+	}
+
+
+	static void wait(u64 us)
+	{
+		if(!us) return;
+		if(virtualTime()) threadClock += us;
+		else std::this_thread::sleep_for(std::chrono::microseconds(us));
+	}
+
+	// Holds the device for us. busy is locked by the caller.
+	static void occupy(DeviceState& state, u64 us)
+	{
+		if(virtualTime())
+		{
+			const u64 start = std::max(threadClock, state.busyUntil);
+			state.busyUntil = start + us;
+			threadClock = state.busyUntil;
+		}
+		else std::this_thread::sleep_for(std::chrono::microseconds(us));
+	}
+
+
+	void simulate(Device dev, u64 bytes, u64 stream, u64 offset)
+	{
+		DeviceState& state = device(dev);
+		const ServiceModel model = state.model;
+
+		chargeCpu();
+		wait(model.latencyUs);
+		if(!bytes || (!model.bytesPerSec && !model.seekUs)) return;
+
+		// The device moves one transfer at a time
+		std::lock_guard<std::mutex> lock(state.busy);
+		u64 us = (model.bytesPerSec ? bytes * 1000000ULL / model.bytesPerSec : 0);
+		if(stream!=state.lastStream || offset!=state.lastEnd) us += model.seekUs;
+		state.lastStream = stream;
+		state.lastEnd = offset + bytes;
+		occupy(state, us);
+	}
+
+	void simulateFinish()
+	{
+		DeviceState& state = device(DEVICE_NAND);
+		const ServiceModel model = state.model;
+
+		chargeCpu();
+		wait(model.latencyUs);
+		if(!model.finishUs && !model.finishTailUs) return;
+
+		std::lock_guard<std::mutex> lock(state.busy);
+		u64 us = model.finishUs;
+		if(model.finishTailUs && state.rng() % 100<model.finishTailPercent)
+		{
+			// Exponentially distributed with a mean of finishTailUs
+			std::exponential_distribution<double> tail(1.0 / model.finishTailUs);
+			us += (u64)tail(state.rng);
+		}
+		occupy(state, us);
+	}
+
+
+	static bool setModelValue(ServiceModel& model, const char *key, unsigned long long value)
+	{
+		if(!strcmp(key, "latencyUs")) model.latencyUs = value;
+		else if(!strcmp(key, "bytesPerSec")) model.bytesPerSec = value;
+		else if(!strcmp(key, "seekUs")) model.seekUs = value;
+		else if(!strcmp(key, "finishUs")) model.finishUs = value;
+		else if(!strcmp(key, "finishTailUs")) model.finishTailUs = value;
+		else if(!strcmp(key, "finishTailPercent")) model.finishTailPercent = value;
+		else return false;
+
+		return true;
+	}
+
+	bool loadProfile(const char *path)
+	{
+		FILE *f = fopen(path, "r");
+		if(!f) return false;
+
+		ServiceModel sd = sdModel(), nand = nandModel();
+		u32 scale = cpuScale();
+		char line[256], dev[16], key[32];
+		unsigned long long value;
+		bool ok = true;
+		while(ok && fgets(line, sizeof(line), f))
+		{
+			const char *p = line + strspn(line, " \t");
+			if(*p=='#' || *p=='\n' || *p==0) continue;
+
+			if(sscanf(p, "%15[a-z].%31[A-Za-z] = %llu", dev, key, &value)!=3) ok = false;
+			else if(!strcmp(dev, "sd")) ok = setModelValue(sd, key, value);
+			else if(!strcmp(dev, "nand")) ok = setModelValue(nand, key, value);
+			else if(!strcmp(dev, "cpu") && !strcmp(key, "scale")) scale = value;
+			else ok = false;
+		}
+		fclose(f);
+
+		if(ok)
+		{
+			setSdModel(sd);
+			setNandModel(nand);
+			setCpuScale(scale);
+		}
+		return ok;
+	}
+}
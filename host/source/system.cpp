@@ -0,0 +1,77 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// CFG, APT, HID, GFX and console. Just enough for the app code to run.
+
+#include <3ds.h>
+#include "hostctru.h"
+#include "internal.h"
+
+
+namespace host
+{
+	static bool isNew3DS = false;
+	static u8 region = CFG_REGION_USA;
+	static u32 keysDown = 0;
+
+	void setNew3DS(bool n3ds) {isNew3DS = n3ds;}
+	void setRegion(u8 r) {region = r;}
+	void setKeysDown(u32 keys) {__atomic_store_n(&keysDown, keys, __ATOMIC_RELAXED);}
+}
+
+using namespace host;
+
+
+
+Result cfguInit(void) {return 0;}
+void cfguExit(void) {}
+
+Result CFGU_SecureInfoGetRegion(u8* r)
+{
+	*r = region;
+	return 0;
+}
+
+bool aptMainLoop(void) {return true;}
+
+Result APT_CheckNew3DS(bool* out)
+{
+	*out = isNew3DS;
+	return 0;
+}
+
+Result APT_HardwareResetAsync(void) {return 0;}
+Result APT_PrepareToStartSystemApplet(NS_APPID appID) {return 0;}
+Result APT_StartSystemApplet(NS_APPID appID, const void* param, size_t paramSize, Handle handle) {return 0;}
+Result APT_PrepareToDoApplicationJump(u8 flags, u64 programID, u8 mediatype) {return 0;}
+Result APT_DoApplicationJump(const void* param, size_t paramSize, const void* hmac) {return 0;}
+
+void hidScanInput(void) {}
+u32 hidKeysDown(void) {return __atomic_load_n(&keysDown, __ATOMIC_RELAXED);}
+
+void gfxInit(GSPGPU_FramebufferFormats topFormat, GSPGPU_FramebufferFormats bottomFormat, bool vrambuffers) {}
+void gfxExit(void) {}
+void gfxFlushBuffers(void) {}
+void gfxSwapBuffers(void) {}
+void gspWaitForVBlank(void) {svcSleepThread(16715000LL);}
+
+// Console output goes to stdout
+PrintConsole* consoleInit(gfxScreen_t screen, PrintConsole* console) {return console;}
+void consoleClear(void) {}
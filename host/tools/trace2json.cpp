@@ -0,0 +1,101 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+// Converts /sysDowngrader.trace into Chrome trace event JSON.
+// Open the output in chrome://tracing or ui.perfetto.dev.
+// Usage: trace2json <in.trace> [out.json]
+
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+#include "traceformat.h"
+
+
+#define TRACE_NAME_ENTRY(id, name) name,
+static const char *const eventNames[TRACE_EVENT_COUNT] = {TRACE_EVENT_LIST(TRACE_NAME_ENTRY)};
+#undef TRACE_NAME_ENTRY
+
+
+
+int main(int argc, char *argv[])
+{
+	if(argc<2)
+	{
+		fprintf(stderr, "Usage: %s <in.trace> [out.json]\n", argv[0]);
+		return 1;
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+	if(!in)
+	{
+		fprintf(stderr, "Failed to open '%s'!\n", argv[1]);
+		return 1;
+	}
+
+	TraceHeader header;
+	if(fread(&header, sizeof(TraceHeader), 1, in)!=1 || header.magic!=TRACE_MAGIC)
+	{
+		fprintf(stderr, "'%s' is not a trace file!\n", argv[1]);
+		fclose(in);
+		return 1;
+	}
+	if(header.version!=TRACE_VERSION || header.recordSize!=sizeof(TraceRecord) || !header.tickRate)
+	{
+		fprintf(stderr, "Unsupported trace version %u!\n", header.version);
+		fclose(in);
+		return 1;
+	}
+
+	std::vector<TraceRecord> records(header.recordCount);
+	const size_t count = fread(records.data(), sizeof(TraceRecord), records.size(), in);
+	fclose(in);
+	if(count!=records.size()) fprintf(stderr, "Warning: trace is truncated (%zu of %u records)\n", count, header.recordCount);
+	if(header.dropped) fprintf(stderr, "Warning: %u records were dropped on the device\n", header.dropped);
+
+
+	FILE *out = (argc>2 ? fopen(argv[2], "w") : stdout);
+	if(!out)
+	{
+		fprintf(stderr, "Failed to open '%s'!\n", argv[2]);
+		return 1;
+	}
+
+	const uint64_t start = (count ? records[0].tick : 0);
+	static const char phases[] = {'B', 'E', 'i'};
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for(size_t i = 0; i<count; i++)
+	{
+		const TraceRecord& r = records[i];
+		// Records are in reservation order which can differ from tick order by a few ticks
+		const double ts = (double)(int64_t)(r.tick - start) * 1000000.0 / (double)header.tickRate;
+		const char *name = (r.id<TRACE_EVENT_COUNT ? eventNames[r.id] : "unknown");
+		const char phase = (r.phase<sizeof(phases) ? phases[r.phase] : 'i');
+
+		fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", (i ? ",\n" : ""), name, phase, ts, r.thread);
+		if(phase=='i') fprintf(out, ",\"s\":\"t\"");
+		if(r.phase!=TRACE_PHASE_END) fprintf(out, ",\"args\":{\"payload\":%" PRIu32 "}", r.payload);
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n]}\n");
+
+	if(out!=stdout) fclose(out);
+	return 0;
+}
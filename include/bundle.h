@@ -0,0 +1,51 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _BUNDLE_H_
+#define _BUNDLE_H_
+
+#include <vector>
+#include <3ds.h>
+#include "bundleformat.h"
+#include "fs.h"
+
+#define BUNDLE_INDEX_READ   (0x4000) // 16 KB. Bigger indexes take a second read
+#define BUNDLE_MAX_ENTRIES  (0x400)
+
+
+
+// Read-only view of a bundle. The index is read and checked when opening.
+// Entries are read through file() at their offset, so the bundle is opened once.
+class Bundle
+{
+	fs::File _file_;
+	std::vector<BundleEntry> _entries_;
+
+	Bundle(const Bundle&);
+	Bundle& operator =(const Bundle&);
+
+
+public:
+	Bundle(const fs::Path& path, FS_Archive& archive=sdmcArchive);
+
+	const std::vector<BundleEntry>& entries() const {return _entries_;}
+	fs::File& file() {return _file_;}
+};
+
+#endif // _BUNDLE_H_
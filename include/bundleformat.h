@@ -0,0 +1,57 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _BUNDLEFORMAT_H_
+#define _BUNDLEFORMAT_H_
+
+// Layout of a firmware pack bundle (/updates.bundle), one file holding all
+// CIAs of a pack.
+//
+// The header and the entries form the index at the start of the file. Each
+// CIA follows, in entry order, at a multiple of align so it starts on a new
+// SD card cluster. Gaps are zero filled.
+
+#include <stdint.h>
+
+#define BUNDLE_MAGIC          (0x4C444E42) // "BNDL"
+#define BUNDLE_VERSION        (1)
+#define BUNDLE_DEFAULT_ALIGN  (0x10000)    // 64 KB, the largest cluster size of SD cards formatted to spec
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t entrySize;
+	uint32_t entryCount;
+	uint32_t align;      // Power of 2
+	uint32_t indexSize;  // Header plus entries
+	uint32_t reserved[3];
+} BundleHeader;
+
+typedef struct
+{
+	uint64_t titleID;
+	uint64_t offset;     // Of the CIA from the start of the bundle
+	uint64_t size;
+	uint16_t version;
+	uint16_t reserved[3];
+	uint8_t  sha256[32]; // Of the CIA
+} BundleEntry;
+
+#endif // _BUNDLEFORMAT_H_
@@ -0,0 +1,55 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+#include <3ds.h>
+
+#define CONSOLE_BUF_SIZE  (0x2000)
+#define CONSOLE_LINE_SIZE (256)
+#define CONSOLE_FRAME_NS  (16715000LL) // One frame at ~59.83 Hz
+
+
+
+// Text is queued by the callers and drawn by a renderer thread, at most once per frame.
+// Before init() and after exit() it is drawn immediately by the caller.
+namespace console
+{
+	struct Stats
+	{
+		u64 callerTicks; // Spent in print()/progress(), including drawing in immediate mode
+		u64 renderTicks; // Spent drawing
+		u32 messages;
+		u32 coalesced;   // Progress updates replaced before they were drawn
+		u32 frames;
+	};
+
+	void init(); // Call after consoleInit()
+	void exit();
+	void print(const char *text);
+	// Replaces the previous update with the same (non-zero) key if it wasn't drawn yet.
+	// Start the text with '\r' to overwrite the line on screen.
+	void progress(u32 key, const char *fmt, ...);
+	void flush(); // Blocks until everything queued is drawn
+	Stats stats();
+}
+
+#endif // _CONSOLE_H_
@@ -0,0 +1,76 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+#include <3ds.h>
+#include "deltaformat.h"
+#include "fs.h"
+#include "misc.h"
+
+#define DELTA_OP_BUF_SIZE  (0x40000) // 256 KB of ops and ADD data read at once
+#define DELTA_CHUNK_SIZE   (0x80000) // 512 KB returned by next()
+#define DELTA_VIEW_BLOCK_SIZE   (0x20000) // Base cache for small COPY ops, 8 * 128 KB
+#define DELTA_VIEW_BLOCK_COUNT  (8)
+#define DELTA_DIRECT_COPY       (0x40000) // COPY ops from 256 KB up bypass the cache
+
+
+
+void readDeltaHeader(fs::File& file, DeltaHeader& header); // Throws if it isn't a delta we can read
+
+// Rebuilds the target CIA of a delta chunk by chunk. Memory use doesn't depend on
+// the CIA size. Ops are checked against the base and target size as they come.
+// Small COPY ops go through a block cache of the base. They mostly go forward with
+// the odd jump back to repeated data, so most of them don't need a read of their own.
+class DeltaReader
+{
+	fs::File _delta_;
+	const DeltaHeader _header_;
+	fs::File _base_;
+	fs::FileView _baseView_;
+	Buffer<u8> _ops_, _out_; // _out_ holds two chunks used in turns
+	u32 _outHalf_ = 0;
+	u32 _opPos_ = 0;
+	u32 _opEnd_ = 0;    // Valid bytes in _ops_
+	u64 _opOffset_;     // Delta file offset of _ops_[_opEnd_]
+	u32 _opType_ = 0;
+	u64 _opLeft_ = 0;   // Bytes the current op still produces
+	u64 _copyFrom_ = 0; // Next base offset of a COPY
+	u64 _produced_ = 0;
+
+	DeltaReader(const DeltaReader&);
+	DeltaReader& operator =(const DeltaReader&);
+
+	void fill(u32 need); // Makes sure need bytes of ops are buffered
+	void nextOp();
+	void copy(u8 *out, u32 size); // From the base at _copyFrom_
+
+
+public:
+	DeltaReader(const fs::Path& path, FS_Archive& archive=sdmcArchive);
+
+	const DeltaHeader& header() const {return _header_;}
+	u64 produced() const {return _produced_;}
+	// Returns the next chunk of the target. It stays valid for one more call so it can
+	// be written while the next one is built. nullptr after the last one
+	const u8* next(u32& size);
+};
+
+#endif // _DELTA_H_
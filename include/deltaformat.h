@@ -0,0 +1,55 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _DELTAFORMAT_H_
+#define _DELTAFORMAT_H_
+
+// Layout of a delta CIA (<title ID>.cia.delta in /updates). It rebuilds a CIA
+// from a base CIA already on the SD card, for example the same title of a pack
+// for another version or region.
+//
+// The header is followed by ops until the end of the file. Each op starts with
+// a u32 of type<<30 | length. COPY is followed by the u64 base offset to copy
+// length bytes from, ADD by length bytes of new data. The ops produce the
+// target CIA front to back.
+
+#include <stdint.h>
+
+#define DELTA_MAGIC             (0x544C4444) // "DDLT"
+#define DELTA_VERSION           (1)
+#define DELTA_BASE_PATH_LENGTH  (128)        // UTF-16 code units including the terminator
+#define DELTA_OP_COPY           (1)
+#define DELTA_OP_ADD            (2)
+#define DELTA_MAX_OP_LENGTH     (0x3FFFFFFF)
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t headerSize;     // Ops start here
+	uint64_t titleID;        // Of the target CIA
+	uint16_t titleVersion;
+	uint16_t reserved[3];
+	uint64_t baseSize;
+	uint64_t targetSize;
+	uint8_t  baseSha256[32]; // Informational. A wrong base fails the target's hash check anyway
+	uint16_t basePath[DELTA_BASE_PATH_LENGTH]; // Absolute SD path, UTF-16, zero terminated
+} DeltaHeader;
+
+#endif // _DELTAFORMAT_H_
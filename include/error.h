@@ -22,11 +22,36 @@
 
 #include <cstdio>
 #include <exception>
+#include <3ds.h>
 
 #define ERR_NULL_PTR       (-1)
 #define ERR_NOT_ENOUGH_MEM (-2)
 #define ERR_PATH_TOO_LONG  (-3)
 
+#define ERR_STR_SIZE       (256)
+
+
+// Base class of all exceptions we throw. The message is formatted into an
+// inline buffer so throwing doesn't allocate or touch the console or SD card.
+// Catch sites decide whether and where to log what().
+class ResultException : public std::exception
+{
+	char _errStr_[ERR_STR_SIZE];
+	Result _res_;
+
+
+protected:
+	ResultException(const char *type, const char *file, const int line, const Result res, const char *desc) : _res_(res)
+	{
+		snprintf(_errStr_, ERR_STR_SIZE, "\n%s:\n%s:%d: Result: 0x%X\n%s", type, file, line, (unsigned int)res, desc);
+	}
+
+
+public:
+	virtual const char* what() const noexcept {return _errStr_;}
+	Result getErrCode() const {return _res_;}
+};
+
 
 
 #endif // _ERROR_H_
@@ -26,31 +26,30 @@
 #include <vector>
 #include <cstdio>
 #include <3ds.h>
+#include "error.h"
+#include "ipc.h"
 #include "misc.h"
 
 #define FS_PATH_MAX_LENGTH         (0x106)
 #define MAX_BUF_SIZE               (0x200000) // 2 MB
+#define COPY_WORKERS               (3)        // Files in flight in copyDir()
+#define COPY_BUF_SIZE              (0x80000)  // 512 KB per copyDir() worker
+#define DIR_READ_BATCH             (64)       // Entries per ipc::FSDIR_Read() call
+#define IO_QUEUE_DEPTH             (8)        // Async requests waiting for the I/O thread
+#define IO_MAX_PENDING             (16)       // Async requests not yet consumed by ioWait()/ioPoll()
+#define VIEW_BLOCK_SIZE            (0x2000)   // 8 KB FileView cache blocks
+#define VIEW_BLOCK_COUNT           (16)
 #define FS_ERR_DOESNT_EXIST        ((Result)0xC8804478)
 #define FS_ERR_DOES_ALREADY_EXIST  ((Result)0xC82044BE) // Sometimes the API returns 0xC82044B9 instead
 
 
 extern FS_Archive sdmcArchive;
 
-class fsException : public std::exception
+class fsException : public ResultException
 {
-	char errStr[256];
-	Result res;
-
-
 public:
 	fsException(const char *file, const int line, const Result res, const char *desc)
-	{
-    this->res = res;
-		logging->logsnprintf(errStr, 255, "\nfsException:\n%s:%d: Result: 0x%X\n%s", file, line, (unsigned int)res, desc);
-	}
-
-	virtual const char* what() const noexcept {return errStr;}
-	const Result getErrCode() {return res;}
+		: ResultException("fsException", file, line, res, desc) {}
 };
 
 typedef enum
@@ -64,47 +63,162 @@ typedef enum
 
 namespace fs
 {
+	// UTF-16 path with inline storage for FS_PATH_MAX_LENGTH characters (including
+	// the terminator). Building and converting paths never touches the heap.
+	// Implicitly constructible from strings so all fs functions accept those, too.
+	class Path
+	{
+		char16_t _str_[FS_PATH_MAX_LENGTH];
+		u32 _len_;
+
+
+	public:
+		Path() : _len_(0) {_str_[0] = 0;}
+		Path(const Path& other) : _len_(other._len_) {memcpy(_str_, other._str_, (_len_+1)*2);}
+		Path(const char16_t *str) : _len_(0) {append(str, std::char_traits<char16_t>::length(str));}
+		Path(const std::u16string& str) : _len_(0) {append(str.data(), str.length());}
+		Path(const Path& dir, const std::u16string& name) : Path(dir) {push(name);}
+
+		Path& operator =(const Path& other) {_len_ = other._len_; memmove(_str_, other._str_, (_len_+1)*2); return *this;}
+		Path& assign(const char16_t *str, u32 len) {_len_ = 0; return append(str, len);}
+		Path& append(const char16_t *str, u32 len);
+		Path& push(const char16_t *name, u32 len); // Adds a dir or file name
+		Path& push(const std::u16string& name) {return push(name.data(), name.length());}
+		Path& pop(); // Removes the last dir or file name
+		void  truncate(u32 len) {if(len < _len_) {_len_ = len; _str_[len] = 0;}}
+
+		u32 length() const {return _len_;}
+		const char16_t* c_str() const {return _str_;}
+		char16_t operator [](u32 i) const {return _str_[i];}
+		std::u16string str() const {return std::u16string(_str_, _len_);}
+		FS_Path fsPath() const {return {PATH_UTF16, (_len_*2)+2, (const u8*)_str_};}
+
+		bool operator ==(const Path& other) const {return _len_ == other._len_ && memcmp(_str_, other._str_, _len_*2) == 0;}
+		bool operator !=(const Path& other) const {return !(*this == other);}
+	};
+
+
+	// Metadata cached by File so size() doesn't need a ipc::FSFILE_GetSize() round-trip.
+	// Seed it from a DirEntry when opening files found by listDirContents().
+	struct FileStat
+	{
+		u64 size;
+		u32 attributes;
+	};
+
+
+	// Completion token of an async request. 0 is never a valid token.
+	typedef u32 IoToken;
+
+	struct IoResult
+	{
+		Result res;
+		u32 bytes; // Bytes read or written
+		u32 size;  // Bytes requested
+	};
+
+
 	class File
 	{
 		u64 _offset_;
-		std::u16string _path_;
+		Path _path_;
 		u32 _openFlags_;
 		FS_Archive *_archive_;
 		Handle _fileHandle_ = 0;
+		FileStat _stat_;
+		bool _statValid_ = false;
 
 
 	public:
-		File(const std::u16string& path, u32 openFlags, FS_Archive& archive=sdmcArchive) {open(path, openFlags, archive);}
+		File(const Path& path, u32 openFlags, FS_Archive& archive=sdmcArchive) {open(path, openFlags, archive);}
+		File(const Path& path, u32 openFlags, const FileStat& stat, FS_Archive& archive=sdmcArchive) {open(path, openFlags, stat, archive);}
 		File(const FS_Path& lowPath, u32 openFlags, FS_Archive& archive=sdmcArchive) {open(lowPath, openFlags, archive);}
 		File() {}
 		~File() {close();}
 
 
-		void open(const std::u16string& path, u32 openFlags, FS_Archive& archive=sdmcArchive);
+		void open(const Path& path, u32 openFlags, FS_Archive& archive=sdmcArchive);
+		void open(const Path& path, u32 openFlags, const FileStat& stat, FS_Archive& archive=sdmcArchive) {open(path, openFlags, archive); setStat(stat);}
 		void open(const FS_Path& lowPath, u32 openFlags, FS_Archive& archive=sdmcArchive);
 		u32  read(void *buf, u32 size);
 		u32  write(const void *buf, u32 size);
 		void flush();
 		void seek(const u64 offset, fsSeekMode mode);
 		u64  tell() {return _offset_;}
-		u64  size();
+		u64  size() {return stat().size;}
 		void setSize(const u64 size);
-		void close() {if(_fileHandle_) FSFILE_Close(_fileHandle_); _fileHandle_ = 0;}
-		void move(const std::u16string& dst, FS_Archive& dstArchive=sdmcArchive);
-		u64  copy(const std::u16string& dst, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr, FS_Archive& dstArchive=sdmcArchive);
+		const FileStat& stat();
+		void setStat(const FileStat& stat) {_stat_ = stat; _statValid_ = true;}
+		void close() {if(_fileHandle_) ipc::FSFILE_Close(_fileHandle_); _fileHandle_ = 0; _statValid_ = false;}
+		void move(const Path& dst, FS_Archive& dstArchive=sdmcArchive);
+		u64  copy(const Path& dst, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr, FS_Archive& dstArchive=sdmcArchive);
 		void del(); // Delete the currently opened file
 
+		// Async I/O through the I/O thread. These don't use or change the current offset.
+		// All requests must be consumed with wait() or ioPoll() before the file is closed.
+		IoToken readAsync(void *buf, u32 size, u64 offset);
+		IoToken writeAsync(const void *buf, u32 size, u64 offset);
+		u32     wait(IoToken token); // Throws on failure and short transfers. Returns the number of bytes transferred
+
 		// Don't use setFileHandle() for normal files! Only for AM file handles or similar.
 		Handle getFileHandle() {return _fileHandle_;}
-		void   setFileHandle(Handle fileHandle) {_fileHandle_ = fileHandle; _offset_ = 0;}
+		void   setFileHandle(Handle fileHandle) {_fileHandle_ = fileHandle; _offset_ = 0; _statValid_ = false;}
+	};
+
+
+	// Random-access view of a file backed by an LRU cache of blockSize aligned blocks.
+	// Lets parsers index into a file as if it was mapped. Doesn't change the file offset.
+	class FileView
+	{
+		struct Block
+		{
+			u64 index;
+			u64 lastUse;
+			u32 size;
+			bool valid;
+		};
+
+		File& _file_;
+		const u32 _blockSize_;
+		std::vector<Block> _blocks_;
+		Buffer<u8> _data_;
+		u64 _fileSize_;
+		u64 _clock_ = 0;
+		u64 _hits_ = 0;
+		u64 _misses_ = 0;
+		u64 _bytesRead_ = 0;
+
+		FileView(const FileView&);
+		FileView& operator =(const FileView&);
+
+		const u8* block(u64 index, u32& size); // Loads the block if it isn't cached
+
+
+	public:
+		FileView(File& file, u32 blockSize=VIEW_BLOCK_SIZE, u32 blockCount=VIEW_BLOCK_COUNT);
+
+		u64  size() {return _fileSize_;}
+		void read(u64 offset, void *buf, u32 size); // Throws if the range is outside of the file
+		template<class T> T get(u64 offset) {T tmp; read(offset, &tmp, sizeof(T)); return tmp;}
+		u8   operator [](u64 offset) {return get<u8>(offset);}
+		// Pointer into the cache. Valid until the next access. nullptr if the range crosses blocks
+		const u8* span(u64 offset, u32 size);
+		void invalidate(); // Drop all cached blocks, for example after writing to the file
+
+		u64 hits() {return _hits_;}
+		u64 misses() {return _misses_;}
+		u64 bytesRead() {return _bytesRead_;} // Bytes read from the file
+		u32 hitRate() {return (_hits_ + _misses_ ? _hits_ * 100 / (_hits_ + _misses_) : 0);} // In percent
 	};
 
 
 	// Other file functions
-	bool fileExist(const std::u16string& path, FS_Archive& archive=sdmcArchive);
-	void moveFile(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
-	u64  copyFile(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
-	void deleteFile(const std::u16string& path, FS_Archive& archive=sdmcArchive);
+	bool fileExist(const Path& path, FS_Archive& archive=sdmcArchive);
+	void moveFile(const Path& src, const Path& dst, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
+	u64  copyFile(const Path& src, const Path& dst, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
+	u64  copyFile(const Path& src, const Path& dst, const FileStat& srcStat, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
+	u64  copyFile(const Path& src, const Path& dst, const FileStat& srcStat, Buffer<u8>& buffer, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
+	void deleteFile(const Path& path, FS_Archive& archive=sdmcArchive);
 
 
 	struct DirInfo
@@ -119,22 +233,143 @@ namespace fs
 		std::u16string name;
 		bool isDir;
 		u64 size;
+		u32 attributes;
+
+		DirEntry(std::u16string name, bool isDir, u64 size, u32 attributes=0) : name(name), isDir(isDir), size(size), attributes(attributes) {}
 
-		DirEntry(std::u16string name, bool isDir, u64 size) : name(name), isDir(isDir), size(size) {}
+		FileStat stat() const {return {size, attributes};}
+	};
+
+
+	// Precompiled listDirContents() filter. Format is "entry1;entry2;..." for example
+	// ".txt;.png;". "" means list everything. Dirs always match, files starting
+	// with '.' never match a non-empty filter.
+	class DirFilter
+	{
+		struct Suffix
+		{
+			std::u16string str;
+			u32 length;
+		};
+
+		std::vector<Suffix> _suffixes_;
+
+
+	public:
+		explicit DirFilter(const std::u16string& filter=u"");
+
+		bool match(const FS_DirectoryEntry& entry, u32 nameLen) const;
+	};
+
+
+	// Entry returned by Dir. name points into Dir's batch buffer and is NOT
+	// null terminated. It stays valid until the next entry is requested.
+	struct DirEntryRef
+	{
+		const char16_t *name;
+		u32 nameLen;
+		bool isDir;
+		u64 size;
+		u32 attributes;
+
+		DirEntry toEntry() const {return DirEntry(std::u16string(name, nameLen), isDir, size, attributes);}
+		FileStat stat() const {return {size, attributes};}
+	};
+
+
+	// Streams the entries of a dir batch by batch without any per-entry allocations.
+	// Entries come in FS order. This is a single pass range: begin() starts reading.
+	class Dir
+	{
+		Handle _dirHandle_ = 0;
+		DirFilter _filter_;
+		Buffer<FS_DirectoryEntry> _entries_;
+		u32 _count_ = 0; // Valid entries in _entries_
+		u32 _pos_ = 0;
+		bool _eof_ = false;
+		DirEntryRef _current_;
+
+		Dir(const Dir&);
+		Dir& operator =(const Dir&);
+
+
+	public:
+		class iterator
+		{
+			Dir *_dir_;
+
+		public:
+			iterator(Dir *dir) : _dir_(dir) {}
+
+			const DirEntryRef& operator *() const {return _dir_->_current_;}
+			const DirEntryRef* operator ->() const {return &_dir_->_current_;}
+			iterator& operator ++() {if(!_dir_->next()) _dir_ = nullptr; return *this;}
+			bool operator ==(const iterator& other) const {return _dir_ == other._dir_;}
+			bool operator !=(const iterator& other) const {return _dir_ != other._dir_;}
+		};
+
+
+		Dir(const Path& path, const DirFilter& filter=DirFilter(), FS_Archive& archive=sdmcArchive, u32 batchSize=DIR_READ_BATCH);
+		~Dir() {if(_dirHandle_) ipc::FSDIR_Close(_dirHandle_);}
+
+		const DirEntryRef* next(); // Returns nullptr after the last entry
+		void close();
+
+		iterator begin() {return iterator(next() ? this : nullptr);}
+		iterator end() {return iterator(nullptr);}
+	};
+
+
+	// Iterative depth-first directory walker. Every directory is listed exactly once
+	// and its listing is kept until all of its entries have been visited.
+	// Entries of a dir come in FS order but parents always come before their children.
+	class DirWalker
+	{
+		struct Level
+		{
+			std::vector<DirEntry> entries;
+			size_t pos;
+		};
+
+		std::vector<Level> _levels_;
+		Path _path_;
+		FS_Archive *_archive_;
+		bool _hasEntry_ = false;
+		bool _descend_ = false;
+
+
+	public:
+		DirWalker(const Path& path, FS_Archive& archive=sdmcArchive);
+
+		const DirEntry* next(); // Returns nullptr after the last entry
+		void skip() {_descend_ = false;} // Don't descend into the dir last returned by next()
+		const Path& path() {return _path_;} // Full path of the entry last returned by next()
+		u32  depth() {return _levels_.size();}
 	};
 
 
 	// Directory functions
-	bool dirExist(const std::u16string& path, FS_Archive& archive=sdmcArchive);
-	void makeDir(const std::u16string& path, FS_Archive& archive=sdmcArchive);
-	void makePath(const std::u16string& path, FS_Archive& archive=sdmcArchive);
-	DirInfo getDirInfo(const std::u16string& path, FS_Archive& archive=sdmcArchive);
-	std::vector<DirEntry> listDirContents(const std::u16string& path, const std::u16string filter=u"", FS_Archive& archive=sdmcArchive);
-	void moveDir(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
-	void copyDir(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& fsObject, u32 totalPercent, u32 filePercent)> callback=nullptr, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
-	void deleteDir(const std::u16string& path, FS_Archive& archive=sdmcArchive);
+	bool dirExist(const Path& path, FS_Archive& archive=sdmcArchive);
+	void makeDir(const Path& path, FS_Archive& archive=sdmcArchive);
+	void createDir(const Path& path, FS_Archive& archive=sdmcArchive);
+	void makePath(const Path& path, FS_Archive& archive=sdmcArchive);
+	DirInfo getDirInfo(const Path& path, FS_Archive& archive=sdmcArchive);
+	std::vector<DirEntry> listDirContents(const Path& path, const std::u16string filter=u"", FS_Archive& archive=sdmcArchive);
+	std::vector<DirEntry> listDirContents(const Path& path, const DirFilter& filter, FS_Archive& archive=sdmcArchive, u32 batchSize=DIR_READ_BATCH);
+	void sortDirEntries(std::vector<DirEntry>& entries); // Dirs first, then by name
+	void moveDir(const Path& src, const Path& dst, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
+	void copyDir(const Path& src, const Path& dst, std::function<void (const std::u16string& fsObject, u32 totalPercent, u32 filePercent)> callback=nullptr, FS_Archive& srcArchive=sdmcArchive, FS_Archive& dstArchive=sdmcArchive);
+	void deleteDir(const Path& path, FS_Archive& archive=sdmcArchive);
+
+	// Async I/O functions. Without ioQueueInit() requests run synchronously on submission.
+	void     ioQueueInit();
+	void     ioQueueExit();
+	IoToken  ioSubmit(Handle fileHandle, void *buf, u32 size, u64 offset, bool write);
+	bool     ioPoll(IoToken token, IoResult *result=nullptr); // Returns true and consumes the token once it completed
+	IoResult ioWait(IoToken token);
 
 	// Misc functions
+	u32  entryNameLength(const FS_DirectoryEntry& entry);
 	void addToPath(std::u16string& path, const std::u16string& dirOrFile);
 	void removeFromPath(std::u16string& path);
 } // namespace fs
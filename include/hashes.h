@@ -19,6 +19,7 @@
 #ifndef _HASHES_H_
 #define _HASHES_H_
 
+#include <array>
 #include <unordered_map>
 #include <string>
 #include <3ds.h>
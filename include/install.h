@@ -0,0 +1,109 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _INSTALL_H_
+#define _INSTALL_H_
+
+#include <array>
+#include <unordered_map>
+#include <3ds.h>
+#include "error.h"
+#include "thread.h"
+
+#define INSTALL_QUEUE_SIZE  (16)
+#define INSTALL_STACK_SIZE  (0x10000) // 64 KB
+#define INSTALL_CANCEL_POLL (10000000LL) // 10 ms. How often a blocked worker checks for cancel()
+#define UPDATES_BUNDLE_PATH u"/updates.bundle" // Used instead of /updates if it exists
+#define UPDATES_MANIFEST_PATH u"/updates.manifest" // Pack of CIAs in the store (see store.h), used instead of /updates if it exists
+
+
+
+// Known good firmware packs, see hashes.h
+typedef std::array<uint8_t,32> Sha256Hash;
+typedef std::unordered_map<u64, Sha256Hash> TitleHashes;   // CIA title ID -> SHA-256 of the CIA
+typedef std::unordered_map<u64, TitleHashes> RegionHashes; // Home Menu title ID -> pack for that region
+typedef std::unordered_map<u64, RegionHashes> DeviceHashes; // NATIVE_FIRM title ID -> regions
+typedef std::unordered_map<int, DeviceHashes> FirmwareDb;   // NATIVE_FIRM version -> devices
+
+typedef enum
+{
+	INSTALL_MSG_PROGRESS = 0, // key (title number), total, percent
+	INSTALL_MSG_PROMPT,       // Waits for answer(). The question was logged already
+	INSTALL_MSG_DONE,
+	INSTALL_MSG_FAILED        // text
+} InstallMsgType;
+
+typedef struct
+{
+	InstallMsgType type;
+	u32 key;
+	u32 total;
+	u32 percent;
+	char text[ERR_STR_SIZE];
+} InstallMsg;
+
+// Runs installUpdates() on a worker thread. The main loop polls messages
+// once per frame and answers prompts. Progress messages are dropped instead
+// of blocking the worker if the main loop falls behind. Without a thread the
+// install runs in the constructor and prompts poll the buttons directly.
+// Once cancelled the worker no longer waits for the main loop: open and
+// later prompts are answered with no and undelivered messages are dropped.
+class Installer
+{
+	BoundedQueue<InstallMsg> _messages_;
+	BoundedQueue<bool> _answers_;
+	const bool _downgrade_;
+	bool _finished_;
+	bool _cancelled_;
+	bool _threaded_;  // Only accessed by the installing thread
+	Worker *_worker_; // Created last. It uses everything above
+
+	Installer(const Installer&);
+	Installer& operator =(const Installer&);
+
+	void run(bool threaded);
+	bool send(const InstallMsg& msg); // Blocks until there is room. false if cancelled
+	bool cancelled() {return __atomic_load_n(&_cancelled_, __ATOMIC_ACQUIRE);}
+
+
+public:
+	Installer(bool downgrade);
+	~Installer(); // Cancels and waits for the install to finish
+
+	// Main loop side
+	bool poll(InstallMsg& msg) {return _messages_.tryPop(msg);}
+	void answer(bool yes) {_answers_.push(yes);}
+	bool finished() {return __atomic_load_n(&_finished_, __ATOMIC_ACQUIRE);}
+	void cancel(); // Doesn't interrupt a title that is being installed
+
+	// Worker side
+	void progress(u32 key, u32 total, u32 percent);
+	bool confirm(); // Blocks until the main loop answers
+};
+
+// The built-in hashes unless replaced. setFirmwareDb() is meant for testing with
+// generated packs, nullptr restores the built-in hashes. Don't call it during an install.
+const FirmwareDb& firmwareDb();
+void setFirmwareDb(const FirmwareDb *db);
+
+// If downgrade is true we don't care about versions (except equal versions) and uninstall newer versions
+void installUpdates(bool downgrade, Installer& installer);
+
+#endif // _INSTALL_H_
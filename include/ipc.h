@@ -0,0 +1,111 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+#ifndef _IPC_H_
+#define _IPC_H_
+
+#include <cstdio>
+#include <3ds.h>
+#include "ipcformat.h"
+
+#ifndef IPC_RECORD_FILE_PATH
+#define IPC_RECORD_FILE_PATH    "/sysDowngrader.ipc"
+#endif
+#define IPC_RECORD_DEFAULT_SIZE (0x200000) // 2 MB, roughly 50000 calls
+#ifndef IPC_STATS_FILE_PATH
+#define IPC_STATS_FILE_PATH     "/sysDowngrader.stats"
+#endif
+#define IPC_HISTOGRAM_BUCKETS   (24) // Bucket i counts calls taking [2^i, 2^(i+1)) us. The last one everything longer
+
+
+
+// All service calls of the app go through these wrappers. They have the
+// signatures of the libctru functions of the same name.
+// Build with -DENABLE_IPC_RECORD to record every call with its arguments,
+// result and duration. Replay recordings with host/bench/ipcreplay.
+// Without it the IPC_RECORD_* macros compile to nothing.
+// Per call counts, bytes and latency histograms are always kept.
+namespace ipc
+{
+	struct CallStats
+	{
+		u32 count;
+		u32 errors;  // Calls which returned an error
+		u64 bytes;   // Transferred by FSFILE_Read(), FSFILE_Write() and FSUSER_UpdateSha256Context()
+		u64 totalUs;
+		u32 maxUs;
+		u32 histogram[IPC_HISTOGRAM_BUCKETS];
+	};
+
+	const char* callName(IpcCall call);
+	void getStats(IpcCall call, CallStats& stats);
+	void resetStats();
+	void dumpStats(FILE *f); // Text table of all calls made so far
+	void writeStats();       // dumpStats() to IPC_STATS_FILE_PATH
+
+#ifdef ENABLE_IPC_RECORD
+	void recordInit(u32 size=IPC_RECORD_DEFAULT_SIZE);
+	void recordExit(); // Writes the recording to the SD card and frees the buffer
+#endif
+
+	Result FSUSER_OpenArchive(FS_Archive* archive, FS_ArchiveID id, FS_Path path);
+	Result FSUSER_CloseArchive(FS_Archive archive);
+	Result FSUSER_OpenFile(Handle* out, FS_Archive archive, FS_Path path, u32 openFlags, u32 attributes);
+	Result FSUSER_OpenFileDirectly(Handle* out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes);
+	Result FSUSER_DeleteFile(FS_Archive archive, FS_Path path);
+	Result FSUSER_RenameFile(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath);
+	Result FSUSER_OpenDirectory(Handle* out, FS_Archive archive, FS_Path path);
+	Result FSUSER_CreateDirectory(FS_Archive archive, FS_Path path, u32 attributes);
+	Result FSUSER_RenameDirectory(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath);
+	Result FSUSER_DeleteDirectoryRecursively(FS_Archive archive, FS_Path path);
+	Result FSUSER_UpdateSha256Context(const void* data, u32 inputSize, u8* hash);
+
+	Result FSFILE_Read(Handle handle, u32* bytesRead, u64 offset, void* buffer, u32 size);
+	Result FSFILE_Write(Handle handle, u32* bytesWritten, u64 offset, const void* buffer, u32 size, u32 flags);
+	Result FSFILE_GetSize(Handle handle, u64* size);
+	Result FSFILE_SetSize(Handle handle, u64 size);
+	Result FSFILE_Flush(Handle handle);
+	Result FSFILE_Close(Handle handle);
+
+	Result FSDIR_Read(Handle handle, u32* entriesRead, u32 entryCount, FS_DirectoryEntry* entries);
+	Result FSDIR_Close(Handle handle);
+
+	Result AM_GetTitleCount(FS_MediaType mediatype, u32* count);
+	Result AM_GetTitleList(u32* titlesRead, FS_MediaType mediatype, u32 titleCount, u64* titleIds);
+	Result AM_GetTitleInfo(FS_MediaType mediatype, u32 titleCount, u64* titleIds, AM_TitleEntry* titleInfo);
+	Result AM_GetTitleProductCode(FS_MediaType mediatype, u64 titleId, char* productCode);
+	Result AM_GetCiaFileInfo(FS_MediaType mediatype, AM_TitleEntry* titleEntry, Handle fileHandle);
+	Result AM_StartCiaInstall(FS_MediaType mediatype, Handle* ciaHandle);
+	Result AM_FinishCiaInstall(Handle ciaHandle);
+	Result AM_CancelCIAInstall(Handle ciaHandle);
+	Result AM_DeleteTitle(FS_MediaType mediatype, u64 titleID);
+	Result AM_DeleteAppTitle(FS_MediaType mediatype, u64 titleID);
+	Result AM_InstallFirm(u64 titleID);
+
+	Result CFGU_SecureInfoGetRegion(u8* region);
+}
+
+#ifdef ENABLE_IPC_RECORD
+#define IPC_RECORD_INIT()  ipc::recordInit()
+#define IPC_RECORD_EXIT()  ipc::recordExit()
+#else
+#define IPC_RECORD_INIT()  ((void)0)
+#define IPC_RECORD_EXIT()  ((void)0)
+#endif // ENABLE_IPC_RECORD
+
+#endif // _IPC_H_
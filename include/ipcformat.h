@@ -0,0 +1,102 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _IPCFORMAT_H_
+#define _IPCFORMAT_H_
+
+// On-disk layout of /sysDowngrader.ipc, the recorded service calls that
+// ipcreplay runs again on the host.
+
+#include <stdint.h>
+
+#define IPC_RECORD_MAGIC    (0x50494453) // "SDIP"
+#define IPC_RECORD_VERSION  (1)
+
+// X(id, name)
+#define IPC_CALL_LIST(X) \
+	X(IPC_FSUSER_OPEN_ARCHIVE,                 "FSUSER_OpenArchive")                 \
+	X(IPC_FSUSER_CLOSE_ARCHIVE,                "FSUSER_CloseArchive")                \
+	X(IPC_FSUSER_OPEN_FILE,                    "FSUSER_OpenFile")                    \
+	X(IPC_FSUSER_OPEN_FILE_DIRECTLY,           "FSUSER_OpenFileDirectly")            \
+	X(IPC_FSUSER_DELETE_FILE,                  "FSUSER_DeleteFile")                  \
+	X(IPC_FSUSER_RENAME_FILE,                  "FSUSER_RenameFile")                  \
+	X(IPC_FSUSER_OPEN_DIRECTORY,               "FSUSER_OpenDirectory")               \
+	X(IPC_FSUSER_CREATE_DIRECTORY,             "FSUSER_CreateDirectory")             \
+	X(IPC_FSUSER_RENAME_DIRECTORY,             "FSUSER_RenameDirectory")             \
+	X(IPC_FSUSER_DELETE_DIRECTORY_RECURSIVELY, "FSUSER_DeleteDirectoryRecursively")  \
+	X(IPC_FSUSER_UPDATE_SHA256_CONTEXT,        "FSUSER_UpdateSha256Context")         \
+	X(IPC_FSFILE_READ,                         "FSFILE_Read")                        \
+	X(IPC_FSFILE_WRITE,                        "FSFILE_Write")                       \
+	X(IPC_FSFILE_GET_SIZE,                     "FSFILE_GetSize")                     \
+	X(IPC_FSFILE_SET_SIZE,                     "FSFILE_SetSize")                     \
+	X(IPC_FSFILE_FLUSH,                        "FSFILE_Flush")                       \
+	X(IPC_FSFILE_CLOSE,                        "FSFILE_Close")                       \
+	X(IPC_FSDIR_READ,                          "FSDIR_Read")                         \
+	X(IPC_FSDIR_CLOSE,                         "FSDIR_Close")                        \
+	X(IPC_AM_GET_TITLE_COUNT,                  "AM_GetTitleCount")                   \
+	X(IPC_AM_GET_TITLE_LIST,                   "AM_GetTitleList")                    \
+	X(IPC_AM_GET_TITLE_INFO,                   "AM_GetTitleInfo")                    \
+	X(IPC_AM_GET_TITLE_PRODUCT_CODE,           "AM_GetTitleProductCode")             \
+	X(IPC_AM_GET_CIA_FILE_INFO,                "AM_GetCiaFileInfo")                  \
+	X(IPC_AM_START_CIA_INSTALL,                "AM_StartCiaInstall")                 \
+	X(IPC_AM_FINISH_CIA_INSTALL,               "AM_FinishCiaInstall")                \
+	X(IPC_AM_CANCEL_CIA_INSTALL,               "AM_CancelCIAInstall")                \
+	X(IPC_AM_DELETE_TITLE,                     "AM_DeleteTitle")                     \
+	X(IPC_AM_DELETE_APP_TITLE,                 "AM_DeleteAppTitle")                  \
+	X(IPC_AM_INSTALL_FIRM,                     "AM_InstallFirm")                     \
+	X(IPC_CFGU_SECURE_INFO_GET_REGION,         "CFGU_SecureInfoGetRegion")
+
+#define IPC_ENUM_ENTRY(id, name) id,
+enum IpcCall
+{
+	IPC_CALL_LIST(IPC_ENUM_ENTRY)
+	IPC_CALL_COUNT
+};
+#undef IPC_ENUM_ENTRY
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t recordSize;
+	uint32_t bytes;       // Records including their path data after this header
+	uint32_t recordCount;
+	uint32_t dropped;     // Records lost because the buffer was full
+	uint32_t reserved;
+} IpcRecordHeader;
+
+// Followed by pathSize bytes of path data, padded to a multiple of 4.
+// Renames store both paths back to back, arg is the size of the first one.
+typedef struct
+{
+	uint32_t start;       // Microseconds since recording started
+	uint32_t duration;    // Microseconds
+	uint8_t  call;        // IpcCall
+	uint8_t  thread;      // Low 8 bits of the kernel thread ID
+	uint8_t  pathType;    // FS_PathType of the path data
+	uint8_t  reserved;
+	uint32_t pathSize;
+	int32_t  res;
+	uint32_t handle;      // Handle the call used or, for open calls, created
+	uint32_t size;        // Bytes or entries requested. Call specific for others
+	uint32_t done;        // Bytes or entries transferred
+	uint64_t arg;         // Offset, title ID, open flags or archive. Call specific
+} IpcRecord;
+
+#endif // _IPCFORMAT_H_
@@ -0,0 +1,97 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+#include <3ds.h>
+#include "fs.h"
+#include "misc.h"
+
+#define LZ4_FRAME_MAGIC      (0x184D2204)
+#define LZ4_MAX_HEADER_SIZE  (19)       // Magic, FLG, BD, content size, dict ID and HC
+#define LZ4_MAX_BLOCK_SIZE   (0x100000) // 1 MB. Frames with bigger blocks are rejected
+#define LZ4_MIN_MATCH        (4)
+#define LZ4_LAST_LITERALS    (5)        // A block always ends with this many literals
+#define LZ4_MFLIMIT          (12)       // Matches must start at least this far before the end
+#define LZ4_UNCOMPRESSED     (0x80000000) // Block size flag for stored blocks
+
+
+
+// Reader for the LZ4 frame format (what the lz4 tool writes). Only frames with
+// independent blocks of at most LZ4_MAX_BLOCK_SIZE and the content size in the
+// header are supported, for example "lz4 -B6 -BI --content-size". Block and
+// content checksums are skipped, the decompressed data is hashed anyway.
+namespace lz4
+{
+	struct FrameInfo
+	{
+		u32 headerSize;   // Offset of the first block
+		u32 blockMaxSize;
+		bool blockChecksum;
+		bool contentChecksum;
+		u64 contentSize;
+	};
+
+	u32  xxh32(const void *data, u32 size, u32 seed);
+	// Throws if the header is invalid or uses a feature we don't support
+	void parseFrameHeader(const u8 *data, u32 size, FrameInfo& info);
+	// Returns the decompressed size or -1 if the block is corrupt or doesn't fit into dst
+	s32  decompressBlock(const u8 *src, u32 srcSize, u8 *dst, u32 dstCapacity);
+
+
+	// Streams the decompressed blocks of the frame at [start, start + size) of a file.
+	// Each read fetches a block and the size of the next one. With prefetch the next
+	// block is read through the I/O thread while the caller works on the current one.
+	// Needs 2 input buffers and 1 output buffer of blockMaxSize, no matter the file size.
+	class FrameReader
+	{
+		fs::File& _file_;
+		const u64 _start_;
+		const u64 _size_;
+		u32 _next_;        // Size field of the next block. 0 is the end mark
+		const FrameInfo _info_;
+		const bool _prefetch_;
+		Buffer<u8> _in0_, _in1_, _out_;
+		u8 *_in_[2];
+		u32 _cur_ = 0;     // Input buffer the next block goes to
+		u64 _offset_;      // Of the next block's data, relative to _start_
+		u64 _produced_ = 0;
+		fs::IoToken _pending_ = 0;
+		u32 _fetched_ = 0; // Bytes _pending_ reads
+
+		FrameReader(const FrameReader&);
+		FrameReader& operator =(const FrameReader&);
+
+		static FrameInfo readHeader(fs::File& file, u64 start, u64 size, u32& firstBlock);
+		void fetch();
+
+
+	public:
+		FrameReader(fs::File& file, u64 start, u64 size, bool prefetch=true);
+		~FrameReader() {if(_pending_) fs::ioWait(_pending_);}
+
+		const FrameInfo& info() const {return _info_;}
+		u64 produced() const {return _produced_;}
+		// Returns the next decompressed block, valid until the next call. nullptr after the last block
+		const u8* next(u32& size);
+	};
+} // namespace lz4
+
+#endif // _LZ4_H_
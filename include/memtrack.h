@@ -0,0 +1,100 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _MEMTRACK_H_
+#define _MEMTRACK_H_
+
+#include <cstdio>
+#include <3ds.h>
+
+#ifndef MEM_STATS_FILE_PATH
+#define MEM_STATS_FILE_PATH  "/sysDowngrader.mem"
+#endif
+#ifndef MEM_BUDGET
+#define MEM_BUDGET           (0x1800000) // 24 MB. Heap in use above which a warning is logged. 0 disables it
+#endif
+#define MEM_MAX_PHASES       (16)
+
+
+
+// Every operator new/delete of the app goes through the tracker. It counts
+// allocations and bytes and keeps the heap in use and its peak, overall and
+// per phase. Buffer<T> also reports its allocations here, so large buffers
+// can be told apart and warn before they push the heap over the budget.
+// Other allocations that cross the budget are flagged at the end of their phase.
+namespace mem
+{
+	struct Usage
+	{
+		u32 allocs;
+		u32 frees;
+		u64 bytes;        // Allocated in total
+		u64 inUse;
+		u64 peak;
+		u64 buffersInUse; // Held by Buffer<T>
+		u64 buffersPeak;
+	};
+
+	struct PhaseUsage
+	{
+		const char *name;
+		u32 allocs;
+		u64 bytes;
+		u64 startInUse; // When the phase began
+		u64 peak;
+		u64 buffersPeak;
+		bool overBudget;
+	};
+
+	Usage usage();
+	void resetPhases();
+	u32  phaseCount();
+	PhaseUsage phase(u32 index);
+
+	void setBudget(u64 bytes);
+	u64  budget();
+
+	// Phases are sequential. Beginning one ends the current one
+	void beginPhase(const char *name);
+	void endPhase();
+
+	// Logs a warning if allocating bytes more would put the heap over the budget
+	void checkBudget(u64 bytes);
+
+	// Called by Buffer<T>
+	void bufferAllocated(u64 bytes);
+	void bufferFreed(u64 bytes);
+
+	void dumpStats(FILE *f); // Text table of the phases so far
+	void writeStats();       // dumpStats() to MEM_STATS_FILE_PATH
+
+	// Begins a phase and ends whichever phase is current when leaving the scope
+	class PhaseScope
+	{
+		PhaseScope(const PhaseScope&);
+		PhaseScope& operator =(const PhaseScope&);
+
+
+	public:
+		PhaseScope(const char *name) {beginPhase(name);}
+		~PhaseScope() {endPhase();}
+	};
+}
+
+#endif // _MEMTRACK_H_
@@ -20,8 +20,12 @@
 #ifndef _MISC_H_
 #define _MISC_H_
 
+#include <cstdarg>
+#include <cstdio>
 #include <cstring>
 #include <3ds.h>
+#include "memtrack.h"
+#include "thread.h"
 
 template<class T>
 class Buffer
@@ -31,8 +35,14 @@ class Buffer
 
 public:
 	// Clears mem by default to avoid problems
-	Buffer(u32 elementCnt, bool clearMem=true) : elements(elementCnt) {ptr = new T[elementCnt]; if(clearMem) clear();}
-	~Buffer() {delete[] ptr;}
+	Buffer(u32 elementCnt, bool clearMem=true) : elements(elementCnt)
+	{
+		mem::checkBudget(size());
+		ptr = new T[elementCnt];
+		mem::bufferAllocated(size());
+		if(clearMem) clear();
+	}
+	~Buffer() {delete[] ptr; mem::bufferFreed(size());}
 
 	void clear() {memset(ptr, 0, size());}
 	u32 size() {return elements*sizeof(T);}
@@ -41,13 +51,53 @@ public:
 	T& operator [](u32 element) {return ptr[element];}
 };
 
+#ifndef LOG_FILE_PATH
+#define LOG_FILE_PATH   "/sysDowngrader.log"
+#endif
+#define LOG_GENERATIONS (4)       // LOG_FILE_PATH plus .1 to .3 from earlier runs
+#define LOG_FILE_SIZE   (0x40000) // Preallocated. Written as a ring
+#define LOG_HEADER_SIZE (64)      // Text line at the start of the file describing the ring
+#define LOG_SLOT_SIZE   (384) // Fits an exception message. Longer messages are truncated
+#define LOG_SLOT_COUNT  (64)
+#define LOG_BATCH_SIZE  (0x1000)
+
+// Messages are formatted into the slots of a lock-free ring buffer which any
+// thread can write to. A background thread writes them to the SD card in batches.
+// The log file has a fixed size so writing it never grows the file. Once full it
+// wraps around. The header line says where the oldest text starts.
 class Logging {
+  struct Slot {
+    u32 seq; // == position when free, position+1 when filled
+    u32 len;
+    char text[LOG_SLOT_SIZE];
+  };
+
   FILE *lgf;
+  u32 filePos; // Next write offset in the log file
+  bool wrapped;
+  Slot slots[LOG_SLOT_COUNT];
+  u32 head; // Next position producers reserve
+  u32 tail; // Next position the writer consumes
+  bool quit;
+  Event pending;
+  Event drained;
+  Worker *writer;
+  Mutex fallback; // Only used if the writer thread couldn't be created
+  char batch[LOG_BATCH_SIZE]; // Owned by whoever consumes
+
+  char *reserve(u32 &pos);
+  void publish(u32 pos, int len);
+  void vlog(const char *fmt, va_list ap);
+  void openFile();
+  void writeFile(const char *buf, u32 len);
+  bool drain();
+  void writerLoop();
+
   public:
     Logging();
     ~Logging();
     void logprintf(const char *fmt, ...);
-		void logsnprintf(char *str, size_t sz, const char *fmt, ...);
+    void flush(); // Blocks until everything logged so far is on the SD card
 };
 
 extern Logging *logging;
@@ -0,0 +1,49 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <3ds.h>
+
+#define SHA256_HASH_SIZE  (32)
+
+
+
+// Incremental SHA-256 (FIPS 180-4) in software. ipc::FSUSER_UpdateSha256Context()
+// needs all data in one buffer, this hashes streams of any size in pieces.
+class Sha256
+{
+	u32 _state_[8];
+	u64 _length_;
+	u8 _block_[64];
+	u32 _used_; // Bytes in _block_
+
+
+public:
+	Sha256() {reset();}
+
+	void reset();
+	void update(const void *data, u32 size);
+	void finish(u8 *hash); // Writes SHA256_HASH_SIZE bytes. reset() before reusing
+
+	static void hash(const void *data, u32 size, u8 *hash);
+};
+
+#endif // _SHA256_H_
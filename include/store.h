@@ -0,0 +1,54 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _STORE_H_
+#define _STORE_H_
+
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "fs.h"
+#include "storeformat.h"
+
+#define STORE_DIR             u"/cias"
+#define STORE_MAX_ENTRIES     (0x400)
+
+
+
+// A pack manifest and the store its CIAs are in. The manifest is read and checked
+// when opening. Packs for other regions or devices share the CIAs they have in
+// common, so each is stored once. Every CIA is still hashed on every install.
+class Store
+{
+	const fs::Path _dir_;
+	std::vector<ManifestEntry> _entries_;
+
+	Store(const Store&);
+	Store& operator =(const Store&);
+
+
+public:
+	Store(const fs::Path& manifestPath, const fs::Path& dir=fs::Path(STORE_DIR), FS_Archive& archive=sdmcArchive);
+
+	const std::vector<ManifestEntry>& entries() const {return _entries_;}
+	const fs::Path& dir() const {return _dir_;}
+	static std::u16string blobName(const u8 *sha256); // <hex>.cia
+};
+
+#endif // _STORE_H_
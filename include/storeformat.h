@@ -0,0 +1,52 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _STOREFORMAT_H_
+#define _STOREFORMAT_H_
+
+// Layout of the content-addressed CIA store.
+//
+// Each CIA is stored once as /cias/<SHA-256 in upper case hex>.cia, whatever
+// pack, region or device it belongs to. A pack is a manifest (/updates.manifest)
+// listing title ID, version, size and hash of each of its CIAs.
+
+#include <stdint.h>
+
+#define MANIFEST_MAGIC       (0x5453464D) // "MFST"
+#define MANIFEST_VERSION     (1)
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t entrySize;
+	uint32_t entryCount;
+	uint32_t reserved;
+} ManifestHeader;
+
+typedef struct
+{
+	uint64_t titleID;
+	uint64_t size;       // Of the CIA
+	uint16_t version;
+	uint16_t reserved[3];
+	uint8_t  sha256[32]; // Of the CIA, also its name in the store
+} ManifestEntry;
+
+#endif // _STOREFORMAT_H_
@@ -0,0 +1,141 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include <functional>
+#include <vector>
+#include <3ds.h>
+
+#define WORKER_STACK_SIZE  (0x8000) // 32 KB
+
+
+// Thin wrappers around the libctru and kernel sync objects.
+// None of them are copyable because they own handles.
+
+class Mutex
+{
+	LightLock _lock_;
+
+	Mutex(const Mutex&);
+	Mutex& operator =(const Mutex&);
+
+
+public:
+	Mutex() {LightLock_Init(&_lock_);}
+
+	void lock() {LightLock_Lock(&_lock_);}
+	void unlock() {LightLock_Unlock(&_lock_);}
+};
+
+class LockGuard
+{
+	Mutex& _mutex_;
+
+	LockGuard(const LockGuard&);
+	LockGuard& operator =(const LockGuard&);
+
+
+public:
+	LockGuard(Mutex& mutex) : _mutex_(mutex) {_mutex_.lock();}
+	~LockGuard() {_mutex_.unlock();}
+};
+
+class Semaphore
+{
+	Handle _handle_ = 0;
+
+	Semaphore(const Semaphore&);
+	Semaphore& operator =(const Semaphore&);
+
+
+public:
+	Semaphore(s32 initialCount, s32 maxCount) {svcCreateSemaphore(&_handle_, initialCount, maxCount);}
+	~Semaphore() {svcCloseHandle(_handle_);}
+
+	void acquire() {svcWaitSynchronization(_handle_, -1);}
+	bool tryAcquire(s64 timeout=0) {return svcWaitSynchronization(_handle_, timeout) == 0;}
+	void release(s32 count=1) {s32 tmp; svcReleaseSemaphore(&tmp, _handle_, count);}
+};
+
+// Auto-clearing event. One waiter wakes up per signal.
+class Event
+{
+	Handle _handle_ = 0;
+
+	Event(const Event&);
+	Event& operator =(const Event&);
+
+
+public:
+	Event() {svcCreateEvent(&_handle_, RESET_ONESHOT);}
+	~Event() {svcCloseHandle(_handle_);}
+
+	void signal() {svcSignalEvent(_handle_);}
+	void wait() {svcWaitSynchronization(_handle_, -1);}
+	bool wait(s64 timeout) {return svcWaitSynchronization(_handle_, timeout) == 0;}
+};
+
+// Runs func on a new thread. The priority is relative to the creating thread,
+// higher offsets mean lower priority. join() is called by the destructor.
+class Worker
+{
+	Thread _thread_ = nullptr;
+	std::function<void ()> _func_;
+
+	Worker(const Worker&);
+	Worker& operator =(const Worker&);
+
+	static void entry(void *arg);
+
+
+public:
+	Worker(std::function<void ()> func, int prioOffset=1, size_t stackSize=WORKER_STACK_SIZE);
+	~Worker() {join();}
+
+	bool running() {return _thread_ != nullptr;}
+	void join();
+};
+
+// Blocking bounded FIFO for passing messages between threads
+template<class T>
+class BoundedQueue
+{
+	std::vector<T> _ring_;
+	u32 _head_ = 0;
+	u32 _tail_ = 0;
+	Mutex _mutex_;
+	Semaphore _free_;
+	Semaphore _used_;
+
+	void put(const T& item) {LockGuard lock(_mutex_); _ring_[_tail_] = item; _tail_ = (_tail_ + 1) % _ring_.size();}
+	void take(T& item) {LockGuard lock(_mutex_); item = _ring_[_head_]; _head_ = (_head_ + 1) % _ring_.size();}
+
+
+public:
+	BoundedQueue(u32 capacity) : _ring_(capacity), _free_(capacity, capacity), _used_(0, capacity) {}
+
+	void push(const T& item) {_free_.acquire(); put(item); _used_.release();}
+	bool tryPush(const T& item, s64 timeout=0) {if(!_free_.tryAcquire(timeout)) return false; put(item); _used_.release(); return true;}
+	void pop(T& item) {_used_.acquire(); take(item); _free_.release();}
+	bool tryPop(T& item, s64 timeout=0) {if(!_used_.tryAcquire(timeout)) return false; take(item); _free_.release(); return true;}
+};
+
+#endif // _THREAD_H_
@@ -25,23 +25,16 @@
 #include <vector>
 #include <cstdio>
 #include <3ds.h>
+#include "fs.h"
 #include "misc.h"
 
-class titleException : public std::exception
-{
-	char errStr[256];
-	Result res;
-
+#define CIA_BLOCK_SIZE  (MAX_BUF_SIZE / 2) // 1 MB. installCia() keeps two in flight, as much as one MAX_BUF_SIZE buffer
 
+class titleException : public ResultException
+{
 public:
 	titleException(const char *file, const int line, const Result res, const char *desc)
-	{
-    this->res = res;
-		logging->logsnprintf(errStr, 255, "\ntitleException:\n%s:%d: Result: 0x%X\n%s", file, line, (unsigned int)res, desc);
-	}
-
-	virtual const char* what() const noexcept {return errStr;}
-	const Result getErrCode() {return res;}
+		: ResultException("titleException", file, line, res, desc) {}
 };
 
 
@@ -92,8 +85,37 @@ struct Icon
 };
 
 
+// Layout of a CIA file. All offsets are absolute file offsets.
+struct CiaInfo
+{
+	u64 certOffset;
+	u32 certSize;
+	u64 ticketOffset;
+	u32 ticketSize;
+	u64 tmdOffset;
+	u32 tmdSize;
+	u64 contentOffset;
+	u64 contentSize;
+	u64 metaOffset;
+	u32 metaSize;
+	u64 titleID;
+	u16 version;
+	u16 contentCount;
+};
+
+
 std::vector<TitleInfo> getTitleInfos(FS_MediaType mediaType);
-void installCia(const std::u16string& path, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
+CiaInfo inspectCia(fs::FileView& view); // Parses header and TMD without going through AM
+// Same from the first size bytes of a CIA of ciaSize bytes, for example a decompressed block. Throws if they aren't enough
+CiaInfo inspectCia(const u8 *data, u32 size, u64 ciaSize);
+void installCia(const fs::Path& path, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
+void installCia(const fs::Path& path, const fs::FileStat& stat, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
+// Installs the CIA stored at [start, start + size) of an open file, for example a bundle entry. name is passed to callback
+void installCia(fs::File& file, u64 start, u64 size, const std::u16string& name, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
+// Installs the LZ4 frame stored at [start, start + size) of an open file, see lz4.h. Memory use doesn't depend on the CIA size
+void installCompressedCia(fs::File& file, u64 start, u64 size, const std::u16string& name, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
+// Installs the CIA a delta rebuilds from its base, see deltaformat.h. Memory use doesn't depend on the CIA size
+void installDeltaCia(const fs::Path& path, const std::u16string& name, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback=nullptr);
 void deleteTitle(FS_MediaType mediaType, u64 titleID);
 bool launchTitle(FS_MediaType mediaType, u8 flags, u64 titleID); // On applet launch it returns false if the applet can't be lauched
 #define relaunchApp() launchTitle(mediatype_SDMC, 2, 0)
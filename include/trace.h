@@ -0,0 +1,75 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <3ds.h>
+#include "traceformat.h"
+
+#ifndef TRACE_FILE_PATH
+#define TRACE_FILE_PATH        "/sysDowngrader.trace"
+#endif
+#define TRACE_DEFAULT_RECORDS  (0x8000) // 512 KB
+
+
+
+// Build with -DENABLE_TRACE to record a timeline of the service calls.
+// Without it all TRACE_* macros compile to nothing.
+#ifdef ENABLE_TRACE
+
+namespace trace
+{
+	void init(u32 capacity=TRACE_DEFAULT_RECORDS);
+	void exit(); // Writes the trace to the SD card and frees the buffer
+	void record(u16 id, u8 phase, u32 payload);
+
+	// Records a begin event now and the matching end event when leaving the scope
+	class Zone
+	{
+		const u16 _id_;
+
+		Zone(const Zone&);
+		Zone& operator =(const Zone&);
+
+
+	public:
+		Zone(u16 id, u32 payload) : _id_(id) {record(id, TRACE_PHASE_BEGIN, payload);}
+		~Zone() {record(_id_, TRACE_PHASE_END, 0);}
+	};
+}
+
+#define TRACE_CONCAT_(a, b)      a##b
+#define TRACE_CONCAT(a, b)       TRACE_CONCAT_(a, b)
+#define TRACE_INIT()             trace::init()
+#define TRACE_EXIT()             trace::exit()
+#define TRACE_ZONE(id, payload)  trace::Zone TRACE_CONCAT(_traceZone, __LINE__)((id), (payload))
+#define TRACE_EVENT(id, payload) trace::record((id), TRACE_PHASE_INSTANT, (payload))
+
+#else
+
+#define TRACE_INIT()             ((void)0)
+#define TRACE_EXIT()             ((void)0)
+#define TRACE_ZONE(id, payload)  ((void)0)
+#define TRACE_EVENT(id, payload) ((void)0)
+
+#endif // ENABLE_TRACE
+
+#endif // _TRACE_H_
@@ -0,0 +1,81 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#ifndef _TRACEFORMAT_H_
+#define _TRACEFORMAT_H_
+
+// On-disk layout of /sysDowngrader.trace. Shared with the host tools so
+// it only depends on the standard headers. Everything is little endian.
+
+#include <stdint.h>
+
+#define TRACE_MAGIC    (0x52544453) // "SDTR"
+#define TRACE_VERSION  (1)
+
+// X(id, name)
+#define TRACE_EVENT_LIST(X) \
+	X(TRACE_FS_READ,               "FSFILE_Read")          \
+	X(TRACE_FS_WRITE,              "FSFILE_Write")         \
+	X(TRACE_AM_GET_CIA_FILE_INFO,  "AM_GetCiaFileInfo")    \
+	X(TRACE_AM_START_CIA_INSTALL,  "AM_StartCiaInstall")   \
+	X(TRACE_AM_FINISH_CIA_INSTALL, "AM_FinishCiaInstall")  \
+	X(TRACE_AM_CANCEL_CIA_INSTALL, "AM_CancelCIAInstall")  \
+	X(TRACE_AM_INSTALL_FIRM,       "AM_InstallFirm")       \
+	X(TRACE_INSTALL_CIA,           "installCia")           \
+	X(TRACE_INSTALL_UPDATES,       "installUpdates")       \
+	X(TRACE_IO_WAIT,               "ioWait")               \
+	X(TRACE_CONSOLE_TIME,          "consoleTime")          /* Payload: us spent in console calls for one title */ \
+	X(TRACE_LZ4_DECOMPRESS,        "lz4Decompress")        /* Payload: compressed block size */
+
+#define TRACE_ENUM_ENTRY(id, name) id,
+enum TraceEventId
+{
+	TRACE_EVENT_LIST(TRACE_ENUM_ENTRY)
+	TRACE_EVENT_COUNT
+};
+#undef TRACE_ENUM_ENTRY
+
+enum TracePhase
+{
+	TRACE_PHASE_BEGIN   = 0,
+	TRACE_PHASE_END     = 1,
+	TRACE_PHASE_INSTANT = 2
+};
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t recordSize;
+	uint64_t tickRate;    // Ticks per second
+	uint32_t recordCount;
+	uint32_t dropped;     // Records lost because the buffer was full
+} TraceHeader;
+
+typedef struct
+{
+	uint64_t tick;
+	uint16_t id;
+	uint8_t  phase;
+	uint8_t  thread;      // Low 8 bits of the kernel thread ID
+	uint32_t payload;     // Event specific. Usually a size in bytes
+} TraceRecord;
+
+#endif // _TRACEFORMAT_H_
@@ -0,0 +1,70 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+#include <cstring>
+#include <vector>
+#include <3ds.h>
+#include "bundle.h"
+#include "fs.h"
+#include "misc.h"
+#include "title.h"
+
+#define _FILE_ "bundle.cpp" // Replacement for __FILE__ without the path
+
+
+
+Bundle::Bundle(const fs::Path& path, FS_Archive& archive) : _file_(path, FS_OPEN_READ, archive)
+{
+	const u64 fileSize = _file_.size();
+	const u32 firstRead = (fileSize<BUNDLE_INDEX_READ ? fileSize : BUNDLE_INDEX_READ);
+	Buffer<u8> index(firstRead, false);
+	BundleHeader header;
+
+
+	// One read gets the header and usually all entries
+	if(firstRead<sizeof(BundleHeader) || _file_.read(&index, firstRead)!=firstRead)
+		throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Bundle is truncated!");
+	memcpy(&header, &index, sizeof(BundleHeader));
+
+	if(header.magic!=BUNDLE_MAGIC || header.version!=BUNDLE_VERSION || header.entrySize!=sizeof(BundleEntry) ||
+	   !header.entryCount || header.entryCount>BUNDLE_MAX_ENTRIES || !header.align || (header.align & (header.align - 1)) ||
+	   header.indexSize!=sizeof(BundleHeader) + header.entryCount * sizeof(BundleEntry))
+		throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid bundle header!");
+	if(header.indexSize>fileSize) throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Bundle is truncated!");
+
+	_entries_.resize(header.entryCount);
+	const u32 inFirst = firstRead - sizeof(BundleHeader);
+	const u32 entryBytes = header.entryCount * sizeof(BundleEntry);
+	memcpy(_entries_.data(), &index[sizeof(BundleHeader)], (entryBytes<inFirst ? entryBytes : inFirst));
+	if(entryBytes>inFirst && _file_.read((u8*)_entries_.data() + inFirst, entryBytes - inFirst)!=entryBytes - inFirst)
+		throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Bundle is truncated!");
+
+	// Aligned, in order, not overlapping, inside the file and one per title
+	u64 end = header.indexSize;
+	for(size_t i = 0; i<_entries_.size(); i++)
+	{
+		const BundleEntry& it = _entries_[i];
+		if((it.offset & (header.align - 1)) || it.offset<end || !it.size || it.size>fileSize || it.offset>fileSize - it.size)
+			throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid bundle entry!");
+		for(size_t j = 0; j<i; j++)
+		{
+			if(_entries_[j].titleID==it.titleID) throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid bundle entry!");
+		}
+		end = it.offset + it.size;
+	}
+}
@@ -0,0 +1,208 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <3ds.h>
+#include "console.h"
+#include "thread.h"
+
+
+namespace console
+{
+	// Text waiting to be drawn
+	static char pending[CONSOLE_BUF_SIZE];
+	static u32 pendingLen = 0;
+	static u32 lastKey = 0;   // Key of the last progress update in pending
+	static u32 lastStart = 0; // Where that update starts
+	static bool drawing = false;
+	static Stats counters = {0, 0, 0, 0, 0};
+
+	static Mutex mutex;
+	static Mutex drawMutex;
+	static Event *wake = nullptr;
+	static Event *drawn = nullptr;
+	static Worker *renderer = nullptr;
+	static bool quit = false;
+
+
+	// Moves pending to the screen. Only one thread draws at a time.
+	static void draw()
+	{
+		static char text[CONSOLE_BUF_SIZE];
+		u32 len;
+
+		LockGuard drawLock(drawMutex);
+		{
+			LockGuard lock(mutex);
+			len = pendingLen;
+			memcpy(text, pending, len);
+			pendingLen = 0;
+			lastKey = 0;
+			drawing = true;
+		}
+
+		const u64 start = svcGetSystemTick();
+		if(len) fwrite(text, 1, len, stdout);
+		const u64 ticks = svcGetSystemTick() - start;
+
+		LockGuard lock(mutex);
+		counters.renderTicks += ticks;
+		counters.frames++;
+		drawing = false;
+	}
+
+
+	static void renderLoop()
+	{
+		while(!__atomic_load_n(&quit, __ATOMIC_ACQUIRE))
+		{
+			wake->wait();
+			draw();
+			drawn->signal();
+
+			// Everything arriving during the next frame is drawn together
+			svcSleepThread(CONSOLE_FRAME_NS);
+		}
+		draw();
+		drawn->signal();
+	}
+
+
+	static void queue(u32 key, const char *text, u32 len)
+	{
+		const u64 start = svcGetSystemTick();
+		bool wasEmpty;
+
+		if(len>CONSOLE_BUF_SIZE) len = CONSOLE_BUF_SIZE;
+
+		while(true)
+		{
+			{
+				LockGuard lock(mutex);
+
+				if(key && key==lastKey)
+				{
+					pendingLen = lastStart;
+					counters.coalesced++;
+				}
+				if(pendingLen + len<=CONSOLE_BUF_SIZE)
+				{
+					wasEmpty = (pendingLen==0);
+					lastKey = key;
+					lastStart = pendingLen;
+					memcpy(pending + pendingLen, text, len);
+					pendingLen += len;
+					counters.messages++;
+					break;
+				}
+				lastKey = 0; // Don't coalesce into text that is drawn meanwhile
+			}
+
+			// Full. Let the renderer catch up or draw it ourself
+			if(renderer)
+			{
+				wake->signal();
+				svcSleepThread(1000000LL);
+			}
+			else draw();
+		}
+
+		if(!renderer) draw();
+		else if(wasEmpty) wake->signal();
+
+		LockGuard lock(mutex);
+		counters.callerTicks += svcGetSystemTick() - start;
+	}
+
+
+	void init()
+	{
+		if(renderer) return;
+
+		wake = new Event;
+		drawn = new Event;
+		quit = false;
+		renderer = new Worker(renderLoop);
+		if(!renderer->running())
+		{
+			delete renderer;
+			renderer = nullptr;
+		}
+	}
+
+
+	void exit()
+	{
+		if(!renderer) return;
+
+		__atomic_store_n(&quit, true, __ATOMIC_RELEASE);
+		wake->signal();
+		delete renderer; // Draws what is left
+		renderer = nullptr;
+		delete wake;
+		delete drawn;
+		wake = drawn = nullptr;
+	}
+
+
+	void print(const char *text)
+	{
+		queue(0, text, strlen(text));
+	}
+
+
+	void progress(u32 key, const char *fmt, ...)
+	{
+		char text[CONSOLE_LINE_SIZE];
+		va_list args;
+
+		va_start(args, fmt);
+		int len = vsnprintf(text, CONSOLE_LINE_SIZE, fmt, args);
+		va_end(args);
+
+		if(len<0) return;
+		queue(key, text, ((u32)len<CONSOLE_LINE_SIZE ? len : CONSOLE_LINE_SIZE - 1));
+	}
+
+
+	void flush()
+	{
+		if(!renderer) return;
+
+		while(true)
+		{
+			{
+				LockGuard lock(mutex);
+				if(!pendingLen && !drawing) break;
+			}
+			wake->signal();
+			drawn->wait(CONSOLE_FRAME_NS * 2);
+		}
+	}
+
+
+	Stats stats()
+	{
+		LockGuard lock(mutex);
+		return counters;
+	}
+}
@@ -0,0 +1,156 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+#include <cstring>
+#include <3ds.h>
+#include "delta.h"
+#include "fs.h"
+#include "misc.h"
+
+#define _FILE_ "delta.cpp" // Replacement for __FILE__ without the path
+
+
+
+void readDeltaHeader(fs::File& file, DeltaHeader& header)
+{
+	file.seek(0, FS_SEEK_SET);
+	if(file.read(&header, sizeof(DeltaHeader))!=sizeof(DeltaHeader)) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Delta is truncated!");
+
+	bool terminated = false;
+	for(u32 i = 0; i<DELTA_BASE_PATH_LENGTH && !terminated; i++) terminated = !header.basePath[i];
+	if(header.magic!=DELTA_MAGIC || header.version!=DELTA_VERSION || header.headerSize!=sizeof(DeltaHeader) ||
+	   !terminated || header.basePath[0]!=u'/')
+		throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid delta header!");
+}
+
+
+static DeltaHeader deltaHeader(fs::File& file)
+{
+	DeltaHeader header;
+
+	readDeltaHeader(file, header);
+	return header;
+}
+
+
+DeltaReader::DeltaReader(const fs::Path& path, FS_Archive& archive)
+	: _delta_(path, FS_OPEN_READ, archive), _header_(deltaHeader(_delta_)), _base_(fs::Path((const char16_t*)_header_.basePath), FS_OPEN_READ, archive),
+	  _baseView_(_base_, DELTA_VIEW_BLOCK_SIZE, DELTA_VIEW_BLOCK_COUNT), _ops_(DELTA_OP_BUF_SIZE, false), _out_(DELTA_CHUNK_SIZE * 2, false)
+{
+	_opOffset_ = _header_.headerSize;
+	if(_baseView_.size()!=_header_.baseSize) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Base CIA of the delta has the wrong size!");
+}
+
+
+void DeltaReader::fill(u32 need)
+{
+	if(_opEnd_ - _opPos_>=need) return;
+
+	// Keep what's left and read as much as fits after it
+	const u32 left = _opEnd_ - _opPos_;
+	memmove(&_ops_, &_ops_[_opPos_], left);
+	_opPos_ = 0;
+	_opEnd_ = left;
+
+	const u64 fileLeft = _delta_.size() - _opOffset_;
+	const u32 toRead = (fileLeft<DELTA_OP_BUF_SIZE - left ? fileLeft : DELTA_OP_BUF_SIZE - left);
+	if(toRead)
+	{
+		_delta_.seek(_opOffset_, FS_SEEK_SET);
+		if(_delta_.read(&_ops_[left], toRead)!=toRead) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Delta is truncated!");
+		_opEnd_ += toRead;
+		_opOffset_ += toRead;
+	}
+	if(_opEnd_<need) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Delta is truncated!");
+}
+
+
+void DeltaReader::nextOp()
+{
+	u32 word;
+
+	fill(4);
+	memcpy(&word, &_ops_[_opPos_], 4);
+	_opPos_ += 4;
+	_opType_ = word>>30;
+	_opLeft_ = word & DELTA_MAX_OP_LENGTH;
+	if(!_opLeft_ || _opLeft_>_header_.targetSize - _produced_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt delta!");
+
+	if(_opType_==DELTA_OP_COPY)
+	{
+		fill(8);
+		memcpy(&_copyFrom_, &_ops_[_opPos_], 8);
+		_opPos_ += 8;
+		if(_copyFrom_>_header_.baseSize || _opLeft_>_header_.baseSize - _copyFrom_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt delta!");
+	}
+	else if(_opType_!=DELTA_OP_ADD) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt delta!");
+}
+
+
+void DeltaReader::copy(u8 *out, u32 size)
+{
+	if(size<DELTA_DIRECT_COPY)
+	{
+		_baseView_.read(_copyFrom_, out, size);
+		return;
+	}
+
+	_base_.seek(_copyFrom_, FS_SEEK_SET);
+	if(_base_.read(out, size)!=size) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Base CIA of the delta is truncated!");
+}
+
+
+const u8* DeltaReader::next(u32& size)
+{
+	if(_produced_==_header_.targetSize)
+	{
+		// Ops past the end of the target mean the delta isn't what it claims to be
+		if(_opPos_!=_opEnd_ || _opOffset_!=_delta_.size()) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt delta!");
+		return nullptr;
+	}
+
+	u8 *const out = &_out_[_outHalf_ * DELTA_CHUNK_SIZE];
+	_outHalf_ ^= 1;
+
+	u32 filled = 0;
+	while(filled<DELTA_CHUNK_SIZE && _produced_<_header_.targetSize)
+	{
+		if(!_opLeft_) nextOp();
+
+		u32 n = (_opLeft_<DELTA_CHUNK_SIZE - filled ? _opLeft_ : DELTA_CHUNK_SIZE - filled);
+		if(_opType_==DELTA_OP_COPY)
+		{
+			copy(&out[filled], n);
+			_copyFrom_ += n;
+		}
+		else
+		{
+			fill(1);
+			if(n>_opEnd_ - _opPos_) n = _opEnd_ - _opPos_;
+			memcpy(&out[filled], &_ops_[_opPos_], n);
+			_opPos_ += n;
+		}
+
+		_opLeft_ -= n;
+		filled += n;
+		_produced_ += n;
+	}
+
+	size = filled;
+	return out;
+}
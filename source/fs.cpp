@@ -18,13 +18,19 @@
 
 
 #include <algorithm>
+#include <exception>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <ctime>
+#include <cstring>
 #include <3ds.h>
 #include "fs.h"
+#include "ipc.h"
 #include "misc.h"
+#include "thread.h"
+#include "trace.h"
 
 #define _FILE_ "fs.cpp" // Replacement for __FILE__ without the path
 
@@ -36,7 +42,7 @@ FS_Archive sdmcArchive;
 namespace fs
 {
 	// Simple std::sort() compar function for file names
-	bool fileNameCmp(fs::DirEntry& first, fs::DirEntry& second)
+	bool fileNameCmp(const fs::DirEntry& first, const fs::DirEntry& second)
 	{
 		if(first.isDir && (!second.isDir)) return true;
 		else if((!first.isDir) && second.isDir) return false;
@@ -46,13 +52,56 @@ namespace fs
 	}
 
 
+	//===============================================
+	// class Path                                  ||
+	//===============================================
+
+	Path& Path::append(const char16_t *str, u32 len)
+	{
+		if(_len_ + len >= FS_PATH_MAX_LENGTH) throw fsException(_FILE_, __LINE__, ERR_PATH_TOO_LONG, "Path too long!");
+
+		memcpy(&_str_[_len_], str, len*2);
+		_len_ += len;
+		_str_[_len_] = 0;
+
+		return *this;
+	}
+
+
+	// Same rules as addToPath()
+	Path& Path::push(const char16_t *name, u32 len)
+	{
+		if(_len_ > 1)
+		{
+			if(_len_ + 1 + len >= FS_PATH_MAX_LENGTH) throw fsException(_FILE_, __LINE__, ERR_PATH_TOO_LONG, "Path too long!");
+			_str_[_len_++] = u'/';
+		}
+
+		return append(name, len);
+	}
+
+
+	// Same rules as removeFromPath()
+	Path& Path::pop()
+	{
+		u32 lastSlash = _len_;
+
+
+		while(lastSlash > 0 && _str_[lastSlash - 1] != u'/') lastSlash--;
+		if(lastSlash == 0) truncate(0); // No slash at all
+		else truncate(lastSlash - 1 > 1 ? lastSlash - 1 : lastSlash);
+
+		return *this;
+	}
+
+
 	//===============================================
 	// class File                                  ||
 	//===============================================
 
-	void File::open(const std::u16string& path, u32 openFlags, FS_Archive& archive)
+	void File::open(const Path& path, u32 openFlags, FS_Archive& archive)
 	{
-		FS_Path filePath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		FS_Path filePath = path.fsPath();
 		Result  res;
 
 		// Save args for when we want to move the file or other uses
@@ -64,9 +113,9 @@ namespace fs
 
 		close(); // Close file handle before we open a new one
 		seek(0, FS_SEEK_SET); // Reset current offset
-		if(FSUSER_OpenFile(&_fileHandle_, archive, filePath, openFlags & 3, 0))
+		if(ipc::FSUSER_OpenFile(&_fileHandle_, archive, filePath, openFlags & 3, 0))
 		{
-			if((res = FSUSER_OpenFile(&_fileHandle_, archive, filePath, openFlags, 0)))
+			if((res = ipc::FSUSER_OpenFile(&_fileHandle_, archive, filePath, openFlags, 0)))
 				throw fsException(_FILE_, __LINE__, res, "Failed to open file!");
 		}
 	}
@@ -79,9 +128,9 @@ namespace fs
 
 		close(); // Close file handle before we open a new one
 		seek(0, FS_SEEK_SET); // Reset current offset
-		if(FSUSER_OpenFile(&_fileHandle_, archive, lowPath, openFlags & 3, 0))
+		if(ipc::FSUSER_OpenFile(&_fileHandle_, archive, lowPath, openFlags & 3, 0))
 		{
-			if((res = FSUSER_OpenFile(&_fileHandle_, archive, lowPath, openFlags, 0)))
+			if((res = ipc::FSUSER_OpenFile(&_fileHandle_, archive, lowPath, openFlags, 0)))
 				throw fsException(_FILE_, __LINE__, res, "Failed to open file!");
 		}
 	}
@@ -95,8 +144,11 @@ namespace fs
 		Result res;
 
 
-		if((res = FSFILE_Read(_fileHandle_, &bytesRead, _offset_, buf, size)))
-			throw fsException(_FILE_, __LINE__, res, "Failed to read from file!");
+		{
+			TRACE_ZONE(TRACE_FS_READ, size);
+			res = ipc::FSFILE_Read(_fileHandle_, &bytesRead, _offset_, buf, size);
+		}
+		if(res) throw fsException(_FILE_, __LINE__, res, "Failed to read from file!");
 
 		_offset_ += bytesRead;
 		return bytesRead;
@@ -111,10 +163,14 @@ namespace fs
 		Result res;
 
 
-		if((res = FSFILE_Write(_fileHandle_, &bytesWritten, _offset_, buf, size, FS_WRITE_FLUSH)))
-			throw fsException(_FILE_, __LINE__, res, "Failed to write to file!");
+		{
+			TRACE_ZONE(TRACE_FS_WRITE, size);
+			res = ipc::FSFILE_Write(_fileHandle_, &bytesWritten, _offset_, buf, size, FS_WRITE_FLUSH);
+		}
+		if(res) throw fsException(_FILE_, __LINE__, res, "Failed to write to file!");
 
 		_offset_ += bytesWritten;
+		if(_statValid_ && _offset_>_stat_.size) _stat_.size = _offset_; // Writing past the end grows the file
 		return bytesWritten;
 	}
 
@@ -126,7 +182,7 @@ namespace fs
     Result res;
 
 
-		if((res = FSFILE_Flush(_fileHandle_))) throw fsException(_FILE_, __LINE__, res, "Failed to flush file!");
+		if((res = ipc::FSFILE_Flush(_fileHandle_))) throw fsException(_FILE_, __LINE__, res, "Failed to flush file!");
 	}
 
 
@@ -146,17 +202,22 @@ namespace fs
 	}
 
 
-	u64 File::size()
+	const FileStat& File::stat()
 	{
 		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
+		if(_statValid_) return _stat_;
 
 		u64 tmp;
 		Result res;
 
 
-		if((res = FSFILE_GetSize(_fileHandle_, &tmp))) throw fsException(_FILE_, __LINE__, res, "Failed to get file size!");
+		if((res = ipc::FSFILE_GetSize(_fileHandle_, &tmp))) throw fsException(_FILE_, __LINE__, res, "Failed to get file size!");
+
+		_stat_.size = tmp;
+		_stat_.attributes = 0; // Unknown
+		_statValid_ = true;
 
-		return tmp;
+		return _stat_;
 	}
 
 
@@ -167,12 +228,16 @@ namespace fs
 		Result res;
 
 
-		if((res = FSFILE_SetSize(_fileHandle_, size))) throw fsException(_FILE_, __LINE__, res, "Failed to set file size!");
+		if((res = ipc::FSFILE_SetSize(_fileHandle_, size))) throw fsException(_FILE_, __LINE__, res, "Failed to set file size!");
+
+		if(!_statValid_) _stat_.attributes = 0;
+		_stat_.size = size;
+		_statValid_ = true;
 	}
 
 
 	// This can also be used to rename files
-	void File::move(const std::u16string& dst, FS_Archive& dstArchive)
+	void File::move(const Path& dst, FS_Archive& dstArchive)
 	{
 		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
 
@@ -186,11 +251,20 @@ namespace fs
 	}
 
 
-	u64 File::copy(const std::u16string& dst, std::function<void (const std::u16string& file, u32 percent)> statusCallback, FS_Archive& dstArchive)
+	static u64 copyOpenedFile(File& inFile, const Path& src, const Path& dst, Buffer<u8>& buffer, std::function<void (const std::u16string& file, u32 percent)> callback, FS_Archive& dstArchive);
+
+	// Copies through our own handle instead of opening the file a second time
+	u64 File::copy(const Path& dst, std::function<void (const std::u16string& file, u32 percent)> statusCallback, FS_Archive& dstArchive)
 	{
 		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
 
-		return copyFile(_path_, dst, statusCallback, *_archive_, dstArchive);
+		Buffer<u8> buffer(MAX_BUF_SIZE, false);
+		const u64 tmp = tell();
+		seek(0, FS_SEEK_SET);
+		const u64 copied = copyOpenedFile(*this, _path_, dst, buffer, statusCallback, dstArchive);
+		seek(tmp, FS_SEEK_SET);
+
+		return copied;
 	}
 
 
@@ -203,20 +277,125 @@ namespace fs
 	}
 
 
+	//===============================================
+	// class FileView                              ||
+	//===============================================
+
+	FileView::FileView(File& file, u32 blockSize, u32 blockCount) : _file_(file), _blockSize_(blockSize), _blocks_(blockCount), _data_(blockSize * blockCount, false)
+	{
+		_fileSize_ = file.size();
+		invalidate();
+	}
+
+
+	const u8* FileView::block(u64 index, u32& size)
+	{
+		u32 slot = 0;
+		Result res;
+
+
+		for(u32 i=0; i<_blocks_.size(); i++)
+		{
+			Block& tmp = _blocks_[i];
+
+			if(tmp.valid && tmp.index == index)
+			{
+				_hits_++;
+				tmp.lastUse = ++_clock_;
+				size = tmp.size;
+				return &_data_ + i * _blockSize_;
+			}
+
+			// Remember the least recently used or a free block
+			if(!_blocks_[slot].valid) continue;
+			if(!tmp.valid || tmp.lastUse < _blocks_[slot].lastUse) slot = i;
+		}
+
+
+		_misses_++;
+
+		Block& victim = _blocks_[slot];
+		const u64 offset = index * _blockSize_;
+		u8 *data = &_data_ + slot * _blockSize_;
+		u32 bytesRead;
+
+		victim.valid = false;
+		{
+			const u32 toRead = (_fileSize_ - offset<_blockSize_ ? _fileSize_ - offset : _blockSize_);
+			TRACE_ZONE(TRACE_FS_READ, toRead);
+			res = ipc::FSFILE_Read(_file_.getFileHandle(), &bytesRead, offset, data, toRead);
+		}
+		if(res) throw fsException(_FILE_, __LINE__, res, "Failed to read from file!");
+
+		_bytesRead_ += bytesRead;
+		victim.index   = index;
+		victim.size    = bytesRead;
+		victim.lastUse = ++_clock_;
+		victim.valid   = true;
+
+		size = bytesRead;
+		return data;
+	}
+
+
+	void FileView::read(u64 offset, void *buf, u32 size)
+	{
+		if(offset + size > _fileSize_ || offset + size < offset) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Read outside of the file!");
+
+		u8 *out = (u8*)buf;
+
+
+		while(size)
+		{
+			u32 blockSize;
+			const u8 *data = block(offset / _blockSize_, blockSize);
+			const u32 inBlock = offset % _blockSize_;
+			const u32 chunk = (blockSize - inBlock<size ? blockSize - inBlock : size);
+
+			if(inBlock >= blockSize) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "File shrunk while reading!");
+			memcpy(out, data + inBlock, chunk);
+			out    += chunk;
+			offset += chunk;
+			size   -= chunk;
+		}
+	}
+
+
+	const u8* FileView::span(u64 offset, u32 size)
+	{
+		if(offset + size > _fileSize_ || offset + size < offset) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Read outside of the file!");
+		if(offset / _blockSize_ != (offset + size - 1) / _blockSize_ && size > 1) return nullptr;
+
+		u32 blockSize;
+		const u8 *data = block(offset / _blockSize_, blockSize);
+
+
+		if(offset % _blockSize_ + size > blockSize) return nullptr;
+
+		return data + offset % _blockSize_;
+	}
+
+
+	void FileView::invalidate()
+	{
+		for(auto& it : _blocks_) it.valid = false;
+	}
+
+
 	//===============================================
 	// Other file functions                        ||
 	//===============================================
 
-	bool fileExist(const std::u16string& path, FS_Archive& archive)
+	bool fileExist(const Path& path, FS_Archive& archive)
 	{
-		FS_Path filePath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		FS_Path filePath = path.fsPath();
 		Handle fileHandle;
 		Result res;
 
 
-		if(!FSUSER_OpenFile(&fileHandle, archive, filePath, FS_OPEN_READ, 0))
+		if(!ipc::FSUSER_OpenFile(&fileHandle, archive, filePath, FS_OPEN_READ, 0))
 		{
-			if((res = FSFILE_Close(fileHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close file!");
+			if((res = ipc::FSFILE_Close(fileHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close file!");
 			return true;
 		}
 
@@ -224,21 +403,24 @@ namespace fs
 	}
 
 
-	void moveFile(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	void moveFile(const Path& src, const Path& dst, FS_Archive& srcArchive, FS_Archive& dstArchive)
 	{
-		FS_Path srcPath = {PATH_UTF16, (src.length()*2)+2, (const u8*)src.c_str()};
-		FS_Path dstPath = {PATH_UTF16, (dst.length()*2)+2, (const u8*)dst.c_str()};
+		FS_Path srcPath = src.fsPath();
+		FS_Path dstPath = dst.fsPath();
 		Result res;
 
 
-		if((res = FSUSER_RenameFile(srcArchive, srcPath, dstArchive, dstPath)))
+		if((res = ipc::FSUSER_RenameFile(srcArchive, srcPath, dstArchive, dstPath)))
 			throw fsException(_FILE_, __LINE__, res, "Failed to move file!");
 	}
 
 
-	u64 copyFile(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& file, u32 percent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	// Copies the already opened inFile to dst using the given transfer buffer
+	static u64 copyOpenedFile(File& inFile, const Path& src, const Path& dst, Buffer<u8>& buffer, std::function<void (const std::u16string& file, u32 percent)> callback, FS_Archive& dstArchive)
 	{
-		File inFile(src, FS_OPEN_READ, srcArchive), outFile(dst, FS_OPEN_WRITE|FS_OPEN_CREATE, dstArchive);
+		File outFile(dst, FS_OPEN_WRITE|FS_OPEN_CREATE, dstArchive);
+		const std::u16string srcStr(callback ? src.str() : std::u16string());
+		const u32 bufSize = buffer.size();
 		u32 blockSize;
 		u64 inFileSize, offset = 0;
 
@@ -248,12 +430,9 @@ namespace fs
 		outFile.setSize(inFileSize);
 
 
-		Buffer<u8> buffer(MAX_BUF_SIZE, false);
-
-
-		for(u32 i=0; i<=inFileSize / MAX_BUF_SIZE; i++)
+		for(u64 i=0; i<=inFileSize / bufSize; i++)
 		{
-			blockSize = ((inFileSize - offset<MAX_BUF_SIZE) ? inFileSize - offset : MAX_BUF_SIZE);
+			blockSize = ((inFileSize - offset<bufSize) ? inFileSize - offset : bufSize);
 
 			if(blockSize>0)
 			{
@@ -261,7 +440,7 @@ namespace fs
 				outFile.write(&buffer, blockSize);
 
 				offset += blockSize;
-				if(callback) callback(src, offset * 100 / inFileSize);
+				if(callback) callback(srcStr, offset * 100 / inFileSize);
 			}
 		}
 
@@ -269,13 +448,39 @@ namespace fs
 	}
 
 
-	void deleteFile(const std::u16string& path, FS_Archive& archive)
+	u64 copyFile(const Path& src, const Path& dst, std::function<void (const std::u16string& file, u32 percent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive)
 	{
-		FS_Path srcPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		File inFile(src, FS_OPEN_READ, srcArchive);
+		Buffer<u8> buffer(MAX_BUF_SIZE, false);
+
+		return copyOpenedFile(inFile, src, dst, buffer, callback, dstArchive);
+	}
+
+
+	u64 copyFile(const Path& src, const Path& dst, const FileStat& srcStat, std::function<void (const std::u16string& file, u32 percent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	{
+		File inFile(src, FS_OPEN_READ, srcStat, srcArchive);
+		Buffer<u8> buffer(MAX_BUF_SIZE, false);
+
+		return copyOpenedFile(inFile, src, dst, buffer, callback, dstArchive);
+	}
+
+
+	u64 copyFile(const Path& src, const Path& dst, const FileStat& srcStat, Buffer<u8>& buffer, std::function<void (const std::u16string& file, u32 percent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	{
+		File inFile(src, FS_OPEN_READ, srcStat, srcArchive);
+
+		return copyOpenedFile(inFile, src, dst, buffer, callback, dstArchive);
+	}
+
+
+	void deleteFile(const Path& path, FS_Archive& archive)
+	{
+		FS_Path srcPath = path.fsPath();
 		Result res;
 
 
-		if((res = FSUSER_DeleteFile(archive, srcPath))) throw fsException(_FILE_, __LINE__, res, "Failed to delete file!");
+		if((res = ipc::FSUSER_DeleteFile(archive, srcPath))) throw fsException(_FILE_, __LINE__, res, "Failed to delete file!");
 	}
 
 
@@ -283,16 +488,16 @@ namespace fs
 	// Directory related functions                 ||
 	//===============================================
 
-	bool dirExist(const std::u16string& path, FS_Archive& archive)
+	bool dirExist(const Path& path, FS_Archive& archive)
 	{
-		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		FS_Path dirPath = path.fsPath();
 		Handle dirHandle;
 		Result res;
 
 
-		if(!FSUSER_OpenDirectory(&dirHandle, archive, dirPath))
+		if(!ipc::FSUSER_OpenDirectory(&dirHandle, archive, dirPath))
 		{
-			if((res = FSDIR_Close(dirHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close directory!");
+			if((res = ipc::FSDIR_Close(dirHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close directory!");
 			return true;
 		}
 
@@ -300,266 +505,651 @@ namespace fs
 	}
 
 
-	void makeDir(const std::u16string& path, FS_Archive& archive)
+	void makeDir(const Path& path, FS_Archive& archive)
 	{
-		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+		FS_Path dirPath = path.fsPath();
 		Handle dirHandle;
 		Result res;
 
 
-		if(!FSUSER_OpenDirectory(&dirHandle, archive, dirPath))
+		if(!ipc::FSUSER_OpenDirectory(&dirHandle, archive, dirPath))
 		{
-			if((res = FSDIR_Close(dirHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close directory!");
+			if((res = ipc::FSDIR_Close(dirHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close directory!");
 			return;
 		}
-		if((res = FSUSER_CreateDirectory(archive, dirPath, 0)))
+		if((res = ipc::FSUSER_CreateDirectory(archive, dirPath, 0)))
 			throw fsException(_FILE_, __LINE__, res, "Failed to create directory!");
 	}
 
 
-	void makePath(const std::u16string& path, FS_Archive& archive)
+	// Like makeDir() but only costs a single FS call. Existing dirs are not an error.
+	void createDir(const Path& path, FS_Archive& archive)
 	{
-		std::u16string tmp;
-		size_t found = 0;
+		FS_Path dirPath = path.fsPath();
+		Result res;
 
 
-		if(path.length() < 2 || path.find_first_of(u"/") == std::u16string::npos) return;
-		while(found != std::u16string::npos)
-		{
-			found = path.find_first_of(u"/", found+1);
-			tmp.assign(path, 0, found);
-			makeDir(tmp, archive);
-		}
+		res = ipc::FSUSER_CreateDirectory(archive, dirPath, 0);
+		if(res && res != FS_ERR_DOES_ALREADY_EXIST && res != (Result)0xC82044B9)
+			throw fsException(_FILE_, __LINE__, res, "Failed to create directory!");
 	}
 
 
-	DirInfo getDirInfo(const std::u16string& path, FS_Archive& archive)
+	void makePath(const Path& path, FS_Archive& archive)
 	{
-		u32 depth = 0;
-		u16 helper[128]; // Anyone uses higher dir depths?
-		DirInfo dirInfo = {0};
-
-		std::u16string tmpPath(path);
+		Path tmp;
 
 
+		if(path.length() < 2) return;
+		for(u32 i=1; i<=path.length(); i++)
+		{
+			if(i == path.length() || path[i] == u'/')
+			{
+				tmp.assign(path.c_str(), i);
+				makeDir(tmp, archive);
+			}
+		}
+	}
 
-		std::vector<DirEntry> entries = listDirContents(tmpPath, u"", archive);
-		helper[0] = 0; // We are in the root at file/folder 0
 
+	DirInfo getDirInfo(const Path& path, FS_Archive& archive)
+	{
+		DirInfo dirInfo = {0};
+		std::vector<Path> pending(1, path); // Dirs we still have to scan
+		Path dirPath;
 
-		while(1)
-		{
-			// Prevent non-existent member access
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir)
-			{
-				addToPath(tmpPath, entries[helper[depth]].name);
-				dirInfo.dirCount++;
 
-				helper[++depth] = 0; // Go 1 up in the fs tree and reset position
-				entries = listDirContents(tmpPath, u"", archive);
-			}
 
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir) continue;
+		while(!pending.empty())
+		{
+			dirPath = pending.back();
+			pending.pop_back();
 
-			for(auto it : entries)
+			Dir dir(dirPath, DirFilter(), archive);
+			for(auto& entry : dir)
 			{
-				if(!it.isDir)
+				if(entry.isDir)
+				{
+					dirInfo.dirCount++;
+					pending.push_back(dirPath);
+					pending.back().push(entry.name, entry.nameLen);
+				}
+				else
 				{
 					dirInfo.fileCount++;
-					dirInfo.size += it.size;
+					dirInfo.size += entry.size;
 				}
 			}
+			dir.close();
+		}
 
-			if(!depth) break;
+		return dirInfo;
+	}
 
-			removeFromPath(tmpPath);
 
-			helper[--depth]++; // Go 1 down in the fs tree and increase position
-			entries = listDirContents(tmpPath, u"", archive);
+	//===============================================
+	// class DirFilter                             ||
+	//===============================================
+
+	DirFilter::DirFilter(const std::u16string& filter)
+	{
+		size_t start = 0, found;
+
+
+		while(start < filter.length())
+		{
+			found = filter.find(u';', start);
+			if(found == std::u16string::npos) found = filter.length();
+			if(found > start) _suffixes_.push_back(Suffix{filter.substr(start, found - start), (u32)(found - start)});
+			start = found + 1;
 		}
+	}
 
-		return dirInfo;
+
+	bool DirFilter::match(const FS_DirectoryEntry& entry, u32 nameLen) const
+	{
+		if(_suffixes_.empty() || (entry.attributes & FS_ATTRIBUTE_DIRECTORY)) return true;
+		if(entry.name[0] == u'.') return false; // Hidden files and OSX attribute files
+
+
+		for(auto& it : _suffixes_)
+		{
+			if(nameLen >= it.length && memcmp(&entry.name[nameLen - it.length], it.str.data(), it.length * 2) == 0) return true;
+		}
+
+		return false;
 	}
 
 
-	// Filter format is "entry1;entry2;..." for example ".txt;.png;". "" means list everything
-	std::vector<DirEntry> listDirContents(const std::u16string& path, const std::u16string filter, FS_Archive& archive)
+	u32 entryNameLength(const FS_DirectoryEntry& entry)
 	{
-		bool useFilter = false;
-		Handle dirHandle;
-		u32 entriesRead;
-		Result res;
+		u32 len = 0;
+
+		while(len < sizeof(entry.name) / 2 && entry.name[len]) len++;
+
+		return len;
+	}
+
+
+	std::vector<DirEntry> listDirContents(const Path& path, const std::u16string filter, FS_Archive& archive)
+	{
+		return listDirContents(path, DirFilter(filter), archive);
+	}
+
 
-		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
+	std::vector<DirEntry> listDirContents(const Path& path, const DirFilter& filter, FS_Archive& archive, u32 batchSize)
+	{
+		Dir dir(path, filter, archive, batchSize);
 		std::vector<DirEntry> filesFolders;
-		if(filter.length() > 0) useFilter = true;
 
 
+		for(auto& entry : dir) filesFolders.push_back(entry.toEntry());
+		dir.close();
 
-		if((res = FSUSER_OpenDirectory(&dirHandle, archive, dirPath)))
-			throw fsException(_FILE_, __LINE__, res, "Failed to open directory!");
+		return filesFolders;
+	}
 
 
-		Buffer<FS_DirectoryEntry> entries(32, false);
+	void sortDirEntries(std::vector<DirEntry>& entries)
+	{
+		std::sort(entries.begin(), entries.end(), fileNameCmp);
+	}
 
 
-		do
+	void moveDir(const Path& src, const Path& dst, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	{
+		FS_Path srcPath = src.fsPath();
+		FS_Path dstPath = dst.fsPath();
+		Result res;
+
+
+		if((res = ipc::FSUSER_RenameDirectory(srcArchive, srcPath, dstArchive, dstPath))) throw fsException(_FILE_, __LINE__, res, "Failed to move directory!");
+	}
+
+
+	// copyDir() walks the source tree once, creates all dirs up front and then
+	// copies COPY_WORKERS files at a time. Progress is reported from the calling
+	// thread so callbacks don't need to be thread safe.
+	void copyDir(const Path& src, const Path& dst, std::function<void (const std::u16string& fsObject, u32 totalPercent, u32 filePercent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	{
+		struct CopyJob
+		{
+			std::u16string src;
+			std::u16string dst;
+			FileStat stat;
+		};
+
+		const u32 relStart = src.length() + (src.length()>1 ? 1 : 0); // Skip the separator unless src is "/"
+		std::vector<CopyJob> dirs, files;
+		Path tmpOutPath;
+		u32 total, done = 0, next = 0, current = 0, currentPercent = 0;
+		std::exception_ptr error; // First failure of any worker, rethrown here after the join
+		Mutex mutex;
+		Event progress;
+
+
+
+		// Collect everything first so we know the total for the progress
+		DirWalker walker(src, srcArchive);
+		const DirEntry *entry;
+		while((entry = walker.next()))
 		{
-			entriesRead = 0;
-			filesFolders.reserve(filesFolders.size()+32); // Save time by reserving enough mem
-			if((res = FSDIR_Read(dirHandle, &entriesRead, 32, &entries))) throw fsException(_FILE_, __LINE__, res, "Failed to read directory!");
+			const Path& tmpInPath = walker.path();
 
-			if(useFilter)
+			tmpOutPath = dst;
+			tmpOutPath.push(tmpInPath.c_str() + relStart, tmpInPath.length() - relStart);
+
+			CopyJob job = {tmpInPath.str(), tmpOutPath.str(), entry->stat()};
+			if(entry->isDir) dirs.push_back(job);
+			else files.push_back(job);
+		}
+		total = dirs.size() + files.size();
+
+
+		// Create the specified path if it doesn't exist and then all dirs in one go.
+		// Parents are always listed before their children.
+		makePath(dst, dstArchive);
+		for(u32 i=0; i<dirs.size(); i++)
+		{
+			if(callback) callback(dirs[i].src, i * 100 / total, 0);
+			createDir(dirs[i].dst, dstArchive);
+		}
+		if(files.empty())
+		{
+			if(callback) callback(src.str(), 100, 0);
+			return;
+		}
+
+
+		// Allocate the buffers here so workers can't fail on that
+		const u32 workerCount = (files.size()<COPY_WORKERS ? files.size() : COPY_WORKERS);
+		std::vector<std::unique_ptr<Buffer<u8>>> buffers;
+		for(u32 i=0; i<workerCount; i++) buffers.push_back(std::unique_ptr<Buffer<u8>>(new Buffer<u8>(COPY_BUF_SIZE, false)));
+
+		auto workerFunc = [&](Buffer<u8>& buffer)
+		{
+			while(1)
 			{
-				for(u32 i=0; i<entriesRead; i++)
+				u32 job;
 				{
-					if(!(entries[i].attributes & FS_ATTRIBUTE_DIRECTORY))
-					{
-						size_t foundOld = 0;
-						size_t found = 0;
-						const std::u16string file((char16_t*)entries[i].name);
-
-						while(1)
-						{
-							found = filter.find_first_of(u";", found+1);
-							if(found == std::u16string::npos) break;
-							if(foundOld > 0) foundOld++; // Skip the separator
-							if(file.length() < found-foundOld) continue;
-              if(file.compare(file.length()-(found-foundOld), found-foundOld, filter, foundOld, found-foundOld) == 0 && file[0] != u'.') {
-								filesFolders.push_back(DirEntry((char16_t*)entries[i].name, entries[i].attributes & FS_ATTRIBUTE_DIRECTORY, entries[i].fileSize));
-							}
-							foundOld = found;
-						}
-					}
-					else
-					{
-						filesFolders.push_back(DirEntry((char16_t*)entries[i].name, entries[i].attributes & FS_ATTRIBUTE_DIRECTORY, entries[i].fileSize));
-					}
+					LockGuard lock(mutex);
+					if(error || next>=files.size()) break;
+					job = next++;
 				}
-			}
-			else
-			{
-				for(u32 i=0; i<entriesRead; i++)
+
+				try
 				{
-					filesFolders.push_back(DirEntry((char16_t*)entries[i].name, entries[i].attributes & FS_ATTRIBUTE_DIRECTORY, entries[i].fileSize));
+					copyFile(files[job].src, files[job].dst, files[job].stat, buffer, [&](const std::u16string& file, u32 percent)
+																								{
+																									LockGuard lock(mutex);
+																									current = job;
+																									currentPercent = percent;
+																									progress.signal();
+																								}, srcArchive, dstArchive);
 				}
+				catch(...) // Anything escaping a worker thread would terminate the app
+				{
+					LockGuard lock(mutex);
+					if(!error) error = std::current_exception();
+				}
+
+				{
+					LockGuard lock(mutex);
+					done++;
+				}
+				progress.signal();
 			}
-		} while(entriesRead == 32);
+		};
+
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		for(u32 i=0; i<workerCount; i++)
+		{
+			Buffer<u8>& buffer = *buffers[i];
 
+			workers.push_back(std::unique_ptr<Worker>(new Worker([&workerFunc, &buffer](){workerFunc(buffer);})));
+			if(!workers.back()->running()) workers.pop_back();
+		}
+		if(workers.empty()) workerFunc(*buffers[0]); // Out of threads. Copy everything ourself
 
 
-		// If we reserved too much mem shrink it
-		filesFolders.shrink_to_fit();
+		while(1)
+		{
+			u32 tmpDone, tmpCurrent, tmpPercent;
+			bool failed;
 
-		// Sort folders and files
-		std::sort(filesFolders.begin(), filesFolders.end(), fileNameCmp);
 
+			progress.wait(100000000LL); // Wake up every 100 ms in case we missed a signal
+			{
+				LockGuard lock(mutex);
+				tmpDone    = done;
+				tmpCurrent = current;
+				tmpPercent = currentPercent;
+				failed     = (bool)error;
+			}
 
+			if(failed || tmpDone==files.size()) break;
+			if(callback) callback(files[tmpCurrent].src, (dirs.size() + tmpDone) * 100 / total, tmpPercent);
+		}
 
-		if((res = FSDIR_Close(dirHandle))) throw fsException(_FILE_, __LINE__, res, "Failed to close directory!");
+		workers.clear(); // Joins all workers. In case of an error they finish their current file first
 
-		return filesFolders;
+		if(error) std::rethrow_exception(error);
+
+		if(callback) callback(src.str(), 100, 0);
 	}
 
 
-	void moveDir(const std::u16string& src, const std::u16string& dst, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	void deleteDir(const Path& path, FS_Archive& archive)
 	{
-		FS_Path srcPath = {PATH_UTF16, (src.length()*2)+2, (const u8*)src.c_str()};
-		FS_Path dstPath = {PATH_UTF16, (dst.length()*2)+2, (const u8*)dst.c_str()};
+		FS_Path dirPath = path.fsPath();
 		Result res;
 
 
-		if((res = FSUSER_RenameDirectory(srcArchive, srcPath, dstArchive, dstPath))) throw fsException(_FILE_, __LINE__, res, "Failed to move directory!");
+		if(path != u"/")
+		{
+			if((res = ipc::FSUSER_DeleteDirectoryRecursively(archive, dirPath)))
+				throw fsException(_FILE_, __LINE__, res, "Failed to delete directory!");
+		}
+		else // We can't delete "/" itself so delete everything in root
+		{
+			std::vector<DirEntry> list = listDirContents(path, u"", archive);
+
+			for(auto& it : list)
+			{
+				if(it.isDir) deleteDir(Path(u"/", it.name), archive);
+				else deleteFile(Path(u"/", it.name), archive);
+			}
+		}
 	}
 
+	//===============================================
+	// class Dir                                   ||
+	//===============================================
 
-	void copyDir(const std::u16string& src, const std::u16string& dst, std::function<void (const std::u16string& fsObject, u32 totalPercent, u32 filePercent)> callback, FS_Archive& srcArchive, FS_Archive& dstArchive)
+	Dir::Dir(const Path& path, const DirFilter& filter, FS_Archive& archive, u32 batchSize) : _filter_(filter), _entries_(batchSize, false)
 	{
-		u32 depth = 0, fileCount = 0, dirCount = 0;
-		u16 helper[128]; // Anyone uses higher dir depths?
+		FS_Path dirPath = path.fsPath();
+		Result res;
 
-		DirInfo inDirInfo = getDirInfo(src, srcArchive);
-		std::u16string tmpInPath(src);
-		std::u16string tmpOutPath(dst);
 
+		if((res = ipc::FSUSER_OpenDirectory(&_dirHandle_, archive, dirPath)))
+		{
+			_dirHandle_ = 0;
+			throw fsException(_FILE_, __LINE__, res, "Failed to open directory!");
+		}
+	}
 
 
-		// Create the specified path if it doesn't exist
-		makePath(tmpOutPath, dstArchive);
-		std::vector<DirEntry> entries = listDirContents(tmpInPath, u"", srcArchive);
-		helper[0] = 0; // We are in the root at file/folder 0
+	const DirEntryRef* Dir::next()
+	{
+		Result res;
 
 
 		while(1)
 		{
-			// Prevent non-existent member access
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir)
+			while(_pos_ < _count_)
 			{
-				addToPath(tmpInPath, entries[helper[depth]].name);
-				addToPath(tmpOutPath, entries[helper[depth]].name);
-				if(callback) callback(tmpInPath, (fileCount + dirCount) * 100 / (inDirInfo.fileCount + inDirInfo.dirCount), 0);
-				makeDir(tmpOutPath, dstArchive);
-				dirCount++;
-
-				helper[++depth] = 0; // Go 1 up in the fs tree and reset position
-				entries = listDirContents(tmpInPath, u"", srcArchive);
-			}
+				const FS_DirectoryEntry& entry = _entries_[_pos_++];
+				const u32 nameLen = entryNameLength(entry);
 
-			if((helper[depth]>=entries.size()) ? 0 : entries[helper[depth]].isDir) continue;
-
-			for(auto it : entries)
-			{
-				if(!it.isDir)
+				if(_filter_.match(entry, nameLen))
 				{
-					addToPath(tmpInPath, it.name);
-					addToPath(tmpOutPath, it.name);
-					if(callback) copyFile(tmpInPath, tmpOutPath, [&](const std::u16string& file, u32 percent)
-																												{
-																													callback(file, (fileCount + dirCount) * 100 / (inDirInfo.fileCount + inDirInfo.dirCount), percent);
-																												}, srcArchive, dstArchive);
-					else copyFile(tmpInPath, tmpOutPath, nullptr, srcArchive, dstArchive);
-					fileCount++;
-					removeFromPath(tmpInPath);
-					removeFromPath(tmpOutPath);
+					_current_.name       = (const char16_t*)entry.name;
+					_current_.nameLen    = nameLen;
+					_current_.isDir      = entry.attributes & FS_ATTRIBUTE_DIRECTORY;
+					_current_.size       = entry.fileSize;
+					_current_.attributes = entry.attributes;
+					return &_current_;
 				}
 			}
 
-			if(!depth) break;
+			if(_eof_ || !_dirHandle_) return nullptr;
+
+			// Buffer is used up. Get the next batch
+			_count_ = _pos_ = 0;
+			if((res = ipc::FSDIR_Read(_dirHandle_, &_count_, _entries_.size() / sizeof(FS_DirectoryEntry), &_entries_)))
+				throw fsException(_FILE_, __LINE__, res, "Failed to read directory!");
+			if(_count_ < _entries_.size() / sizeof(FS_DirectoryEntry)) _eof_ = true;
+		}
+	}
+
+
+	void Dir::close()
+	{
+		if(!_dirHandle_) return;
+
+		Result res = ipc::FSDIR_Close(_dirHandle_);
+
 
-			removeFromPath(tmpInPath);
-			removeFromPath(tmpOutPath);
+		_dirHandle_ = 0;
+		if(res) throw fsException(_FILE_, __LINE__, res, "Failed to close directory!");
+	}
 
-			helper[--depth]++; // Go 1 down in the fs tree and increase position
-			entries = listDirContents(tmpInPath, u"", srcArchive);
+
+	//===============================================
+	// class DirWalker                             ||
+	//===============================================
+
+	DirWalker::DirWalker(const Path& path, FS_Archive& archive) : _path_(path), _archive_(&archive)
+	{
+		_levels_.push_back(Level{listDirContents(path, u"", archive), 0});
+	}
+
+
+	const DirEntry* DirWalker::next()
+	{
+		if(_levels_.empty()) return nullptr;
+
+		if(_descend_) // Go 1 up in the fs tree. The path already points to the dir
+		{
+			_descend_ = false;
+			_levels_.push_back(Level{listDirContents(_path_, u"", *_archive_), 0});
 		}
+		else if(_hasEntry_) _path_.pop();
+
+		_hasEntry_ = false;
+
+
+		while(1)
+		{
+			Level& level = _levels_.back();
 
-		if(callback) callback(tmpInPath, (fileCount + dirCount) * 100 / (inDirInfo.fileCount + inDirInfo.dirCount), 0);
+			if(level.pos < level.entries.size())
+			{
+				const DirEntry& entry = level.entries[level.pos++];
+
+				_path_.push(entry.name);
+				_hasEntry_ = true;
+				_descend_  = entry.isDir;
+				return &entry;
+			}
+
+			// This dir is done. Drop its listing and go 1 down in the fs tree
+			_levels_.pop_back();
+			if(_levels_.empty()) return nullptr;
+			_path_.pop();
+		}
 	}
 
 
-	void deleteDir(const std::u16string& path, FS_Archive& archive)
+	//===============================================
+	// Async I/O                                   ||
+	//===============================================
+
+	// One worker thread executes ipc::FSFILE_Read()/ipc::FSFILE_Write() requests in submission order.
+	// Without it requests run on submission but go through the same slots.
+	// Tokens encode the result slot in the low 4 bits and a sequence number in the rest
+	// so stale tokens are detected.
+	class IoQueue
 	{
-		FS_Path dirPath = {PATH_UTF16, (path.length()*2)+2, (const u8*)path.c_str()};
-		Result res;
+		struct Request
+		{
+			u32 slot;
+			Handle fileHandle;
+			void *buf;
+			u32 size;
+			u64 offset;
+			bool write;
+			bool quit;
+		};
+
+		struct Slot
+		{
+			u32 seq;
+			bool busy;
+			bool done;
+			IoResult result;
+			Event event; // Signaled when done
+		};
+
+		Slot _slots_[IO_MAX_PENDING];
+		u32 _seq_ = 0;
+		Mutex _mutex_;
+		Semaphore _freeSlots_;
+		BoundedQueue<Request> _requests_;
+		Worker *_worker_; // Created last. It uses everything above
+
+
+		static IoResult execute(const Request& req)
+		{
+			IoResult result = {0, 0, req.size};
+			TRACE_ZONE((req.write ? TRACE_FS_WRITE : TRACE_FS_READ), req.size);
+
+			if(req.write) result.res = ipc::FSFILE_Write(req.fileHandle, &result.bytes, req.offset, req.buf, req.size, FS_WRITE_FLUSH);
+			else result.res = ipc::FSFILE_Read(req.fileHandle, &result.bytes, req.offset, req.buf, req.size);
 
+			return result;
+		}
 
-		if(path.compare(u"/") != 0)
+		void complete(u32 slot, const IoResult& result)
 		{
-			if((res = FSUSER_DeleteDirectoryRecursively(archive, dirPath)))
-				throw fsException(_FILE_, __LINE__, res, "Failed to delete directory!");
+			{
+				LockGuard lock(_mutex_);
+				_slots_[slot].result = result;
+				_slots_[slot].done   = true;
+			}
+			_slots_[slot].event.signal();
 		}
-		else // We can't delete "/" itself so delete everything in root
+
+		void run()
 		{
-			std::vector<DirEntry> list = listDirContents(path, u"", archive);
+			Request req;
+
+			while(1)
+			{
+				_requests_.pop(req);
+				if(req.quit) break;
+				complete(req.slot, execute(req));
+			}
+		}
+
+
+	public:
+		IoQueue(bool threaded) : _freeSlots_(IO_MAX_PENDING, IO_MAX_PENDING), _requests_(IO_QUEUE_DEPTH), _worker_(nullptr)
+		{
+			for(u32 i=0; i<IO_MAX_PENDING; i++) _slots_[i].busy = false;
+			if(threaded) _worker_ = new Worker([this](){run();}, -1);
+		}
+
+		~IoQueue()
+		{
+			Request req = {0, 0, nullptr, 0, 0, false, true};
+
+			if(_worker_ && _worker_->running()) _requests_.push(req);
+			delete _worker_; // Joins
+		}
 
-			for(auto it : list)
+		IoToken submit(Handle fileHandle, void *buf, u32 size, u64 offset, bool write)
+		{
+			Request req = {0, fileHandle, buf, size, offset, write, false};
+			IoToken token;
+
+
+			_freeSlots_.acquire(); // Blocks if too many results are not consumed yet
 			{
-				if(it.isDir) deleteDir(u"/" + it.name, archive);
-				else deleteFile(u"/" + it.name, archive);
+				LockGuard lock(_mutex_);
+				while(_slots_[req.slot].busy) req.slot++;
+
+				if(++_seq_ > 0x0FFFFFFF) _seq_ = 1;
+				_slots_[req.slot].seq  = _seq_;
+				_slots_[req.slot].busy = true;
+				_slots_[req.slot].done = false;
+				token = _seq_<<4 | req.slot;
 			}
+
+			if(_worker_ && _worker_->running()) _requests_.push(req); // Blocks if the I/O thread is IO_QUEUE_DEPTH requests behind
+			else complete(req.slot, execute(req));
+
+			return token;
+		}
+
+		bool poll(IoToken token, IoResult *result)
+		{
+			Slot& slot = _slots_[token & 0xF];
+			LockGuard lock(_mutex_);
+
+
+			if(!slot.busy || slot.seq != token>>4) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid I/O token!");
+			if(!slot.done) return false;
+
+			if(result) *result = slot.result;
+			slot.busy = false;
+			_freeSlots_.release();
+
+			return true;
 		}
+
+		IoResult wait(IoToken token)
+		{
+			IoResult result;
+
+			while(!poll(token, &result)) _slots_[token & 0xF].event.wait();
+
+			return result;
+		}
+	};
+
+	static IoQueue *ioQueue = nullptr;
+
+
+	void ioQueueInit()
+	{
+		if(!ioQueue) ioQueue = new IoQueue(true);
 	}
 
+
+	void ioQueueExit()
+	{
+		delete ioQueue; // Waits for all submitted requests
+		ioQueue = nullptr;
+	}
+
+
+	// Without I/O thread requests are executed immediately and the result is kept until consumed.
+	// Don't switch between the two with requests outstanding, their tokens are only valid in one.
+	static IoQueue& syncQueue()
+	{
+		static IoQueue queue(false);
+		return queue;
+	}
+
+	static IoQueue& currentQueue()
+	{
+		return (ioQueue ? *ioQueue : syncQueue());
+	}
+
+
+	IoToken ioSubmit(Handle fileHandle, void *buf, u32 size, u64 offset, bool write)
+	{
+		return currentQueue().submit(fileHandle, buf, size, offset, write);
+	}
+
+
+	bool ioPoll(IoToken token, IoResult *result)
+	{
+		return currentQueue().poll(token, result);
+	}
+
+
+	IoResult ioWait(IoToken token)
+	{
+		TRACE_ZONE(TRACE_IO_WAIT, token);
+
+		return currentQueue().wait(token);
+	}
+
+
+	IoToken File::readAsync(void *buf, u32 size, u64 offset)
+	{
+		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
+
+		return ioSubmit(_fileHandle_, buf, size, offset, false);
+	}
+
+
+	IoToken File::writeAsync(const void *buf, u32 size, u64 offset)
+	{
+		if(!_fileHandle_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "No file opened!");
+
+		if(_statValid_ && offset + size > _stat_.size) _stat_.size = offset + size; // Same as write()
+		return ioSubmit(_fileHandle_, (void*)buf, size, offset, true);
+	}
+
+
+	u32 File::wait(IoToken token)
+	{
+		IoResult result = ioWait(token);
+
+		if(result.res) throw fsException(_FILE_, __LINE__, result.res, "Async file I/O failed!");
+		// Callers always ask for a range they know is there. Less means a truncated file,
+		// and the rest of the buffer would still hold the previous block
+		if(result.bytes!=result.size) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Async file I/O transferred less than requested!");
+
+		return result.bytes;
+	}
+
+
 	//===============================================
 	// Misc functions                              ||
 	//===============================================
@@ -584,10 +1174,10 @@ namespace fs
 void sdmcArchiveInit()
 {
 	sdmcArchive = 0;
-	FSUSER_OpenArchive(&sdmcArchive, ARCHIVE_SDMC, fsMakePath(PATH_EMPTY, ""));
+	ipc::FSUSER_OpenArchive(&sdmcArchive, ARCHIVE_SDMC, fsMakePath(PATH_EMPTY, ""));
 }
 
 void sdmcArchiveExit()
 {
-	FSUSER_CloseArchive(sdmcArchive);
+	ipc::FSUSER_CloseArchive(sdmcArchive);
 }
@@ -0,0 +1,647 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+#include <3ds.h>
+#include "bundle.h"
+#include "console.h"
+#include "delta.h"
+#include "error.h"
+#include "fs.h"
+#include "install.h"
+#include "ipc.h"
+#include "lz4.h"
+#include "memtrack.h"
+#include "misc.h"
+#include "sha256.h"
+#include "store.h"
+#include "title.h"
+#include "hashes.h"
+#include "trace.h"
+
+#define _FILE_ "install.cpp" // Replacement for __FILE__ without the path
+
+typedef enum
+{
+	CIA_PLAIN = 0,
+	CIA_LZ4,      // .cia.lz4
+	CIA_DELTA     // .cia.delta
+} CiaFormat;
+
+typedef struct
+{
+	std::u16string name;
+	fs::FileStat stat; // Of the file, entry.size is the CIA
+	AM_TitleEntry entry;
+	bool requiresDelete;
+	CiaFormat format;
+	const BundleEntry *bundleEntry; // nullptr for CIAs in /updates
+	const ManifestEntry *storeEntry; // nullptr unless the CIA is in the store
+} TitleInstallInfo;
+
+static const FirmwareDb *customFirmwareDb = nullptr;
+
+// Ordered from highest to lowest priority.
+static const u32 titleTypes[7] = {
+		0x00040138, // System Firmware
+		0x00040130, // System Modules
+		0x00040030, // Applets
+		0x00040010, // System Applications
+		0x0004001B, // System Data Archives
+		0x0004009B, // System Data Archives (Shared Archives)
+		0x000400DB, // System Data Archives
+};
+
+u32 getTitlePriority(u64 id) {
+	u32 type = (u32) (id >> 32);
+	for(u32 i = 0; i < 7; i++) {
+		if(type == titleTypes[i]) {
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+bool sortTitlesHighToLow(const TitleInstallInfo &a, const TitleInstallInfo &b) {
+	bool aSafe = (a.entry.titleID & 0xFF) == 0x03;
+	bool bSafe = (b.entry.titleID & 0xFF) == 0x03;
+	if(aSafe != bSafe) {
+		return aSafe;
+	}
+
+	return getTitlePriority(a.entry.titleID) < getTitlePriority(b.entry.titleID);
+}
+
+bool sortTitlesLowToHigh(const TitleInstallInfo &a, const TitleInstallInfo &b) {
+        bool aSafe = (a.entry.titleID & 0xFF) == 0x03;
+        bool bSafe = (b.entry.titleID & 0xFF) == 0x03;
+        if(aSafe != bSafe) {
+                return aSafe;
+        }
+
+	return getTitlePriority(a.entry.titleID) > getTitlePriority(b.entry.titleID);
+}
+
+// Find title and compare versions. Returns CIA file version - installed title version
+int versionCmp(std::vector<TitleInfo>& installedTitles, u64& titleID, u16 version)
+{
+	for(auto it : installedTitles)
+	{
+		if(it.titleID == titleID)
+		{
+			return (version - it.version);
+		}
+	}
+
+	return 1; // The title is not installed
+}
+
+
+const FirmwareDb& firmwareDb()
+{
+	return (customFirmwareDb ? *customFirmwareDb : firms);
+}
+
+void setFirmwareDb(const FirmwareDb *db)
+{
+	customFirmwareDb = db;
+}
+
+
+void getCiaFileInfo(fs::File& f, AM_TitleEntry& ciaFileInfo)
+{
+	Result res;
+
+	{
+		TRACE_ZONE(TRACE_AM_GET_CIA_FILE_INFO, 0);
+		res = ipc::AM_GetCiaFileInfo(MEDIATYPE_NAND, &ciaFileInfo, f.getFileHandle());
+	}
+	if(res) throw titleException(_FILE_, __LINE__, res, "Failed to get CIA file info!");
+}
+
+// AM can't look into compressed CIAs. Their header and TMD are in the first block.
+static void getCompressedCiaInfo(fs::File& f, AM_TitleEntry& ciaFileInfo)
+{
+	lz4::FrameReader reader(f, 0, f.size(), false); // Only the first block is read
+	u32 size;
+	const u8 *data = reader.next(size);
+	const CiaInfo info = inspectCia(data, (data ? size : 0), reader.info().contentSize);
+
+	memset(&ciaFileInfo, 0, sizeof(AM_TitleEntry));
+	ciaFileInfo.titleID = info.titleID;
+	ciaFileInfo.size = reader.info().contentSize;
+	ciaFileInfo.version = info.version;
+}
+
+// The title is in the header. The target hash is checked before installing like for all CIAs
+static void getDeltaCiaInfo(fs::File& f, AM_TitleEntry& ciaFileInfo)
+{
+	DeltaHeader header;
+
+	readDeltaHeader(f, header);
+	memset(&ciaFileInfo, 0, sizeof(AM_TitleEntry));
+	ciaFileInfo.titleID = header.titleID;
+	ciaFileInfo.size = header.targetSize;
+	ciaFileInfo.version = header.titleVersion;
+}
+
+static bool hasSuffix(const std::u16string& name, const std::u16string& suffix)
+{
+	return name.length()>suffix.length() && name.compare(name.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+// SHA-256 of everything next() returns. The CIA is never in memory as a whole
+template<class Reader>
+static void hashStream(Reader& reader, u8 *hash)
+{
+	Sha256 sha;
+	const u8 *data;
+	u32 size;
+
+	while((data = reader.next(size))) sha.update(data, size);
+	sha.finish(hash);
+}
+
+// Every CIA of the pack in /updates. Each file is opened and asked for its title once
+static void scanUpdatesDir(const fs::Path& updatesDir, std::vector<TitleInstallInfo>& pack)
+{
+	std::vector<fs::DirEntry> filesDirs = fs::listDirContents(updatesDir, u".cia;.cia.lz4;.cia.delta;"); // Filter for (compressed or delta) .cia files
+	TitleInstallInfo info;
+	fs::File f;
+
+	fs::sortDirEntries(filesDirs);
+	for(auto& it : filesDirs)
+	{
+		// Quick and dirty hack to detect these pesky
+		// attribute files OSX creates.
+		// This should rather be added to the
+		// filter rules later.
+		if(it.isDir || it.name[0] == u'.') continue;
+
+		info.format = (hasSuffix(it.name, u".lz4") ? CIA_LZ4 : hasSuffix(it.name, u".delta") ? CIA_DELTA : CIA_PLAIN);
+		f.open(fs::Path(updatesDir, it.name), FS_OPEN_READ, it.stat());
+		if(info.format==CIA_LZ4) getCompressedCiaInfo(f, info.entry);
+		else if(info.format==CIA_DELTA) getDeltaCiaInfo(f, info.entry);
+		else getCiaFileInfo(f, info.entry);
+
+		info.name = it.name;
+		info.stat = it.stat();
+		info.requiresDelete = false;
+		info.bundleEntry = nullptr;
+		info.storeEntry = nullptr;
+		pack.push_back(info);
+	}
+}
+
+// Every CIA of the pack in the bundle. Title IDs and versions come from its index.
+// The hashes in there only speed up rejecting bad bundles, the data is still hashed.
+static void scanBundle(Bundle& bundle, std::vector<TitleInstallInfo>& pack)
+{
+	TitleInstallInfo info;
+	char name[24];
+
+	for(auto& it : bundle.entries())
+	{
+		snprintf(name, sizeof(name), "%016" PRIX64 ".cia", it.titleID);
+		info.name.assign(name, name + strlen(name));
+		info.stat = {it.size, 0};
+		memset(&info.entry, 0, sizeof(AM_TitleEntry));
+		info.entry.titleID = it.titleID;
+		info.entry.size = it.size;
+		info.entry.version = it.version;
+		info.requiresDelete = false;
+		info.format = CIA_PLAIN;
+		info.bundleEntry = &it;
+		info.storeEntry = nullptr;
+		pack.push_back(info);
+	}
+}
+
+// Every CIA of the pack in the manifest. Like for bundles the titles come from it and nothing
+// is opened before verifying. The CIAs are named by their hash, which has to be in the hash DB
+static void scanStore(const Store& store, std::vector<TitleInstallInfo>& pack)
+{
+	TitleInstallInfo info;
+
+	for(auto& it : store.entries())
+	{
+		info.name = Store::blobName(it.sha256);
+		info.stat = {it.size, 0};
+		memset(&info.entry, 0, sizeof(AM_TitleEntry));
+		info.entry.titleID = it.titleID;
+		info.entry.size = it.size;
+		info.entry.version = it.version;
+		info.requiresDelete = false;
+		info.format = CIA_PLAIN;
+		info.bundleEntry = nullptr;
+		info.storeEntry = &it;
+		pack.push_back(info);
+	}
+}
+
+void installUpdates(bool downgrade, Installer& installer)
+{
+	TRACE_ZONE(TRACE_INSTALL_UPDATES, downgrade);
+	mem::PhaseScope memPhase("scan");
+	const fs::Path updatesDir(u"/updates");
+	const fs::Path bundlePath(UPDATES_BUNDLE_PATH);
+	const fs::Path manifestPath(UPDATES_MANIFEST_PATH);
+	std::unique_ptr<Bundle> bundle;
+	std::unique_ptr<Store> store;
+	std::vector<TitleInstallInfo> pack;
+
+	// A bundle or a manifest replaces /updates
+	if(fs::fileExist(bundlePath))
+	{
+		bundle.reset(new Bundle(bundlePath));
+		scanBundle(*bundle, pack);
+	}
+	else if(fs::fileExist(manifestPath))
+	{
+		store.reset(new Store(manifestPath));
+		scanStore(*store, pack);
+	}
+	else scanUpdatesDir(updatesDir, pack);
+
+	// A title listed twice would take the place of a missing one in the count check below
+	for(size_t i = 0; i<pack.size(); i++)
+	{
+		for(size_t j = 0; j<i; j++)
+		{
+			if(pack[j].entry.titleID == pack[i].entry.titleID)
+				throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "\x1b[31mA title is in the pack more than once!\x1b[0m\n");
+		}
+	}
+
+	std::vector<TitleInfo> installedTitles = getTitleInfos(MEDIATYPE_NAND);
+	std::vector<TitleInstallInfo> titles;
+
+	const FirmwareDb& firmDb = firmwareDb();
+	DeviceHashes devices;
+	RegionHashes regions;
+	TitleHashes hashes;
+	Sha256Hash cmphash;
+
+	u8 calchash[32];
+	u64 ciaSize;
+	u32 bytesRead;
+
+	bool is_n3ds = 0;
+	APT_CheckNew3DS(&is_n3ds);
+
+	Result res = 0;
+	fs::File f;
+
+	mem::beginPhase("identify");
+	logging->logprintf("Getting firmware files information...\n\n");
+
+	// determine firm cia version
+	for(auto& it : pack)
+	{
+		const AM_TitleEntry& ciaFileInfo = it.entry;
+
+		if(ciaFileInfo.titleID != 0x0004013800000002LL && ciaFileInfo.titleID != 0x0004013820000002L)
+			continue;
+
+		if(ciaFileInfo.titleID == 0x0004013820000002LL && is_n3ds == 0)
+			throw titleException(_FILE_, __LINE__, res, "Installing N3DS pack on O3DS will always brick!");
+		if(ciaFileInfo.titleID == 0x0004013800000002LL && is_n3ds == 1 && ciaFileInfo.version > 11872)
+			throw titleException(_FILE_, __LINE__, res, "Installing O3DS pack >6.0 on N3DS will always brick!");
+
+		if(ciaFileInfo.titleID == 0x0004013800000002LL && is_n3ds == 1 && ciaFileInfo.version < 11872){
+			logging->logprintf("Installing O3DS pack on N3DS will brick unless you swap the NCSD and crypto slot!\n");
+			logging->logprintf("!! DO NOT CONTINUE UNLESS !!\n!! YOU ARE ON A9LH OR REDNAND !!\n\n");
+			logging->logprintf("(A) continue\n(B) cancel\n\n");
+			if(!installer.confirm()) throw titleException(_FILE_, __LINE__, res, "Canceled!");
+		}
+
+		logging->logprintf("Verifying firmware files...\n");
+
+		if (firmDb.find(ciaFileInfo.version) == firmDb.end()) {
+			throw titleException(_FILE_, __LINE__, res, "\x1b[31mDid not find known firmware files!\x1b[0m\n");
+		} else {
+			devices = firmDb.find(ciaFileInfo.version)->second;
+		}
+	}
+
+	logging->logprintf("Getting region map...\n");
+
+	// determine firm cia device (n3ds/o3ds)
+	for(auto& it : pack)
+	{
+		if (devices.find(it.entry.titleID) == devices.end()) {
+			continue;
+		} else {
+			regions = devices.find(it.entry.titleID)->second;
+		}
+	}
+
+	if (regions.empty()){
+		throw titleException(_FILE_, __LINE__, res, "\x1b[31mDid not find known firmware files!\x1b[0m\n");
+	}
+
+	logging->logprintf("Getting hash map...\n");
+
+	//determine home menu cia for region
+	//also do region checking
+	for(auto& it : pack)
+	{
+		if (regions.find(it.entry.titleID) == regions.end()) {
+			continue;
+		} else {
+
+			u64 home = regions.find(it.entry.titleID)->first;
+			u8 region;
+
+			if((res = ipc::CFGU_SecureInfoGetRegion(&region)))
+				throw titleException(_FILE_, __LINE__, res, "ipc::CFGU_SecureInfoGetRegion() failed!");
+
+			if ( (( home == 0x0004003000008202LL ) && ( region != CFG_REGION_JPN )) ||
+				 (( home == 0x0004003000008F02LL ) && ( region != CFG_REGION_USA )) ||
+				 (( home == 0x0004003000009802LL ) && ( region != CFG_REGION_EUR ) && ( region != CFG_REGION_AUS )) ||
+				 (( home == 0x000400300000A102LL ) && ( region != CFG_REGION_CHN )) ||
+				 (( home == 0x000400300000A902LL ) && ( region != CFG_REGION_KOR )) ||
+				 (( home == 0x000400300000B102LL ) && ( region != CFG_REGION_TWN )) ) {
+					 throw titleException(_FILE_, __LINE__, res, "\x1b[31mFirmware files are not for this device region!\x1b[0m\n");
+			}
+
+		 	hashes = regions.find(it.entry.titleID)->second;
+			if(pack.size() > hashes.size()) throw titleException(_FILE_, __LINE__, res, "Too many titles in /updates/ found!\n");
+			if(pack.size() < hashes.size()) throw titleException(_FILE_, __LINE__, res, "Too few titles in /updates/ found!\n");
+		}
+	}
+
+	if (hashes.empty()){
+		throw titleException(_FILE_, __LINE__, res, "\x1b[31mDid not find known firmware files!\x1b[0m\n");
+	}
+
+	mem::beginPhase("verify");
+	logging->logprintf("Checking hashes...\n\n");
+
+	//check hashmap
+	for(auto& it : pack)
+	{
+		logging->logprintf("0x%016" PRIx64, it.entry.titleID);
+
+		const auto hash = hashes.find(it.entry.titleID);
+		if(hash == hashes.end()) throw titleException(_FILE_, __LINE__, res, "\x1b[31mTitle is not part of this firmware!\x1b[0m\n\n");
+		cmphash = hash->second;
+
+		// Bundle entries are in file order so this reads the bundle front to back
+		fs::File& src = (bundle ? bundle->file() : f);
+		if(it.bundleEntry)
+		{
+			if(memcmp(cmphash.data(), it.bundleEntry->sha256, 32)!=0)
+				throw titleException(_FILE_, __LINE__, res, "\x1b[31mHash mismatch! File is corrupt or incorrect!\x1b[0m\n\n");
+		}
+		else if(it.storeEntry)
+		{
+			// The name is the hash, which rejects wrong packs early. The data is hashed like any CIA
+			if(memcmp(cmphash.data(), it.storeEntry->sha256, 32)!=0)
+				throw titleException(_FILE_, __LINE__, res, "\x1b[31mHash mismatch! File is corrupt or incorrect!\x1b[0m\n\n");
+			f.open(fs::Path(store->dir(), it.name), FS_OPEN_READ);
+			if(f.size()!=it.stat.size) throw titleException(_FILE_, __LINE__, res, "\x1b[31mHash mismatch! File is corrupt or incorrect!\x1b[0m\n\n");
+		}
+		else f.open(fs::Path(updatesDir, it.name), FS_OPEN_READ, it.stat);
+		ciaSize = it.stat.size;
+
+		// Hashed block by block as it's decompressed or rebuilt
+		if(it.format!=CIA_PLAIN)
+		{
+			if(it.format==CIA_LZ4)
+			{
+				lz4::FrameReader reader(f, 0, ciaSize);
+				hashStream(reader, calchash);
+			}
+			else
+			{
+				DeltaReader reader(fs::Path(updatesDir, it.name));
+				hashStream(reader, calchash);
+			}
+			if(memcmp(cmphash.data(), calchash, 32)!=0)
+				throw titleException(_FILE_, __LINE__, res, "\x1b[31mHash mismatch! File is corrupt or incorrect!\x1b[0m\n\n");
+			logging->logprintf("\x1b[32m  Verified\x1b[0m\n");
+			continue;
+		}
+
+		Buffer<u8> shaBuffer(ciaSize, false);
+
+		{
+			TRACE_ZONE(TRACE_FS_READ, ciaSize);
+			res = ipc::FSFILE_Read(src.getFileHandle(), &bytesRead, (it.bundleEntry ? it.bundleEntry->offset : 0), &shaBuffer, ciaSize);
+		}
+		if(res) throw fsException(_FILE_, __LINE__, res, "Failed to read from file!");
+
+		if((res = ipc::FSUSER_UpdateSha256Context(&shaBuffer, ciaSize, calchash)))
+			throw titleException(_FILE_, __LINE__, res, "ipc::FSUSER_UpdateSha256Context() failed!");
+
+		if(memcmp(cmphash.data(), calchash, 32)==0){
+			logging->logprintf("\x1b[32m  Verified\x1b[0m\n");
+		} else {
+			throw titleException(_FILE_, __LINE__, res, "\x1b[31mHash mismatch! File is corrupt or incorrect!\x1b[0m\n\n");
+		}
+	}
+	f.close();
+
+	logging->logprintf("\n\n\x1b[32mVerified firmware files successfully!\n\n\x1b[0m\n\n");
+	mem::beginPhase("install");
+	logging->logprintf("Installing firmware files...\n");
+	for(auto& it : pack)
+	{
+		int cmpResult = versionCmp(installedTitles, it.entry.titleID, it.entry.version);
+		if((downgrade && cmpResult != 0) || (cmpResult > 0))
+		{
+			it.requiresDelete = downgrade && cmpResult < 0;
+			titles.push_back(it);
+		}
+	}
+
+	std::sort(titles.begin(), titles.end(), downgrade ? sortTitlesLowToHigh : sortTitlesHighToLow);
+
+	u32 titleKey = 0;
+	for(auto it : titles)
+	{
+#ifdef ENABLE_TRACE
+		const console::Stats before = console::stats();
+#endif
+		bool nativeFirm = it.entry.titleID == 0x0004013800000002LL || it.entry.titleID == 0x0004013820000002LL;
+		if(nativeFirm)
+		{
+			logging->logprintf("\nNATIVE_FIRM (0x%016" PRIx64 ")", it.entry.titleID);
+		} else {
+			logging->logprintf("0x%016" PRIx64, it.entry.titleID);
+		}
+
+		if(it.requiresDelete) deleteTitle(MEDIATYPE_NAND, it.entry.titleID);
+		titleKey++;
+		auto progress = [&](const std::u16string& file, u32 percent)
+		{
+			installer.progress(titleKey, titles.size(), percent);
+		};
+		if(it.bundleEntry) installCia(bundle->file(), it.bundleEntry->offset, it.stat.size, it.name, MEDIATYPE_NAND, progress);
+		else if(it.storeEntry) installCia(fs::Path(store->dir(), it.name), it.stat, MEDIATYPE_NAND, progress);
+		else if(it.format==CIA_LZ4)
+		{
+			fs::File cia(fs::Path(updatesDir, it.name), FS_OPEN_READ, it.stat);
+			installCompressedCia(cia, 0, it.stat.size, it.name, MEDIATYPE_NAND, progress);
+		}
+		else if(it.format==CIA_DELTA) installDeltaCia(fs::Path(updatesDir, it.name), it.name, MEDIATYPE_NAND, progress);
+		else installCia(fs::Path(updatesDir, it.name), it.stat, MEDIATYPE_NAND, progress);
+		if(nativeFirm)
+		{
+			{
+				TRACE_ZONE(TRACE_AM_INSTALL_FIRM, (u32)it.entry.titleID);
+				res = ipc::AM_InstallFirm(it.entry.titleID);
+			}
+			if(res) throw titleException(_FILE_, __LINE__, res, "Failed to install NATIVE_FIRM!");
+		}
+		logging->logprintf("\x1b[32m  Installed\x1b[0m\n");
+#ifdef ENABLE_TRACE
+		TRACE_EVENT(TRACE_CONSOLE_TIME, (u32)((console::stats().callerTicks - before.callerTicks) * 1000000 / SYSCLOCK_ARM11));
+#endif
+	}
+}
+
+
+Installer::Installer(bool downgrade) : _messages_(INSTALL_QUEUE_SIZE), _answers_(1), _downgrade_(downgrade), _finished_(false), _cancelled_(false), _threaded_(false)
+{
+	_worker_ = new Worker([this]() {run(true);}, 1, INSTALL_STACK_SIZE);
+	if(!_worker_->running()) run(false); // No thread. Install right here
+}
+
+
+Installer::~Installer()
+{
+	cancel();
+	delete _worker_;
+}
+
+
+void Installer::cancel()
+{
+	InstallMsg msg;
+
+	__atomic_store_n(&_cancelled_, true, __ATOMIC_RELEASE);
+
+	// Wake the worker if it waits for an answer or for room in the queue.
+	// If it blocks again later it sees the flag within INSTALL_CANCEL_POLL.
+	_answers_.tryPush(false);
+	while(_messages_.tryPop(msg));
+}
+
+
+bool Installer::send(const InstallMsg& msg)
+{
+	while(!_messages_.tryPush(msg, INSTALL_CANCEL_POLL))
+	{
+		if(cancelled()) return false;
+	}
+
+	return true;
+}
+
+
+void Installer::run(bool threaded)
+{
+	InstallMsg msg;
+
+	_threaded_ = threaded;
+	msg.key = msg.total = msg.percent = 0;
+	msg.text[0] = 0;
+	try
+	{
+		installUpdates(_downgrade_, *this);
+		msg.type = INSTALL_MSG_DONE;
+	}
+	catch(ResultException& e)
+	{
+		msg.type = INSTALL_MSG_FAILED;
+		strncpy(msg.text, e.what(), ERR_STR_SIZE - 1);
+		msg.text[ERR_STR_SIZE - 1] = 0;
+	}
+	// Anything else escaping the worker thread would terminate the app without a word.
+	// std::bad_alloc from a whole-CIA buffer is the likely one
+	catch(std::exception& e)
+	{
+		msg.type = INSTALL_MSG_FAILED;
+		snprintf(msg.text, ERR_STR_SIZE, "Unexpected error: %s", e.what());
+	}
+	catch(...)
+	{
+		msg.type = INSTALL_MSG_FAILED;
+		snprintf(msg.text, ERR_STR_SIZE, "Unexpected error!");
+	}
+
+	send(msg); // Nobody reads it once cancelled
+	__atomic_store_n(&_finished_, true, __ATOMIC_RELEASE);
+}
+
+
+void Installer::progress(u32 key, u32 total, u32 percent)
+{
+	InstallMsg msg;
+
+	if(!_threaded_) return; // Nobody polls until we are done
+
+	msg.type = INSTALL_MSG_PROGRESS;
+	msg.key = key;
+	msg.total = total;
+	msg.percent = percent;
+	msg.text[0] = 0;
+	_messages_.tryPush(msg);
+}
+
+
+bool Installer::confirm()
+{
+	InstallMsg msg;
+	bool yes;
+
+	if(!_threaded_) // Ask ourself
+	{
+		while(aptMainLoop())
+		{
+			hidScanInput();
+			if(hidKeysDown() & KEY_A) return true;
+			if(hidKeysDown() & KEY_B) return false;
+			gspWaitForVBlank();
+		}
+		return false;
+	}
+
+	msg.type = INSTALL_MSG_PROMPT;
+	msg.key = msg.total = msg.percent = 0;
+	msg.text[0] = 0;
+	if(!send(msg)) return false;
+
+	while(!_answers_.tryPop(yes, INSTALL_CANCEL_POLL))
+	{
+		if(cancelled()) return false;
+	}
+	return yes;
+}
@@ -0,0 +1,457 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <3ds.h>
+#include "ipc.h"
+
+
+namespace ipc
+{
+#define IPC_NAME_ENTRY(id, name) name,
+	static const char *const callNames[IPC_CALL_COUNT] = {IPC_CALL_LIST(IPC_NAME_ENTRY)};
+#undef IPC_NAME_ENTRY
+
+	// Written by any thread with relaxed atomics. Readers only get a consistent
+	// picture once the other threads are done, which is fine for a dump at the end.
+	static CallStats stats[IPC_CALL_COUNT];
+
+
+	const char* callName(IpcCall call)
+	{
+		return (call<IPC_CALL_COUNT ? callNames[call] : "unknown");
+	}
+
+
+	void getStats(IpcCall call, CallStats& out)
+	{
+		const CallStats& s = stats[call];
+
+		out.count   = __atomic_load_n(&s.count, __ATOMIC_RELAXED);
+		out.errors  = __atomic_load_n(&s.errors, __ATOMIC_RELAXED);
+		out.bytes   = __atomic_load_n(&s.bytes, __ATOMIC_RELAXED);
+		out.totalUs = __atomic_load_n(&s.totalUs, __ATOMIC_RELAXED);
+		out.maxUs   = __atomic_load_n(&s.maxUs, __ATOMIC_RELAXED);
+		for(u32 i = 0; i<IPC_HISTOGRAM_BUCKETS; i++) out.histogram[i] = __atomic_load_n(&s.histogram[i], __ATOMIC_RELAXED);
+	}
+
+
+	void resetStats()
+	{
+		memset(stats, 0, sizeof(stats));
+	}
+
+
+	// Upper bound of the bucket the call at the given fraction falls into, at most the slowest call
+	static u32 percentileUs(const CallStats& s, u32 permille)
+	{
+		const u64 target = ((u64)s.count * permille + 999) / 1000;
+		u64 seen = 0;
+
+		for(u32 i = 0; i<IPC_HISTOGRAM_BUCKETS - 1; i++)
+		{
+			seen += s.histogram[i];
+			if(seen>=target) return (2u<<i<s.maxUs ? 2u<<i : s.maxUs);
+		}
+		return s.maxUs;
+	}
+
+	void dumpStats(FILE *f)
+	{
+		u32 calls = 0;
+		u64 totalUs = 0;
+
+		fprintf(f, "%-34s %7s %6s %11s %10s %8s %8s %8s %8s\n", "call", "count", "errors", "bytes", "total ms", "mean us", "max us", "p50 us", "p99 us");
+		for(u32 i = 0; i<IPC_CALL_COUNT; i++)
+		{
+			CallStats s;
+			getStats((IpcCall)i, s);
+			if(!s.count) continue;
+
+			calls += s.count;
+			totalUs += s.totalUs;
+			fprintf(f, "%-34s %7lu %6lu %11llu %10.3f %8llu %8lu %8lu %8lu\n", callNames[i], (unsigned long)s.count,
+			        (unsigned long)s.errors, (unsigned long long)s.bytes, s.totalUs / 1000.0, (unsigned long long)(s.totalUs / s.count),
+			        (unsigned long)s.maxUs, (unsigned long)percentileUs(s, 500), (unsigned long)percentileUs(s, 990));
+
+			// Non-empty buckets as <upper bound in us>:<calls>
+			fprintf(f, "  histogram");
+			for(u32 b = 0; b<IPC_HISTOGRAM_BUCKETS; b++)
+			{
+				if(!s.histogram[b]) continue;
+				if(b<IPC_HISTOGRAM_BUCKETS - 1) fprintf(f, " <%lu:%lu", (unsigned long)(2u<<b), (unsigned long)s.histogram[b]);
+				else fprintf(f, " >=%lu:%lu", (unsigned long)(1u<<b), (unsigned long)s.histogram[b]);
+			}
+			fputc('\n', f);
+		}
+		fprintf(f, "%lu calls, %.3f ms in services\n", (unsigned long)calls, totalUs / 1000.0);
+	}
+
+
+	void writeStats()
+	{
+		FILE *f = fopen(IPC_STATS_FILE_PATH, "w");
+		if(!f) return;
+
+		dumpStats(f);
+		fclose(f);
+	}
+
+
+	static u32 ticksToUs(u64 ticks) {return (u32)(ticks * 1000000 / SYSCLOCK_ARM11);}
+
+	static void count(IpcCall call, u32 us, Result res, u32 bytes)
+	{
+		CallStats& s = stats[call];
+		const u32 bucket = (us ? 31 - __builtin_clz(us) : 0);
+
+		__atomic_fetch_add(&s.count, 1, __ATOMIC_RELAXED);
+		if(res) __atomic_fetch_add(&s.errors, 1, __ATOMIC_RELAXED);
+		if(bytes) __atomic_fetch_add(&s.bytes, bytes, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&s.totalUs, us, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&s.histogram[bucket<IPC_HISTOGRAM_BUCKETS ? bucket : IPC_HISTOGRAM_BUCKETS - 1], 1, __ATOMIC_RELAXED);
+
+		u32 max = __atomic_load_n(&s.maxUs, __ATOMIC_RELAXED);
+		while(us>max && !__atomic_compare_exchange_n(&s.maxUs, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+
+
+#ifdef ENABLE_IPC_RECORD
+	static u8 *buffer = nullptr;
+	static u32 capacity = 0;
+	static u32 used = 0;
+	static u32 recordCount = 0;
+	static u32 dropped = 0;
+	static u64 startTick = 0;
+
+
+	void recordInit(u32 size)
+	{
+		if(buffer) return;
+
+		startTick = svcGetSystemTick();
+		used = recordCount = dropped = 0;
+		capacity = size;
+		buffer = (u8*)malloc(size);
+		if(!buffer) capacity = 0;
+	}
+
+
+	void recordExit()
+	{
+		if(!buffer) return;
+
+		// Records reserved but not yet filled in by another thread are still written
+		const u32 bytes = __atomic_load_n(&used, __ATOMIC_RELAXED);
+		const IpcRecordHeader header = {IPC_RECORD_MAGIC, IPC_RECORD_VERSION, sizeof(IpcRecord), bytes, recordCount, dropped, 0};
+
+		FILE *f = fopen(IPC_RECORD_FILE_PATH, "wb");
+		if(f)
+		{
+			fwrite(&header, sizeof(IpcRecordHeader), 1, f);
+			fwrite(buffer, 1, bytes, f);
+			fclose(f);
+		}
+
+		free(buffer);
+		buffer = nullptr;
+		capacity = 0;
+	}
+
+
+	// Lock-free. Every record is reserved with one compare and swap.
+	static void record(IpcCall call, u64 start, u64 end, Result res, u32 handle, u32 size, u32 done, u64 arg, const FS_Path *path, const FS_Path *path2)
+	{
+		static __thread u32 threadId = 0xFFFFFFFF;
+
+		if(!buffer) return;
+
+		const u32 pathSize = (path ? path->size : 0) + (path2 ? path2->size : 0);
+		const u32 len = sizeof(IpcRecord) + ((pathSize + 3) & ~3u);
+		u32 offset = __atomic_load_n(&used, __ATOMIC_RELAXED);
+		do
+		{
+			if(offset + len>capacity)
+			{
+				__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+				return;
+			}
+		} while(!__atomic_compare_exchange_n(&used, &offset, offset + len, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+		if(threadId==0xFFFFFFFF) svcGetThreadId(&threadId, CUR_THREAD_HANDLE);
+
+		IpcRecord r;
+		r.start    = ticksToUs(start - startTick);
+		r.duration = ticksToUs(end - start);
+		r.call     = call;
+		r.thread   = (u8)threadId;
+		r.pathType = (path ? path->type : PATH_INVALID);
+		r.reserved = 0;
+		r.pathSize = pathSize;
+		r.res      = res;
+		r.handle   = handle;
+		r.size     = size;
+		r.done     = done;
+		r.arg      = arg;
+
+		u8 *dst = buffer + offset;
+		memcpy(dst, &r, sizeof(IpcRecord));
+		dst += sizeof(IpcRecord);
+		if(path) memcpy(dst, path->data, path->size);
+		if(path2) memcpy(dst + path->size, path2->data, path2->size);
+		memset(dst + pathSize, 0, len - sizeof(IpcRecord) - pathSize);
+		__atomic_fetch_add(&recordCount, 1, __ATOMIC_RELAXED);
+	}
+#endif // ENABLE_IPC_RECORD
+
+
+	// Times one call, counts it and records it
+	class Call
+	{
+		const IpcCall _call_;
+		const u64 _start_;
+
+		Call(const Call&);
+		Call& operator =(const Call&);
+
+
+	public:
+		Call(IpcCall call) : _call_(call), _start_(svcGetSystemTick()) {}
+
+		Result end(Result res, u32 handle=0, u32 size=0, u32 done=0, u64 arg=0, const FS_Path *path=nullptr, const FS_Path *path2=nullptr)
+		{
+			const u64 end = svcGetSystemTick();
+			const bool transfer = (_call_==IPC_FSFILE_READ || _call_==IPC_FSFILE_WRITE || _call_==IPC_FSUSER_UPDATE_SHA256_CONTEXT);
+
+			count(_call_, ticksToUs(end - _start_), res, (transfer ? done : 0));
+#ifdef ENABLE_IPC_RECORD
+			record(_call_, _start_, end, res, handle, size, done, arg, path, path2);
+#endif
+			return res;
+		}
+	};
+
+
+
+	Result FSUSER_OpenArchive(FS_Archive* archive, FS_ArchiveID id, FS_Path path)
+	{
+		Call call(IPC_FSUSER_OPEN_ARCHIVE);
+		const Result res = ::FSUSER_OpenArchive(archive, id, path);
+		return call.end(res, 0, id, 0, (res ? 0 : *archive), &path);
+	}
+
+	Result FSUSER_CloseArchive(FS_Archive archive)
+	{
+		Call call(IPC_FSUSER_CLOSE_ARCHIVE);
+		return call.end(::FSUSER_CloseArchive(archive), 0, 0, 0, archive);
+	}
+
+	Result FSUSER_OpenFile(Handle* out, FS_Archive archive, FS_Path path, u32 openFlags, u32 attributes)
+	{
+		Call call(IPC_FSUSER_OPEN_FILE);
+		const Result res = ::FSUSER_OpenFile(out, archive, path, openFlags, attributes);
+		return call.end(res, (res ? 0 : *out), attributes, 0, openFlags, &path);
+	}
+
+	// The archive path isn't recorded. The app only opens files in the SD card archive this way
+	Result FSUSER_OpenFileDirectly(Handle* out, FS_ArchiveID archiveId, FS_Path archivePath, FS_Path filePath, u32 openFlags, u32 attributes)
+	{
+		Call call(IPC_FSUSER_OPEN_FILE_DIRECTLY);
+		const Result res = ::FSUSER_OpenFileDirectly(out, archiveId, archivePath, filePath, openFlags, attributes);
+		return call.end(res, (res ? 0 : *out), archiveId, 0, openFlags, &filePath);
+	}
+
+	Result FSUSER_DeleteFile(FS_Archive archive, FS_Path path)
+	{
+		Call call(IPC_FSUSER_DELETE_FILE);
+		return call.end(::FSUSER_DeleteFile(archive, path), 0, 0, 0, 0, &path);
+	}
+
+	Result FSUSER_RenameFile(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath)
+	{
+		Call call(IPC_FSUSER_RENAME_FILE);
+		return call.end(::FSUSER_RenameFile(srcArchive, srcPath, dstArchive, dstPath), 0, 0, 0, srcPath.size, &srcPath, &dstPath);
+	}
+
+	Result FSUSER_OpenDirectory(Handle* out, FS_Archive archive, FS_Path path)
+	{
+		Call call(IPC_FSUSER_OPEN_DIRECTORY);
+		const Result res = ::FSUSER_OpenDirectory(out, archive, path);
+		return call.end(res, (res ? 0 : *out), 0, 0, 0, &path);
+	}
+
+	Result FSUSER_CreateDirectory(FS_Archive archive, FS_Path path, u32 attributes)
+	{
+		Call call(IPC_FSUSER_CREATE_DIRECTORY);
+		return call.end(::FSUSER_CreateDirectory(archive, path, attributes), 0, attributes, 0, 0, &path);
+	}
+
+	Result FSUSER_RenameDirectory(FS_Archive srcArchive, FS_Path srcPath, FS_Archive dstArchive, FS_Path dstPath)
+	{
+		Call call(IPC_FSUSER_RENAME_DIRECTORY);
+		return call.end(::FSUSER_RenameDirectory(srcArchive, srcPath, dstArchive, dstPath), 0, 0, 0, srcPath.size, &srcPath, &dstPath);
+	}
+
+	Result FSUSER_DeleteDirectoryRecursively(FS_Archive archive, FS_Path path)
+	{
+		Call call(IPC_FSUSER_DELETE_DIRECTORY_RECURSIVELY);
+		return call.end(::FSUSER_DeleteDirectoryRecursively(archive, path), 0, 0, 0, 0, &path);
+	}
+
+	Result FSUSER_UpdateSha256Context(const void* data, u32 inputSize, u8* hash)
+	{
+		Call call(IPC_FSUSER_UPDATE_SHA256_CONTEXT);
+		return call.end(::FSUSER_UpdateSha256Context(data, inputSize, hash), 0, inputSize, inputSize);
+	}
+
+
+	Result FSFILE_Read(Handle handle, u32* bytesRead, u64 offset, void* buffer, u32 size)
+	{
+		Call call(IPC_FSFILE_READ);
+		const Result res = ::FSFILE_Read(handle, bytesRead, offset, buffer, size);
+		return call.end(res, handle, size, (res ? 0 : *bytesRead), offset);
+	}
+
+	Result FSFILE_Write(Handle handle, u32* bytesWritten, u64 offset, const void* buffer, u32 size, u32 flags)
+	{
+		Call call(IPC_FSFILE_WRITE);
+		const Result res = ::FSFILE_Write(handle, bytesWritten, offset, buffer, size, flags);
+		return call.end(res, handle, size, (res ? 0 : *bytesWritten), offset);
+	}
+
+	Result FSFILE_GetSize(Handle handle, u64* size)
+	{
+		Call call(IPC_FSFILE_GET_SIZE);
+		const Result res = ::FSFILE_GetSize(handle, size);
+		return call.end(res, handle, 0, 0, (res ? 0 : *size));
+	}
+
+	Result FSFILE_SetSize(Handle handle, u64 size)
+	{
+		Call call(IPC_FSFILE_SET_SIZE);
+		return call.end(::FSFILE_SetSize(handle, size), handle, 0, 0, size);
+	}
+
+	Result FSFILE_Flush(Handle handle)
+	{
+		Call call(IPC_FSFILE_FLUSH);
+		return call.end(::FSFILE_Flush(handle), handle);
+	}
+
+	Result FSFILE_Close(Handle handle)
+	{
+		Call call(IPC_FSFILE_CLOSE);
+		return call.end(::FSFILE_Close(handle), handle);
+	}
+
+
+	Result FSDIR_Read(Handle handle, u32* entriesRead, u32 entryCount, FS_DirectoryEntry* entries)
+	{
+		Call call(IPC_FSDIR_READ);
+		const Result res = ::FSDIR_Read(handle, entriesRead, entryCount, entries);
+		return call.end(res, handle, entryCount, (res ? 0 : *entriesRead));
+	}
+
+	Result FSDIR_Close(Handle handle)
+	{
+		Call call(IPC_FSDIR_CLOSE);
+		return call.end(::FSDIR_Close(handle), handle);
+	}
+
+
+	Result AM_GetTitleCount(FS_MediaType mediatype, u32* count)
+	{
+		Call call(IPC_AM_GET_TITLE_COUNT);
+		const Result res = ::AM_GetTitleCount(mediatype, count);
+		return call.end(res, 0, mediatype, (res ? 0 : *count));
+	}
+
+	Result AM_GetTitleList(u32* titlesRead, FS_MediaType mediatype, u32 titleCount, u64* titleIds)
+	{
+		Call call(IPC_AM_GET_TITLE_LIST);
+		const Result res = ::AM_GetTitleList(titlesRead, mediatype, titleCount, titleIds);
+		return call.end(res, 0, titleCount, (res ? 0 : *titlesRead), mediatype);
+	}
+
+	Result AM_GetTitleInfo(FS_MediaType mediatype, u32 titleCount, u64* titleIds, AM_TitleEntry* titleInfo)
+	{
+		Call call(IPC_AM_GET_TITLE_INFO);
+		const Result res = ::AM_GetTitleInfo(mediatype, titleCount, titleIds, titleInfo);
+		return call.end(res, 0, titleCount, (res ? 0 : titleCount), (titleCount ? titleIds[0] : 0));
+	}
+
+	Result AM_GetTitleProductCode(FS_MediaType mediatype, u64 titleId, char* productCode)
+	{
+		Call call(IPC_AM_GET_TITLE_PRODUCT_CODE);
+		return call.end(::AM_GetTitleProductCode(mediatype, titleId, productCode), 0, mediatype, 0, titleId);
+	}
+
+	Result AM_GetCiaFileInfo(FS_MediaType mediatype, AM_TitleEntry* titleEntry, Handle fileHandle)
+	{
+		Call call(IPC_AM_GET_CIA_FILE_INFO);
+		const Result res = ::AM_GetCiaFileInfo(mediatype, titleEntry, fileHandle);
+		return call.end(res, fileHandle, mediatype, 0, (res ? 0 : titleEntry->titleID));
+	}
+
+	Result AM_StartCiaInstall(FS_MediaType mediatype, Handle* ciaHandle)
+	{
+		Call call(IPC_AM_START_CIA_INSTALL);
+		const Result res = ::AM_StartCiaInstall(mediatype, ciaHandle);
+		return call.end(res, (res ? 0 : *ciaHandle), mediatype);
+	}
+
+	Result AM_FinishCiaInstall(Handle ciaHandle)
+	{
+		Call call(IPC_AM_FINISH_CIA_INSTALL);
+		return call.end(::AM_FinishCiaInstall(ciaHandle), ciaHandle);
+	}
+
+	Result AM_CancelCIAInstall(Handle ciaHandle)
+	{
+		Call call(IPC_AM_CANCEL_CIA_INSTALL);
+		return call.end(::AM_CancelCIAInstall(ciaHandle), ciaHandle);
+	}
+
+	Result AM_DeleteTitle(FS_MediaType mediatype, u64 titleID)
+	{
+		Call call(IPC_AM_DELETE_TITLE);
+		return call.end(::AM_DeleteTitle(mediatype, titleID), 0, mediatype, 0, titleID);
+	}
+
+	Result AM_DeleteAppTitle(FS_MediaType mediatype, u64 titleID)
+	{
+		Call call(IPC_AM_DELETE_APP_TITLE);
+		return call.end(::AM_DeleteAppTitle(mediatype, titleID), 0, mediatype, 0, titleID);
+	}
+
+	Result AM_InstallFirm(u64 titleID)
+	{
+		Call call(IPC_AM_INSTALL_FIRM);
+		return call.end(::AM_InstallFirm(titleID), 0, 0, 0, titleID);
+	}
+
+
+	Result CFGU_SecureInfoGetRegion(u8* region)
+	{
+		Call call(IPC_CFGU_SECURE_INFO_GET_REGION);
+		const Result res = ::CFGU_SecureInfoGetRegion(region);
+		return call.end(res, 0, 0, (res ? 0 : *region));
+	}
+}
@@ -0,0 +1,240 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+#include <cstring>
+#include <3ds.h>
+#include "fs.h"
+#include "lz4.h"
+#include "misc.h"
+#include "trace.h"
+
+#define _FILE_ "lz4.cpp" // Replacement for __FILE__ without the path
+
+#define FLG_VERSION_MASK      (0xC0)
+#define FLG_VERSION           (0x40)
+#define FLG_BLOCK_INDEPENDENT (0x20)
+#define FLG_BLOCK_CHECKSUM    (0x10)
+#define FLG_CONTENT_SIZE      (0x08)
+#define FLG_CONTENT_CHECKSUM  (0x04)
+#define FLG_RESERVED          (0x02)
+#define FLG_DICT_ID           (0x01)
+
+
+
+static inline u32 read32(const u8 *p) {return (u32)p[0] | (u32)p[1]<<8 | (u32)p[2]<<16 | (u32)p[3]<<24;}
+static inline u32 rotl(u32 x, u32 n) {return x<<n | x>>(32 - n);}
+
+
+namespace lz4
+{
+	u32 xxh32(const void *data, u32 size, u32 seed)
+	{
+		const u32 p1 = 2654435761U, p2 = 2246822519U, p3 = 3266489917U, p4 = 668265263U, p5 = 374761393U;
+		const u8 *p = (const u8*)data;
+		const u8 *const end = p + size;
+		u32 h;
+
+
+		if(size>=16)
+		{
+			u32 v[4] = {seed + p1 + p2, seed + p2, seed, seed - p1};
+			for(; end - p>=16; p += 16)
+			{
+				for(u32 i = 0; i<4; i++) v[i] = rotl(v[i] + read32(p + i*4) * p2, 13) * p1;
+			}
+			h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+		}
+		else h = seed + p5;
+
+		h += size;
+		for(; end - p>=4; p += 4) h = rotl(h + read32(p) * p3, 17) * p4;
+		for(; p<end; p++) h = rotl(h + *p * p5, 11) * p1;
+
+		h ^= h>>15;
+		h *= p2;
+		h ^= h>>13;
+		h *= p3;
+		h ^= h>>16;
+
+		return h;
+	}
+
+
+	void parseFrameHeader(const u8 *data, u32 size, FrameInfo& info)
+	{
+		if(size<7 || read32(data)!=LZ4_FRAME_MAGIC) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Not a LZ4 frame!");
+
+		const u8 flg = data[4], bd = data[5];
+		if((flg & FLG_VERSION_MASK)!=FLG_VERSION || (flg & FLG_RESERVED) || (bd & 0x8F))
+			throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+
+		info.headerSize = 6 + (flg & FLG_CONTENT_SIZE ? 8 : 0) + (flg & FLG_DICT_ID ? 4 : 0) + 1;
+		if(size<info.headerSize) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+		if(data[info.headerSize - 1]!=(u8)(xxh32(data + 4, info.headerSize - 5, 0)>>8))
+			throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+
+		// BD 4 to 7 are 64 KB to 4 MB
+		info.blockMaxSize = 1u<<(8 + 2*(bd>>4));
+		info.blockChecksum = flg & FLG_BLOCK_CHECKSUM;
+		info.contentChecksum = flg & FLG_CONTENT_CHECKSUM;
+		info.contentSize = 0;
+		for(u32 i = 0; flg & FLG_CONTENT_SIZE && i<8; i++) info.contentSize |= (u64)data[6 + i]<<(i*8);
+
+		if((bd>>4)<4) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+		if(!(flg & FLG_BLOCK_INDEPENDENT) || !(flg & FLG_CONTENT_SIZE) || (flg & FLG_DICT_ID) || info.blockMaxSize>LZ4_MAX_BLOCK_SIZE)
+			throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Unsupported LZ4 frame! Use lz4 -B6 -BI --content-size");
+	}
+
+
+	// Every check is against the buffer ends so corrupt blocks can't read or write out of bounds
+	s32 decompressBlock(const u8 *src, u32 srcSize, u8 *dst, u32 dstCapacity)
+	{
+		const u8 *ip = src;
+		const u8 *const iend = src + srcSize;
+		u8 *op = dst;
+		u8 *const oend = dst + dstCapacity;
+
+
+		while(ip<iend)
+		{
+			const u32 token = *ip++;
+			u32 length = token>>4, s;
+
+			if(length==15) do
+			{
+				if(ip>=iend) return -1;
+				length += (s = *ip++);
+			} while(s==255);
+			if(length>(u32)(iend - ip) || length>(u32)(oend - op)) return -1;
+			memcpy(op, ip, length);
+			op += length;
+			ip += length;
+			if(ip==iend) return op - dst; // The last sequence has no match
+
+			if(iend - ip<2) return -1;
+			const u32 offset = ip[0] | ip[1]<<8;
+			ip += 2;
+			if(!offset || offset>(u32)(op - dst)) return -1;
+
+			length = token & 15;
+			if(length==15) do
+			{
+				if(ip>=iend) return -1;
+				length += (s = *ip++);
+			} while(s==255);
+			length += LZ4_MIN_MATCH;
+			if(length>(u32)(oend - op)) return -1;
+
+			// Overlapping matches repeat the last offset bytes. Copying from the
+			// match start doubles the distance to op every round.
+			const u8 *match = op - offset;
+			u8 *const mend = op + length;
+			while(op<mend)
+			{
+				const u32 n = (mend - op<op - match ? mend - op : op - match);
+				memcpy(op, match, n);
+				op += n;
+			}
+		}
+
+		return -1; // Empty or ends without the last literals
+	}
+
+
+	FrameInfo FrameReader::readHeader(fs::File& file, u64 start, u64 size, u32& firstBlock)
+	{
+		u8 header[LZ4_MAX_HEADER_SIZE + 4];
+		const u32 toRead = (size<sizeof(header) ? size : sizeof(header));
+		FrameInfo info;
+
+
+		if(file.wait(file.readAsync(header, toRead, start))!=toRead) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+		parseFrameHeader(header, toRead, info);
+		if(toRead<info.headerSize + 4) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+		firstBlock = read32(header + info.headerSize);
+
+		return info;
+	}
+
+
+	FrameReader::FrameReader(fs::File& file, u64 start, u64 size, bool prefetch)
+		: _file_(file), _start_(start), _size_(size), _info_(readHeader(file, start, size, _next_)), _prefetch_(prefetch),
+		  _in0_(_info_.blockMaxSize + 8, false), _in1_(prefetch ? _info_.blockMaxSize + 8 : 0, false), _out_(_info_.blockMaxSize, false)
+	{
+		_in_[0] = &_in0_;
+		_in_[1] = (prefetch ? &_in1_ : &_in0_);
+		_offset_ = _info_.headerSize + 4;
+		if(prefetch) fetch();
+	}
+
+
+	// Reads the data of the block _next_ describes plus the size of the block after it
+	void FrameReader::fetch()
+	{
+		if(!_next_) return;
+
+		const u32 blockSize = _next_ & ~LZ4_UNCOMPRESSED;
+		if(blockSize>_info_.blockMaxSize) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+
+		_fetched_ = blockSize + (_info_.blockChecksum ? 4 : 0) + 4;
+		if(_fetched_>_size_ - _offset_ || _offset_>_size_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "LZ4 frame is truncated!");
+		_pending_ = _file_.readAsync(_in_[_cur_], _fetched_, _start_ + _offset_);
+	}
+
+
+	const u8* FrameReader::next(u32& size)
+	{
+		if(!_next_)
+		{
+			if(_produced_!=_info_.contentSize) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+			return nullptr;
+		}
+		if(!_pending_) fetch();
+
+		const fs::IoToken token = _pending_;
+		_pending_ = 0; // Consumed by wait() even if it throws
+		if(_file_.wait(token)!=_fetched_) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "LZ4 frame is truncated!");
+
+		const u8 *in = _in_[_cur_];
+		const u32 block = _next_, blockSize = block & ~LZ4_UNCOMPRESSED;
+		_next_ = read32(in + _fetched_ - 4);
+		_offset_ += _fetched_;
+		_cur_ ^= 1;
+		if(_prefetch_) fetch(); // Goes to the other buffer
+
+		const u8 *data;
+		if(block & LZ4_UNCOMPRESSED)
+		{
+			data = in;
+			size = blockSize;
+		}
+		else
+		{
+			TRACE_ZONE(TRACE_LZ4_DECOMPRESS, blockSize);
+			const s32 res = decompressBlock(in, blockSize, &_out_, _info_.blockMaxSize);
+			if(res<0) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+			data = &_out_;
+			size = res;
+		}
+
+		_produced_ += size;
+		if(_produced_>_info_.contentSize) throw fsException(_FILE_, __LINE__, 0xDEADBEEF, "Corrupt LZ4 frame!");
+
+		return data;
+	}
+} // namespace lz4
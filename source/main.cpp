@@ -16,315 +16,35 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/
  */
 
-#include <algorithm>
 #include <cstdio>
-#include <string>
-#include <vector>
-#include <inttypes.h>
 #include <3ds.h>
+#include "console.h"
 #include "error.h"
 #include "fs.h"
+#include "install.h"
+#include "ipc.h"
+#include "memtrack.h"
 #include "misc.h"
-#include "title.h"
-#include "hashes.h"
+#include "trace.h"
 
-#define _FILE_ "main.cpp" // Replacement for __FILE__ without the path
-
-typedef struct
-{
-	std::u16string name;
-	AM_TitleEntry entry;
-	bool requiresDelete;
-} TitleInstallInfo;
-
-// Ordered from highest to lowest priority.
-static const u32 titleTypes[7] = {
-		0x00040138, // System Firmware
-		0x00040130, // System Modules
-		0x00040030, // Applets
-		0x00040010, // System Applications
-		0x0004001B, // System Data Archives
-		0x0004009B, // System Data Archives (Shared Archives)
-		0x000400DB, // System Data Archives
-};
-
-u32 getTitlePriority(u64 id) {
-	u32 type = (u32) (id >> 32);
-	for(u32 i = 0; i < 7; i++) {
-		if(type == titleTypes[i]) {
-			return i;
-		}
-	}
-
-	return 0;
-}
-
-bool sortTitlesHighToLow(const TitleInstallInfo &a, const TitleInstallInfo &b) {
-	bool aSafe = (a.entry.titleID & 0xFF) == 0x03;
-	bool bSafe = (b.entry.titleID & 0xFF) == 0x03;
-	if(aSafe != bSafe) {
-		return aSafe;
-	}
-
-	return getTitlePriority(a.entry.titleID) < getTitlePriority(b.entry.titleID);
-}
-
-bool sortTitlesLowToHigh(const TitleInstallInfo &a, const TitleInstallInfo &b) {
-        bool aSafe = (a.entry.titleID & 0xFF) == 0x03;
-        bool bSafe = (b.entry.titleID & 0xFF) == 0x03;
-        if(aSafe != bSafe) {
-                return aSafe;
-        }
-
-	return getTitlePriority(a.entry.titleID) > getTitlePriority(b.entry.titleID);
-}
-
-// Fix compile error. This should be properly initialized if you fiddle with the title stuff!
-u8 sysLang = 0;
-
-// Find title and compare versions. Returns CIA file version - installed title version
-int versionCmp(std::vector<TitleInfo>& installedTitles, u64& titleID, u16 version)
-{
-	for(auto it : installedTitles)
-	{
-		if(it.titleID == titleID)
-		{
-			return (version - it.version);
-		}
-	}
-
-	return 1; // The title is not installed
-}
-
-
-// If downgrade is true we don't care about versions (except equal versions) and uninstall newer versions
-void installUpdates(bool downgrade)
-{
-	std::vector<fs::DirEntry> filesDirs = fs::listDirContents(u"/updates", u".cia;"); // Filter for .cia files
-	std::vector<TitleInfo> installedTitles = getTitleInfos(MEDIATYPE_NAND);
-	std::vector<TitleInstallInfo> titles;
-
-	std::unordered_map<u64, std::unordered_map<u64, std::unordered_map<u64, std::array<uint8_t,32>>>> devices;
-	std::unordered_map<u64, std::unordered_map<u64, std::array<uint8_t,32>>> regions;
-	std::unordered_map<u64, std::array<uint8_t,32>> hashes;
-	std::array<uint8_t,32> cmphash;
-
-	u8 calchash[32];
-	u64 ciaSize, offset = 0;
-	u32 bytesRead;
-
-	bool is_n3ds = 0;
-	APT_CheckNew3DS(&is_n3ds);
-
-	Buffer<char> tmpStr(256);
-	Result res;
-	TitleInstallInfo installInfo;
-	AM_TitleEntry ciaFileInfo;
-	fs::File f;
-
-	logging->logprintf("Getting firmware files information...\n\n");
-
-	// determine firm cia version
-	for(auto it : filesDirs)
-	{
-		if(!it.isDir)
-		{
-
-			f.open(u"/updates/" + it.name, FS_OPEN_READ);
-			if((res = AM_GetCiaFileInfo(MEDIATYPE_NAND, &ciaFileInfo, f.getFileHandle())))
-				throw titleException(_FILE_, __LINE__, res, "Failed to get CIA file info!");
-
-			if(ciaFileInfo.titleID != 0x0004013800000002LL && ciaFileInfo.titleID != 0x0004013820000002L)
-				continue;
-
-			if(ciaFileInfo.titleID == 0x0004013820000002LL && is_n3ds == 0)
-				throw titleException(_FILE_, __LINE__, res, "Installing N3DS pack on O3DS will always brick!");
-			if(ciaFileInfo.titleID == 0x0004013800000002LL && is_n3ds == 1 && ciaFileInfo.version > 11872)
-				throw titleException(_FILE_, __LINE__, res, "Installing O3DS pack >6.0 on N3DS will always brick!");
-
-			if(ciaFileInfo.titleID == 0x0004013800000002LL && is_n3ds == 1 && ciaFileInfo.version < 11872){
-				logging->logprintf("Installing O3DS pack on N3DS will brick unless you swap the NCSD and crypto slot!\n");
-				logging->logprintf("!! DO NOT CONTINUE UNLESS !!\n!! YOU ARE ON A9LH OR REDNAND !!\n\n");
-				logging->logprintf("(A) continue\n(B) cancel\n\n");
-				while(aptMainLoop())
-				{
-					hidScanInput();
-
-					if(hidKeysDown() & KEY_A)
-						break;
-
-					if(hidKeysDown() & KEY_B)
-						throw titleException(_FILE_, __LINE__, res, "Canceled!");
-				}
-			}
-
-			logging->logprintf("Verifying firmware files...\n");
-
-			if (firms.find(ciaFileInfo.version) == firms.end()) {
-				throw titleException(_FILE_, __LINE__, res, "\x1b[31mDid not find known firmware files!\x1b[0m\n");
-			} else {
-				devices = firms.find(ciaFileInfo.version)->second;
-			}
-		}
-	}
-
-	logging->logprintf("Getting region map...\n");
-
-	// determine firm cia device (n3ds/o3ds)
-	for(auto it : filesDirs)
-	{
-		if(!it.isDir)
-		{
-
-			f.open(u"/updates/" + it.name, FS_OPEN_READ);
-			if((res = AM_GetCiaFileInfo(MEDIATYPE_NAND, &ciaFileInfo, f.getFileHandle())))
-				throw titleException(_FILE_, __LINE__, res, "Failed to get CIA file info!");
-
-			if (devices.find(ciaFileInfo.titleID) == devices.end()) {
-				continue;
-			} else {
-				regions = devices.find(ciaFileInfo.titleID)->second;
-			}
-		}
-	}
-
-	if (regions.empty()){
-		throw titleException(_FILE_, __LINE__, res, "\x1b[31mDid not find known firmware files!\x1b[0m\n");
-	}
-
-	logging->logprintf("Getting hash map...\n");
-
-	//determine home menu cia for region
-	//also do region checking
-	for(auto it : filesDirs)
-	{
-		if(!it.isDir)
-		{
-
-			f.open(u"/updates/" + it.name, FS_OPEN_READ);
-			if((res = AM_GetCiaFileInfo(MEDIATYPE_NAND, &ciaFileInfo, f.getFileHandle())))
-				throw titleException(_FILE_, __LINE__, res, "Failed to get CIA file info!");
-
-			if (regions.find(ciaFileInfo.titleID) == regions.end()) {
-				continue;
-			} else {
-
-				u64 home = regions.find(ciaFileInfo.titleID)->first;
-				u8 region;
-
-				if((res = CFGU_SecureInfoGetRegion(&region)))
-					throw titleException(_FILE_, __LINE__, res, "CFGU_SecureInfoGetRegion() failed!");
-
-				if ( (( home == 0x0004003000008202LL ) && ( region != CFG_REGION_JPN )) ||
-					 (( home == 0x0004003000008F02LL ) && ( region != CFG_REGION_USA )) ||
-					 (( home == 0x0004003000009802LL ) && ( region != CFG_REGION_EUR ) && ( region != CFG_REGION_AUS )) ||
-					 (( home == 0x000400300000A102LL ) && ( region != CFG_REGION_CHN )) ||
-					 (( home == 0x000400300000A902LL ) && ( region != CFG_REGION_KOR )) ||
-					 (( home == 0x000400300000B102LL ) && ( region != CFG_REGION_TWN )) ) {
-						 throw titleException(_FILE_, __LINE__, res, "\x1b[31mFirmware files are not for this device region!\x1b[0m\n");
-				}
-
-			 	hashes = regions.find(ciaFileInfo.titleID)->second;
-				if(filesDirs.size() > hashes.size()) throw titleException(_FILE_, __LINE__, res, "Too many titles in /updates/ found!\n");
-				if(filesDirs.size() < hashes.size()) throw titleException(_FILE_, __LINE__, res, "Too few titles in /updates/ found!\n");
-			}
-		}
-	}
-
-	if (hashes.empty()){
-		throw titleException(_FILE_, __LINE__, res, "\x1b[31mDid not find known firmware files!\x1b[0m\n");
-	}
-
-	logging->logprintf("Checking hashes...\n\n");
-
-	//check hashmap
-	for(auto it : filesDirs)
-	{
-		if(!it.isDir){
-
-			f.open(u"/updates/" + it.name, FS_OPEN_READ);
-			if((res = AM_GetCiaFileInfo(MEDIATYPE_NAND, &ciaFileInfo, f.getFileHandle())))
-				throw titleException(_FILE_, __LINE__, res, "Failed to get CIA file info!");
-
-			logging->logprintf("0x%016" PRIx64, ciaFileInfo.titleID);
-
-			cmphash = hashes.find(ciaFileInfo.titleID)->second;
-			ciaSize = f.size();
-
-			Buffer<u8> shaBuffer(ciaSize, false);
-
-			if((res = FSFILE_Read(f.getFileHandle(), &bytesRead, offset, &shaBuffer, ciaSize)))
-				throw fsException(_FILE_, __LINE__, res, "Failed to read from file!");
-
-			if((res = FSUSER_UpdateSha256Context(&shaBuffer, ciaSize, calchash)))
-				throw titleException(_FILE_, __LINE__, res, "FSUSER_UpdateSha256Context() failed!");
-
-			if(memcmp(cmphash.data(), calchash, 32)==0){
-				logging->logprintf("\x1b[32m  Verified\x1b[0m\n");
-			} else {
-				throw titleException(_FILE_, __LINE__, res, "\x1b[31mHash mismatch! File is corrupt or incorrect!\x1b[0m\n\n");
-			}
-
-		}
-	}
-
-	logging->logprintf("\n\n\x1b[32mVerified firmware files successfully!\n\n\x1b[0m\n\n");
-	logging->logprintf("Installing firmware files...\n");
-	for(auto it : filesDirs)
-	{
-		if(!it.isDir)
-		{
-			// Quick and dirty hack to detect these pesky
-			// attribute files OSX creates.
-			// This should rather be added to the
-			// filter rules later.
-			if(it.name[0] == u'.') continue;
-
-			f.open(u"/updates/" + it.name, FS_OPEN_READ);
-			if((res = AM_GetCiaFileInfo(MEDIATYPE_NAND, &ciaFileInfo, f.getFileHandle()))) throw titleException(_FILE_, __LINE__, res, "Failed to get CIA file info!");
-
-			int cmpResult = versionCmp(installedTitles, ciaFileInfo.titleID, ciaFileInfo.version);
-			if((downgrade && cmpResult != 0) || (cmpResult > 0))
-			{
-				installInfo.name = it.name;
-				installInfo.entry = ciaFileInfo;
-				installInfo.requiresDelete = downgrade && cmpResult < 0;
-
-				titles.push_back(installInfo);
-			}
-		}
-	}
-
-	std::sort(titles.begin(), titles.end(), downgrade ? sortTitlesLowToHigh : sortTitlesHighToLow);
-
-	for(auto it : titles)
-	{
-		bool nativeFirm = it.entry.titleID == 0x0004013800000002LL || it.entry.titleID == 0x0004013820000002LL;
-		if(nativeFirm)
-		{
-			logging->logprintf("\nNATIVE_FIRM (0x%016" PRIx64 ")", it.entry.titleID);
-		} else {
-			logging->logprintf("0x%016" PRIx64, it.entry.titleID);
-		}
-
-		if(it.requiresDelete) deleteTitle(MEDIATYPE_NAND, it.entry.titleID);
-		installCia(u"/updates/" + it.name, MEDIATYPE_NAND);
-		if(nativeFirm && (res = AM_InstallFirm(it.entry.titleID))) throw titleException(_FILE_, __LINE__, res, "Failed to install NATIVE_FIRM!");
-		logging->logprintf("\x1b[32m  Installed\x1b[0m\n");
-	}
-}
+#define REBOOT_DELAY_MS (10000)
 
 int main()
 {
 	gfxInit(GSP_RGB565_OES, GSP_RGB565_OES, false);
 	sdmcArchiveInit();
+	fs::ioQueueInit();
+	TRACE_INIT();
+	IPC_RECORD_INIT();
 	amInit();
 	cfguInit();
 
-	bool once = false;
-	int mode;
+	Installer *installer = nullptr;
+	bool once = false, prompting = false;
+	u64 rebootTime = 0; // Reboot when osGetTime() reaches this. 0 = not scheduled
 
 	consoleInit(GFX_TOP, NULL);
+	console::init();
 
 	logging->logprintf("sysDowngrader\n\n");
 	logging->logprintf("(A) update\n(Y) downgrade\n(X) test svchax\n(B) exit\n\n");
@@ -337,72 +57,111 @@ int main()
 	logging->logprintf(" + profi200\n\n");
 
 
+	// The install runs on a worker thread. This loop only handles input and
+	// messages so it keeps running once per frame and APT events get processed.
 	while(aptMainLoop())
 	{
 		hidScanInput();
+		const u32 kDown = hidKeysDown();
 
-		if(hidKeysDown() & KEY_B)
-			break;
-		if(!once)
+		if(installer)
 		{
-			if(hidKeysDown() & (KEY_A | KEY_Y | KEY_X))
+			const bool finished = installer->finished(); // Before polling so the last message isn't missed
+			InstallMsg msg;
+
+			while(installer->poll(msg))
 			{
-				try
+				switch(msg.type)
 				{
-
-					if ((bool)(hidKeysDown() & KEY_Y)) {
-						mode = 0;
-					} else if ((bool)(hidKeysDown() & KEY_A)) {
-						mode = 1;
-					} else {
-						mode = 2;
-					}
-
-					consoleClear();
-
-					if (getAMu() != 0) {
-						logging->logprintf("\x1b[31mDid not get am:u handle, please reboot\x1b[0m\n\n");
-						return 0;
-					}
-
-					if (mode == 0) {
-						logging->logprintf("Beginning downgrade...\n");
-						installUpdates(true);
-						logging->logprintf("\n\nUpdates installed; rebooting in 10 seconds...\n\n");
-					} else if (mode == 1) {
-						logging->logprintf("Beginning update...\n");
-						installUpdates(false);
+					case INSTALL_MSG_PROGRESS:
+						// Top right corner. Saving and restoring the cursor keeps it out of the way of the log
+						console::progress(1, "\x1b[s\x1b[1;38H%3lu/%-3lu %3lu%%\x1b[u", (unsigned long)msg.key, (unsigned long)msg.total, (unsigned long)msg.percent);
+						break;
+					case INSTALL_MSG_PROMPT:
+						prompting = true;
+						break;
+					case INSTALL_MSG_DONE:
 						logging->logprintf("\n\nUpdates installed; rebooting in 10 seconds...\n\n");
-					} else {
-						logging->logprintf("Tested svchax; rebooting in 10 seconds...\n");
-					}
-
-					svcSleepThread(10000000000LL);
+						rebootTime = osGetTime() + REBOOT_DELAY_MS;
+						break;
+					case INSTALL_MSG_FAILED:
+						logging->logprintf("\n%s\n", msg.text);
+						console::print("Press (B) to exit.");
+						break;
+				}
+			}
 
-					APT_HardwareResetAsync();
+			if(prompting && (kDown & (KEY_A | KEY_B)))
+			{
+				installer->answer((kDown & KEY_A) != 0);
+				prompting = false;
+			}
 
-					once = true;
-				}
-				catch(fsException& e)
-				{
-					printf("\n%s\n", e.what());
-					printf("Press (B) to exit.");
-					once = true;
+			if(finished && !prompting)
+			{
+				delete installer;
+				installer = nullptr;
+			}
+		}
+		else
+		{
+			if((kDown & KEY_B) && !rebootTime)
+				break;
+			if(!once && (kDown & (KEY_A | KEY_Y | KEY_X)))
+			{
+				once = true;
+				console::print("\x1b[2J"); // Clear through the renderer so the order is kept
+
+				if (getAMu() != 0) {
+					logging->logprintf("\x1b[31mDid not get am:u handle, please reboot\x1b[0m\n\n");
+					logging->flush();
+					console::flush();
+					break;
 				}
-				catch(titleException& e)
-				{
-					printf("\n%s\n", e.what());
-					printf("Press (B) to exit.");
-					once = true;
+
+				if (kDown & KEY_Y) {
+					logging->logprintf("Beginning downgrade...\n");
+					installer = new Installer(true);
+				} else if (kDown & KEY_A) {
+					logging->logprintf("Beginning update...\n");
+					installer = new Installer(false);
+				} else {
+					logging->logprintf("Tested svchax; rebooting in 10 seconds...\n");
+					rebootTime = osGetTime() + REBOOT_DELAY_MS;
 				}
 			}
 		}
+
+		if(rebootTime && osGetTime()>=rebootTime)
+		{
+			rebootTime = 0;
+			TRACE_EXIT();
+			IPC_RECORD_EXIT();
+			ipc::writeStats();
+			mem::writeStats();
+			logging->flush();
+			console::flush();
+			APT_HardwareResetAsync();
+		}
+
 		gfxFlushBuffers();
 		gfxSwapBuffers();
 		gspWaitForVBlank();
 	}
 
+	// Leaving through HOME. Cancels open and later prompts and waits for the install
+	delete installer;
+
+	TRACE_EXIT();
+	IPC_RECORD_EXIT();
+	ipc::writeStats();
+	mem::writeStats();
+	delete logging; // Drains the log and stops the writer thread
+	logging = nullptr;
+	console::exit();
+
 	amExit();
+	fs::ioQueueExit();
 	sdmcArchiveExit();
 	cfguExit();
 	gfxExit();
@@ -0,0 +1,250 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <3ds.h>
+#include "memtrack.h"
+#include "misc.h"
+
+// Every block starts with its size. Keeps the alignment malloc() guarantees
+#define MEM_HEADER_SIZE (alignof(std::max_align_t))
+
+
+namespace mem
+{
+	struct Phase
+	{
+		PhaseUsage usage;
+		bool warned; // Don't warn twice for the same phase
+	};
+
+	// Updated by any thread with relaxed atomics. The phases are only begun
+	// and ended by one thread at a time.
+	static u32 allocs = 0;
+	static u32 frees = 0;
+	static u64 bytes = 0;
+	static u64 inUse = 0;
+	static u64 peak = 0;
+	static u64 buffersInUse = 0;
+	static u64 buffersPeak = 0;
+	static u64 budgetBytes = MEM_BUDGET;
+
+	static Phase phases[MEM_MAX_PHASES];
+	static u32 phaseCnt = 0;
+	static Phase *current = nullptr;
+
+
+	static void raise(u64& max, u64 value)
+	{
+		u64 old = __atomic_load_n(&max, __ATOMIC_RELAXED);
+		while(value>old && !__atomic_compare_exchange_n(&max, &old, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+
+	static void allocated(u64 size)
+	{
+		__atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&bytes, size, __ATOMIC_RELAXED);
+		const u64 now = __atomic_add_fetch(&inUse, size, __ATOMIC_RELAXED);
+		raise(peak, now);
+
+		Phase *p = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+		if(!p) return;
+		__atomic_fetch_add(&p->usage.allocs, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&p->usage.bytes, size, __ATOMIC_RELAXED);
+		raise(p->usage.peak, now);
+		// Logging from in here could deadlock. endPhase() reports it
+		if(budgetBytes && now>budgetBytes) __atomic_store_n(&p->usage.overBudget, true, __ATOMIC_RELAXED);
+	}
+
+	static void freed(u64 size)
+	{
+		__atomic_fetch_add(&frees, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_sub(&inUse, size, __ATOMIC_RELAXED);
+	}
+
+
+	Usage usage()
+	{
+		Usage u;
+
+		u.allocs       = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+		u.frees        = __atomic_load_n(&frees, __ATOMIC_RELAXED);
+		u.bytes        = __atomic_load_n(&bytes, __ATOMIC_RELAXED);
+		u.inUse        = __atomic_load_n(&inUse, __ATOMIC_RELAXED);
+		u.peak         = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+		u.buffersInUse = __atomic_load_n(&buffersInUse, __ATOMIC_RELAXED);
+		u.buffersPeak  = __atomic_load_n(&buffersPeak, __ATOMIC_RELAXED);
+		return u;
+	}
+
+
+	void resetPhases()
+	{
+		endPhase();
+		phaseCnt = 0;
+	}
+
+	u32 phaseCount()
+	{
+		return phaseCnt;
+	}
+
+	PhaseUsage phase(u32 index)
+	{
+		return phases[index].usage;
+	}
+
+
+	void setBudget(u64 bytes)
+	{
+		budgetBytes = bytes;
+	}
+
+	u64 budget()
+	{
+		return budgetBytes;
+	}
+
+
+	void beginPhase(const char *name)
+	{
+		endPhase();
+		if(phaseCnt==MEM_MAX_PHASES) return; // Not tracked but still counted overall
+
+		Phase& p = phases[phaseCnt++];
+		p.usage.name = name;
+		p.usage.allocs = 0;
+		p.usage.bytes = 0;
+		p.usage.startInUse = p.usage.peak = __atomic_load_n(&inUse, __ATOMIC_RELAXED);
+		p.usage.buffersPeak = __atomic_load_n(&buffersInUse, __ATOMIC_RELAXED);
+		p.usage.overBudget = false;
+		p.warned = false;
+		__atomic_store_n(&current, &p, __ATOMIC_RELEASE);
+	}
+
+	void endPhase()
+	{
+		Phase *p = __atomic_exchange_n(&current, nullptr, __ATOMIC_ACQ_REL);
+		if(!p || !__atomic_load_n(&p->usage.overBudget, __ATOMIC_RELAXED) || p->warned || !logging) return;
+
+		p->warned = true;
+		logging->logprintf("\x1b[33mWarning: the heap peaked at %lu KB during %s, over the %lu KB budget\x1b[0m\n",
+		                   (unsigned long)(p->usage.peak>>10), p->usage.name, (unsigned long)(budgetBytes>>10));
+	}
+
+
+	void checkBudget(u64 bytes)
+	{
+		const u64 now = __atomic_load_n(&inUse, __ATOMIC_RELAXED);
+		Phase *p = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+
+		if(!budgetBytes || now + bytes<=budgetBytes || (p && p->warned) || !logging) return;
+
+		if(p) p->warned = true;
+		logging->logprintf("\x1b[33mWarning: allocating %lu KB%s%s puts the heap at %lu KB, over the %lu KB budget\x1b[0m\n",
+		                   (unsigned long)(bytes>>10), (p ? " during " : ""), (p ? p->usage.name : ""),
+		                   (unsigned long)((now + bytes)>>10), (unsigned long)(budgetBytes>>10));
+	}
+
+
+	void bufferAllocated(u64 bytes)
+	{
+		const u64 now = __atomic_add_fetch(&buffersInUse, bytes, __ATOMIC_RELAXED);
+		raise(buffersPeak, now);
+
+		Phase *p = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+		if(p) raise(p->usage.buffersPeak, now);
+	}
+
+	void bufferFreed(u64 bytes)
+	{
+		__atomic_fetch_sub(&buffersInUse, bytes, __ATOMIC_RELAXED);
+	}
+
+
+	void dumpStats(FILE *f)
+	{
+		const Usage u = usage();
+
+		fprintf(f, "%-12s %8s %10s %10s %10s %10s\n", "phase", "allocs", "bytes KB", "start KB", "peak KB", "buffers KB");
+		for(u32 i = 0; i<phaseCnt; i++)
+		{
+			const PhaseUsage& p = phases[i].usage;
+			fprintf(f, "%-12s %8lu %10lu %10lu %10lu %10lu%s\n", p.name, (unsigned long)p.allocs, (unsigned long)(p.bytes>>10),
+			        (unsigned long)(p.startInUse>>10), (unsigned long)(p.peak>>10), (unsigned long)(p.buffersPeak>>10),
+			        (p.overBudget ? " over budget" : ""));
+		}
+		fprintf(f, "%lu allocs, %lu frees, %lu KB allocated, peak %lu KB (buffers %lu KB), budget %lu KB\n",
+		        (unsigned long)u.allocs, (unsigned long)u.frees, (unsigned long)(u.bytes>>10), (unsigned long)(u.peak>>10),
+		        (unsigned long)(u.buffersPeak>>10), (unsigned long)(budgetBytes>>10));
+	}
+
+
+	void writeStats()
+	{
+		FILE *f = fopen(MEM_STATS_FILE_PATH, "w");
+		if(!f) return;
+
+		dumpStats(f);
+		fclose(f);
+	}
+}
+
+
+static void* allocate(size_t size)
+{
+	u8 *block = (u8*)malloc(size + MEM_HEADER_SIZE);
+	if(!block) return nullptr;
+
+	*(size_t*)block = size;
+	mem::allocated(size);
+	return block + MEM_HEADER_SIZE;
+}
+
+static void release(void *ptr)
+{
+	if(!ptr) return;
+
+	u8 *block = (u8*)ptr - MEM_HEADER_SIZE;
+	mem::freed(*(size_t*)block);
+	free(block);
+}
+
+void* operator new(size_t size)
+{
+	void *ptr = allocate(size);
+	if(!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	void *ptr = allocate(size);
+	if(!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {return allocate(size);}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {return allocate(size);}
+void operator delete(void *ptr) noexcept {release(ptr);}
+void operator delete[](void *ptr) noexcept {release(ptr);}
+void operator delete(void *ptr, const std::nothrow_t&) noexcept {release(ptr);}
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept {release(ptr);}
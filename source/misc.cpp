@@ -21,8 +21,11 @@
 #include <3ds.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include "console.h"
 #include "misc.h"
 #include "fs.h"
+#include "thread.h"
 
 extern "C" {
   Result svchax_init(bool patch_srv);
@@ -30,39 +33,187 @@ extern "C" {
   extern u32 __ctr_svchax_srv;
 }
 
-Logging::Logging(void) {
-  lgf = fopen("/sysDowngrader.log", "a");
-  if (nullptr != lgf) {
-    fprintf(lgf, "\n------------------------------------------------------------\n\n");
-    fflush(lgf);
+Logging::Logging(void) : filePos(LOG_HEADER_SIZE), wrapped(false), head(0), tail(0), quit(false) {
+  for (u32 i = 0; i < LOG_SLOT_COUNT; i++) {
+    slots[i].seq = i;
   }
+
+  openFile();
+
+  writer = new Worker([this]() { writerLoop(); });
 }
 
 Logging::~Logging(void) {
+  __atomic_store_n(&quit, true, __ATOMIC_RELEASE);
+  pending.signal();
+  delete writer; // Joins after the last drain
+
   if (nullptr != lgf) {
     fclose(lgf);
   }
 }
 
-void Logging::logprintf(const char *fmt, ...) {
+// Claims the next free slot. Spins (sleeping) while the writer catches up.
+char *Logging::reserve(u32 &pos) {
+  pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+  while (true) {
+    Slot &slot = slots[pos % LOG_SLOT_COUNT];
+    s32 diff = (s32)(__atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE) - pos);
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return slot.text;
+      }
+    } else if (diff < 0) { // Ring is full
+      pending.signal();
+      svcSleepThread(1000000LL);
+      pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    } else {
+      pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+void Logging::publish(u32 pos, int len) {
+  Slot &slot = slots[pos % LOG_SLOT_COUNT];
+
+  if (len < 0) len = 0;
+  slot.len = ((u32)len < LOG_SLOT_SIZE ? (u32)len : LOG_SLOT_SIZE - 1);
+  __atomic_store_n(&slot.seq, pos + 1, __ATOMIC_RELEASE);
+  pending.signal();
+}
+
+// Formats exactly once. The console gets the same text as the log file.
+void Logging::vlog(const char *fmt, va_list ap) {
+  u32 pos;
+  char *text = reserve(pos);
+  int len = vsnprintf(text, LOG_SLOT_SIZE, fmt, ap);
+
+  console::print(text);
+  publish(pos, (nullptr != lgf ? len : 0));
+
+  if (!writer->running()) {
+    LockGuard lock(fallback);
+    drain();
+  }
+}
+
+// Rotates the logs of earlier runs and creates a new, fully allocated log file.
+// All FAT allocation happens here, not later while installing.
+void Logging::openFile() {
+  char from[64], to[64];
+
+  snprintf(to, sizeof(to), "%s.%d", LOG_FILE_PATH, LOG_GENERATIONS - 1);
+  remove(to);
+  for (int i = LOG_GENERATIONS - 1; i > 0; i--) {
+    if (i > 1) {
+      snprintf(from, sizeof(from), "%s.%d", LOG_FILE_PATH, i - 1);
+    } else {
+      snprintf(from, sizeof(from), "%s", LOG_FILE_PATH);
+    }
+    snprintf(to, sizeof(to), "%s.%d", LOG_FILE_PATH, i);
+    rename(from, to);
+  }
+
+  lgf = fopen(LOG_FILE_PATH, "wb");
   if (nullptr != lgf) {
-    va_list ap;
-    va_start(ap, fmt);
-    vprintf(fmt, ap);
-    vfprintf(lgf, fmt, ap);
+    ftruncate(fileno(lgf), LOG_FILE_SIZE);
+    writeFile(nullptr, 0);
     fflush(lgf);
-    va_end(ap);
   }
 }
 
-void Logging::logsnprintf(char *str, size_t sz, const char *fmt, ...) {
-  if (nullptr != lgf) {
-    va_list ap;
-    va_start(ap, fmt);
-    vprintf(fmt, ap);
-    vfprintf(lgf, fmt, ap);
+// Appends to the ring and updates the header. A null buf only writes the header.
+void Logging::writeFile(const char *buf, u32 len) {
+  char header[LOG_HEADER_SIZE];
+
+  while (len > 0) {
+    u32 chunk = LOG_FILE_SIZE - filePos;
+    if (chunk > len) chunk = len;
+
+    fseek(lgf, filePos, SEEK_SET);
+    fwrite(buf, 1, chunk, lgf);
+    buf += chunk;
+    len -= chunk;
+    filePos += chunk;
+    if (filePos == LOG_FILE_SIZE) {
+      filePos = LOG_HEADER_SIZE;
+      wrapped = true;
+    }
+  }
+
+  // Text runs from the header end to head. Once wrapped the oldest text starts at head
+  int n = snprintf(header, LOG_HEADER_SIZE, "sysDowngrader log size=0x%05X head=0x%05lX wrapped=%d",
+                   LOG_FILE_SIZE, (unsigned long)filePos, wrapped);
+  memset(header + n, ' ', LOG_HEADER_SIZE - n);
+  header[LOG_HEADER_SIZE - 1] = '\n';
+
+  fseek(lgf, 0, SEEK_SET);
+  fwrite(header, 1, LOG_HEADER_SIZE, lgf);
+}
+
+// Moves everything that is ready into batches and writes them. Returns false if nothing was ready.
+bool Logging::drain() {
+  u32 batchLen = 0;
+  bool any = false;
+
+  while (true) {
+    Slot &slot = slots[tail % LOG_SLOT_COUNT];
+    if (__atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE) != tail + 1) {
+      break;
+    }
+
+    if (batchLen + slot.len > LOG_BATCH_SIZE && nullptr != lgf) {
+      writeFile(batch, batchLen);
+      batchLen = 0;
+    }
+    memcpy(batch + batchLen, slot.text, slot.len);
+    batchLen += slot.len;
+
+    __atomic_store_n(&slot.seq, tail + LOG_SLOT_COUNT, __ATOMIC_RELEASE);
+    __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    any = true;
+  }
+
+  if (any && nullptr != lgf) {
+    writeFile(batch, batchLen);
     fflush(lgf);
-    va_end(ap);
+  }
+
+  return any;
+}
+
+void Logging::writerLoop() {
+  while (true) {
+    pending.wait(500000000LL);
+    drain();
+    drained.signal();
+
+    // Producers are done once quit is set. Drain whatever they left and stop.
+    if (__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+      drain();
+      break;
+    }
+  }
+}
+
+void Logging::logprintf(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vlog(fmt, ap);
+  va_end(ap);
+}
+
+void Logging::flush(void) {
+  u32 target = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+
+  if (!writer->running()) { // vlog() already wrote everything
+    return;
+  }
+
+  while ((s32)(__atomic_load_n(&tail, __ATOMIC_ACQUIRE) - target) < 0) {
+    pending.signal();
+    drained.wait(100000000LL);
   }
 }
 
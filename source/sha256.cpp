@@ -0,0 +1,143 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+#include <cstring>
+#include <3ds.h>
+#include "sha256.h"
+
+
+static const u32 k[64] =
+{
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static inline u32 ror(u32 x, u32 n) {return x>>n | x<<(32 - n);}
+
+// The variables rotate through the round arguments instead of being moved around
+#define S0(x)     (ror(x, 2) ^ ror(x, 13) ^ ror(x, 22))
+#define S1(x)     (ror(x, 6) ^ ror(x, 11) ^ ror(x, 25))
+#define CH(x, y, z)  (z ^ (x & (y ^ z)))
+#define MAJ(x, y, z) ((x & y) | (z & (x | y)))
+#define ROUND(a, b, c, d, e, f, g, h, i) \
+	t = h + S1(e) + CH(e, f, g) + k[i] + w[i]; \
+	d += t; \
+	h = t + S0(a) + MAJ(a, b, c);
+
+static void transform(u32 state[8], const u8 *p)
+{
+	u32 w[64], t;
+
+	for(u32 i = 0; i<16; i++) w[i] = (u32)p[i*4]<<24 | (u32)p[i*4 + 1]<<16 | (u32)p[i*4 + 2]<<8 | p[i*4 + 3];
+	for(u32 i = 16; i<64; i++)
+	{
+		const u32 s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ w[i - 15]>>3;
+		const u32 s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ w[i - 2]>>10;
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	u32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+	for(u32 i = 0; i<64; i += 8)
+	{
+		ROUND(a, b, c, d, e, f, g, h, i)
+		ROUND(h, a, b, c, d, e, f, g, i + 1)
+		ROUND(g, h, a, b, c, d, e, f, i + 2)
+		ROUND(f, g, h, a, b, c, d, e, i + 3)
+		ROUND(e, f, g, h, a, b, c, d, i + 4)
+		ROUND(d, e, f, g, h, a, b, c, i + 5)
+		ROUND(c, d, e, f, g, h, a, b, i + 6)
+		ROUND(b, c, d, e, f, g, h, a, i + 7)
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+
+void Sha256::reset()
+{
+	static const u32 init[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+	memcpy(_state_, init, sizeof(_state_));
+	_length_ = 0;
+	_used_ = 0;
+}
+
+
+void Sha256::update(const void *data, u32 size)
+{
+	const u8 *p = (const u8*)data;
+
+	_length_ += size;
+	if(_used_)
+	{
+		const u32 n = (size<64 - _used_ ? size : 64 - _used_);
+		memcpy(_block_ + _used_, p, n);
+		_used_ += n;
+		p += n;
+		size -= n;
+		if(_used_<64) return;
+		transform(_state_, _block_);
+		_used_ = 0;
+	}
+
+	for(; size>=64; size -= 64, p += 64) transform(_state_, p);
+
+	memcpy(_block_, p, size);
+	_used_ = size;
+}
+
+
+void Sha256::finish(u8 *hash)
+{
+	const u64 bits = _length_ * 8;
+
+	_block_[_used_++] = 0x80;
+	if(_used_>56)
+	{
+		memset(_block_ + _used_, 0, 64 - _used_);
+		transform(_state_, _block_);
+		_used_ = 0;
+	}
+	memset(_block_ + _used_, 0, 56 - _used_);
+	for(u32 i = 0; i<8; i++) _block_[63 - i] = (u8)(bits>>(i*8));
+	transform(_state_, _block_);
+
+	for(u32 i = 0; i<8; i++)
+	{
+		hash[i*4]     = (u8)(_state_[i]>>24);
+		hash[i*4 + 1] = (u8)(_state_[i]>>16);
+		hash[i*4 + 2] = (u8)(_state_[i]>>8);
+		hash[i*4 + 3] = (u8)_state_[i];
+	}
+}
+
+
+void Sha256::hash(const void *data, u32 size, u8 *hash)
+{
+	Sha256 sha;
+
+	sha.update(data, size);
+	sha.finish(hash);
+}
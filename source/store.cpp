@@ -0,0 +1,79 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <3ds.h>
+#include "fs.h"
+#include "misc.h"
+#include "store.h"
+#include "title.h"
+
+#define _FILE_ "store.cpp" // Replacement for __FILE__ without the path
+
+
+
+Store::Store(const fs::Path& manifestPath, const fs::Path& dir, FS_Archive& archive) : _dir_(dir)
+{
+	fs::File manifest(manifestPath, FS_OPEN_READ, archive);
+	const u64 fileSize = manifest.size();
+	ManifestHeader header;
+
+
+	if(fileSize<sizeof(ManifestHeader) || manifest.read(&header, sizeof(ManifestHeader))!=sizeof(ManifestHeader))
+		throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Manifest is truncated!");
+	if(header.magic!=MANIFEST_MAGIC || header.version!=MANIFEST_VERSION || header.entrySize!=sizeof(ManifestEntry) ||
+	   !header.entryCount || header.entryCount>STORE_MAX_ENTRIES || fileSize!=sizeof(ManifestHeader) + header.entryCount * sizeof(ManifestEntry))
+		throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid manifest header!");
+
+	_entries_.resize(header.entryCount);
+	const u32 entryBytes = header.entryCount * sizeof(ManifestEntry);
+	if(manifest.read(_entries_.data(), entryBytes)!=entryBytes) throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Manifest is truncated!");
+
+	// One CIA per title. Different titles never have the same CIA
+	for(size_t i = 0; i<_entries_.size(); i++)
+	{
+		if(!_entries_[i].size) throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid manifest entry!");
+		for(size_t j = 0; j<i; j++)
+		{
+			if(_entries_[j].titleID==_entries_[i].titleID || !memcmp(_entries_[j].sha256, _entries_[i].sha256, 32))
+				throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid manifest entry!");
+		}
+	}
+}
+
+
+std::u16string Store::blobName(const u8 *sha256)
+{
+	static const char16_t digits[] = u"0123456789ABCDEF";
+	std::u16string name;
+
+
+	name.reserve(68);
+	for(u32 i = 0; i<32; i++)
+	{
+		name += digits[sha256[i]>>4];
+		name += digits[sha256[i] & 0xF];
+	}
+	name += u".cia";
+
+	return name;
+}
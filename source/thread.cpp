@@ -0,0 +1,55 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <functional>
+#include <3ds.h>
+#include "thread.h"
+
+
+
+void Worker::entry(void *arg)
+{
+	((Worker*)arg)->_func_();
+}
+
+
+Worker::Worker(std::function<void ()> func, int prioOffset, size_t stackSize) : _func_(func)
+{
+	s32 prio = 0x30;
+
+
+	svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+	prio += prioOffset;
+	if(prio < 0x18) prio = 0x18; // Applications can't go below this
+	if(prio > 0x3F) prio = 0x3F;
+
+	// Threads stay on the app core. -2 means "use the default core of this process"
+	_thread_ = threadCreate(entry, this, stackSize, prio, -2, false);
+}
+
+
+void Worker::join()
+{
+	if(!_thread_) return;
+
+	threadJoin(_thread_, U64_MAX);
+	threadFree(_thread_);
+	_thread_ = nullptr;
+}
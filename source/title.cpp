@@ -21,18 +21,24 @@
 #include <vector>
 #include <cstring>
 #include <3ds.h>
+#include "delta.h"
 #include "fs.h"
+#include "ipc.h"
+#include "lz4.h"
 #include "misc.h"
 #include "title.h"
+#include "trace.h"
 
 #define _FILE_ "title.cpp" // Replacement for __FILE__ without the path
 
+// Fix compile error. This should be properly initialized if you fiddle with the title stuff!
+u8 sysLang = 0;
+
 
 
 std::vector<TitleInfo> getTitleInfos(FS_MediaType mediaType)
 {
 	char tmpStr[16];
-	extern u8 sysLang; // We got this in main.c
 	u32 count, bytesRead;
 	Result res;
 	Handle fileHandle;
@@ -44,7 +50,7 @@ std::vector<TitleInfo> getTitleInfos(FS_MediaType mediaType)
 	const FS_Path filePath = {PATH_BINARY, sizeof(fileLowPath), fileLowPath};
 
 
-	if((res = AM_GetTitleCount(mediaType, &count))) throw titleException(_FILE_, __LINE__, res, "Failed to get title count!");
+	if((res = ipc::AM_GetTitleCount(mediaType, &count))) throw titleException(_FILE_, __LINE__, res, "Failed to get title count!");
 
 
 	std::vector<TitleInfo> titleInfos; titleInfos.reserve(count);
@@ -54,24 +60,24 @@ std::vector<TitleInfo> getTitleInfos(FS_MediaType mediaType)
 
 
 	u32 throwaway;
-	if((res = AM_GetTitleList(&throwaway, mediaType, count, &titleIdList))) throw titleException(_FILE_, __LINE__, res, "Failed to get title ID list!");
-	if((res = AM_GetTitleInfo(mediaType, count, &titleIdList, &titleList))) throw titleException(_FILE_, __LINE__, res, "Failed to get title list!");
+	if((res = ipc::AM_GetTitleList(&throwaway, mediaType, count, &titleIdList))) throw titleException(_FILE_, __LINE__, res, "Failed to get title ID list!");
+	if((res = ipc::AM_GetTitleInfo(mediaType, count, &titleIdList, &titleList))) throw titleException(_FILE_, __LINE__, res, "Failed to get title list!");
 	for(u32 i=0; i<count; i++)
 	{
 		// Copy title ID, size and version directly
 		memcpy(&tmpTitleInfo.titleID, &titleList[i].titleID, 18);
-		if(AM_GetTitleProductCode(mediaType, titleIdList[i], tmpStr)) memset(tmpStr, 0, 16);
+		if(ipc::AM_GetTitleProductCode(mediaType, titleIdList[i], tmpStr)) memset(tmpStr, 0, 16);
 		tmpTitleInfo.productCode = tmpStr;
 
 		// Copy the title ID into our archive low path
 		memcpy(archiveLowPath, &titleIdList[i], 8);
 		icon.clear();
-		if(!FSUSER_OpenFileDirectly(&fileHandle, ARCHIVE_SAVEDATA_AND_CONTENT, archivePath, filePath, FS_OPEN_READ, 0))
+		if(!ipc::FSUSER_OpenFileDirectly(&fileHandle, ARCHIVE_SAVEDATA_AND_CONTENT, archivePath, filePath, FS_OPEN_READ, 0))
 		{
 			// Nintendo decided to release a title with an icon entry but with size 0 so this will fail.
 			// Ignoring errors because of this here.
-			FSFILE_Read(fileHandle, &bytesRead, 0, &icon, sizeof(Icon));
-			FSFILE_Close(fileHandle);
+			ipc::FSFILE_Read(fileHandle, &bytesRead, 0, &icon, sizeof(Icon));
+			ipc::FSFILE_Close(fileHandle);
 		}
 
 		tmpTitleInfo.title = icon[0].appTitles[sysLang].longDesc;
@@ -85,45 +91,261 @@ std::vector<TitleInfo> getTitleInfos(FS_MediaType mediaType)
 }
 
 
-void installCia(const std::u16string& path, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+static u32 signatureSize(u32 sigType)
+{
+	switch(sigType)
+	{
+		case 0x10000: // RSA-4096 SHA1
+		case 0x10003: // RSA-4096 SHA256
+			return 0x200 + 0x3C;
+		case 0x10001: // RSA-2048 SHA1
+		case 0x10004: // RSA-2048 SHA256
+			return 0x100 + 0x3C;
+		case 0x10002: // ECDSA SHA1
+		case 0x10005: // ECDSA SHA256
+			return 0x3C + 0x40;
+	}
+
+	return 0;
+}
+
+
+// Decompressed start of a CIA. Reads past the available data throw like reads past the end of a file.
+class MemoryView
+{
+	const u8 *const _data_;
+	const u32 _available_;
+	const u64 _size_;
+
+
+public:
+	MemoryView(const u8 *data, u32 available, u64 size) : _data_(data), _available_(available), _size_(size) {}
+
+	u64 size() {return _size_;}
+	template<class T> T get(u64 offset)
+	{
+		T tmp;
+		if(offset>_available_ || sizeof(T)>_available_ - offset) throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "CIA header doesn't fit into the first block!");
+		memcpy(&tmp, _data_ + offset, sizeof(T));
+		return tmp;
+	}
+};
+
+
+template<class View>
+static CiaInfo parseCia(View& view)
+{
+	const u64 align = 64; // All CIA sections are 64 byte aligned
+	CiaInfo info;
+	u32 headerSize, sigSize;
+
+
+	headerSize         = view.template get<u32>(0x00);
+	info.certSize      = view.template get<u32>(0x08);
+	info.ticketSize    = view.template get<u32>(0x0C);
+	info.tmdSize       = view.template get<u32>(0x10);
+	info.metaSize      = view.template get<u32>(0x14);
+	info.contentSize   = view.template get<u64>(0x18);
+	if(headerSize != 0x2020) throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid CIA header!");
+
+	info.certOffset    = (headerSize + align - 1) & ~(align - 1);
+	info.ticketOffset  = (info.certOffset + info.certSize + align - 1) & ~(align - 1);
+	info.tmdOffset     = (info.ticketOffset + info.ticketSize + align - 1) & ~(align - 1);
+	info.contentOffset = (info.tmdOffset + info.tmdSize + align - 1) & ~(align - 1);
+	info.metaOffset    = (info.contentOffset + info.contentSize + align - 1) & ~(align - 1);
+	if(info.contentOffset + info.contentSize > view.size()) throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "CIA is truncated!");
+
+
+	// TMD fields are big endian and start after the signature
+	if(!(sigSize = signatureSize(__builtin_bswap32(view.template get<u32>(info.tmdOffset)))) || 4 + sigSize + 0xC4 > info.tmdSize)
+		throw titleException(_FILE_, __LINE__, 0xDEADBEEF, "Invalid TMD!");
+
+	const u64 tmdHeader = info.tmdOffset + 4 + sigSize;
+	info.titleID      = __builtin_bswap64(view.template get<u64>(tmdHeader + 0x4C));
+	info.version      = __builtin_bswap16(view.template get<u16>(tmdHeader + 0x9C));
+	info.contentCount = __builtin_bswap16(view.template get<u16>(tmdHeader + 0x9E));
+
+	return info;
+}
+
+
+CiaInfo inspectCia(fs::FileView& view)
+{
+	return parseCia(view);
+}
+
+
+CiaInfo inspectCia(const u8 *data, u32 size, u64 ciaSize)
+{
+	MemoryView view(data, size, ciaSize);
+
+	return parseCia(view);
+}
+
+
+void installCia(const fs::Path& path, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+{
+	fs::File ciaFile(path, FS_OPEN_READ);
+
+	installCia(ciaFile, 0, ciaFile.size(), (callback ? path.str() : std::u16string()), mediaType, callback);
+}
+
+
+void installCia(const fs::Path& path, const fs::FileStat& stat, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+{
+	fs::File ciaFile(path, FS_OPEN_READ, stat);
+
+	installCia(ciaFile, 0, ciaFile.size(), (callback ? path.str() : std::u16string()), mediaType, callback);
+}
+
+
+// Reads the next block through the I/O thread while the current one is written to AM
+void installCia(fs::File& ciaFile, u64 start, u64 ciaSize, const std::u16string& name, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
 {
-	fs::File ciaFile(path, FS_OPEN_READ), cia;
-	Buffer<u8> buffer(MAX_BUF_SIZE, false);
+	fs::File cia;
+	Buffer<u8> buffer0(CIA_BLOCK_SIZE, false), buffer1(CIA_BLOCK_SIZE, false);
+	u8 *buffers[2] = {&buffer0, &buffer1};
+	fs::IoToken pending = 0;
 	Handle ciaHandle;
-	u32 blockSize;
-	u64 ciaSize, offset = 0;
+	u32 blockSize, cur = 0;
+	u64 offset = 0;
 	Result res;
 
 
 
-	ciaSize = ciaFile.size();
-	if((res = AM_StartCiaInstall(mediaType, &ciaHandle))) throw titleException(_FILE_, __LINE__, res, "Failed to start CIA installation!");
+	TRACE_ZONE(TRACE_INSTALL_CIA, ciaSize);
+	{
+		TRACE_ZONE(TRACE_AM_START_CIA_INSTALL, 0);
+		res = ipc::AM_StartCiaInstall(mediaType, &ciaHandle);
+	}
+	if(res) throw titleException(_FILE_, __LINE__, res, "Failed to start CIA installation!");
 	cia.setFileHandle(ciaHandle); // Use the handle returned by AM
 
 
-	for(u32 i=0; i<=ciaSize / MAX_BUF_SIZE; i++)
+	try
+	{
+		if(ciaSize>0) pending = ciaFile.readAsync(buffers[0], (ciaSize<CIA_BLOCK_SIZE ? ciaSize : CIA_BLOCK_SIZE), start);
+
+		while(offset<ciaSize)
+		{
+			blockSize = ((ciaSize - offset<CIA_BLOCK_SIZE) ? ciaSize - offset : CIA_BLOCK_SIZE);
+
+			const fs::IoToken token = pending;
+			pending = 0; // Consumed by wait() even if it throws
+			ciaFile.wait(token); // Throws if the CIA is shorter than it claims
+
+			// Start reading the next block before writing this one
+			const u64 next = offset + blockSize;
+			if(next<ciaSize) pending = ciaFile.readAsync(buffers[cur^1], (ciaSize - next<CIA_BLOCK_SIZE ? ciaSize - next : CIA_BLOCK_SIZE), start + next);
+
+			cia.write(buffers[cur], blockSize);
+
+			offset = next;
+			cur ^= 1;
+			if(callback) callback(name, offset * 100 / ciaSize);
+		}
+	} catch(fsException& e)
+	{
+		if(pending) fs::ioWait(pending); // The buffer must not go away under the I/O thread
+		TRACE_EVENT(TRACE_AM_CANCEL_CIA_INSTALL, 0);
+		ipc::AM_CancelCIAInstall(ciaHandle); // Abort installation
+		cia.setFileHandle(0); // Reset the handle so it doesn't get closed twice
+		throw;
+	}
+
+	{
+		TRACE_ZONE(TRACE_AM_FINISH_CIA_INSTALL, 0);
+		res = ipc::AM_FinishCiaInstall(ciaHandle);
+	}
+	if(res) throw titleException(_FILE_, __LINE__, res, "Failed to finish CIA installation!");
+}
+
+
+// Writes the blocks next() returns to AM until it returns nullptr. For CIAs that are built while installing
+// With overlap the previous chunk is still being written while next() builds the following one.
+// The reader must keep its last two chunks valid for that.
+static void installStream(u64 ciaSize, std::function<const u8* (u32& size)> next, bool overlap, const std::u16string& name, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+{
+	fs::File cia;
+	Handle ciaHandle;
+	const u8 *data;
+	u32 blockSize;
+	u64 offset = 0;
+	fs::IoToken pending = 0;
+	u32 pendingSize = 0;
+	Result res;
+
+
+
+	TRACE_ZONE(TRACE_INSTALL_CIA, ciaSize);
 	{
-		blockSize = ((ciaSize - offset<MAX_BUF_SIZE) ? ciaSize - offset : MAX_BUF_SIZE);
+		TRACE_ZONE(TRACE_AM_START_CIA_INSTALL, 0);
+		res = ipc::AM_StartCiaInstall(mediaType, &ciaHandle);
+	}
+	if(res) throw titleException(_FILE_, __LINE__, res, "Failed to start CIA installation!");
+	cia.setFileHandle(ciaHandle); // Use the handle returned by AM
+
 
-		if(blockSize>0)
+	try
+	{
+		auto written = [&](u32 size) {
+			offset += size;
+			if(callback) callback(name, (ciaSize ? offset * 100 / ciaSize : 100));
+		};
+		auto finishPending = [&]() {
+			const fs::IoToken token = pending;
+			pending = 0;
+			cia.wait(token); // Throws if AM took less than the whole chunk
+			written(pendingSize);
+		};
+
+		while((data = next(blockSize)))
 		{
-			try
+			if(pending) finishPending();
+
+			if(overlap)
 			{
-				ciaFile.read(&buffer, blockSize);
-				cia.write(&buffer, blockSize);
-			} catch(fsException& e)
+				pending = cia.writeAsync(data, blockSize, offset);
+				pendingSize = blockSize;
+			}
+			else
 			{
-				AM_CancelCIAInstall(ciaHandle); // Abort installation
-				cia.setFileHandle(0); // Reset the handle so it doesn't get closed twice
-				throw;
+				cia.write(data, blockSize);
+				written(blockSize);
 			}
-
-			offset += blockSize;
-			if(callback) callback(path, offset * 100 / ciaSize);
 		}
+		if(pending) finishPending();
+	} catch(ResultException& e) // Corrupt input throws, too
+	{
+		if(pending) fs::ioWait(pending); // The request still uses the handle
+		TRACE_EVENT(TRACE_AM_CANCEL_CIA_INSTALL, 0);
+		ipc::AM_CancelCIAInstall(ciaHandle); // Abort installation
+		cia.setFileHandle(0); // Reset the handle so it doesn't get closed twice
+		throw;
 	}
 
-	if((res = AM_FinishCiaInstall(ciaHandle))) throw titleException(_FILE_, __LINE__, res, "Failed to finish CIA installation!");
+	{
+		TRACE_ZONE(TRACE_AM_FINISH_CIA_INSTALL, 0);
+		res = ipc::AM_FinishCiaInstall(ciaHandle);
+	}
+	if(res) throw titleException(_FILE_, __LINE__, res, "Failed to finish CIA installation!");
+}
+
+
+// The frame reader prefetches the next compressed block while the current one is written to AM
+void installCompressedCia(fs::File& file, u64 start, u64 size, const std::u16string& name, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+{
+	lz4::FrameReader reader(file, start, size);
+
+	installStream(reader.info().contentSize, [&](u32& blockSize) {return reader.next(blockSize);}, false, name, mediaType, callback);
+}
+
+
+void installDeltaCia(const fs::Path& path, const std::u16string& name, FS_MediaType mediaType, std::function<void (const std::u16string& file, u32 percent)> callback)
+{
+	DeltaReader reader(path);
+
+	installStream(reader.header().targetSize, [&](u32& blockSize) {return reader.next(blockSize);}, true, name, mediaType, callback);
 }
 
 
@@ -132,9 +354,9 @@ void deleteTitle(FS_MediaType mediaType, u64 titleID)
 	Result res;
 
 	// System app
-	if(titleID>>32 & 0xFFFF) {if((res = AM_DeleteTitle(mediaType, titleID))) throw titleException(_FILE_, __LINE__, res, "Failed to delete system title!");} // Who likes ambiguous else?
+	if(titleID>>32 & 0xFFFF) {if((res = ipc::AM_DeleteTitle(mediaType, titleID))) throw titleException(_FILE_, __LINE__, res, "Failed to delete system title!");} // Who likes ambiguous else?
 	// Normal app
-	else if((res = AM_DeleteAppTitle(mediaType, titleID))) throw titleException(_FILE_, __LINE__, res, "Failed to delete app title!");
+	else if((res = ipc::AM_DeleteAppTitle(mediaType, titleID))) throw titleException(_FILE_, __LINE__, res, "Failed to delete app title!");
 }
 
 
@@ -0,0 +1,95 @@
+/*
+ *  sysUpdater is an update app for the Nintendo 3DS.
+ *  Copyright (C) 2015 profi200
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/
+ */
+
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <3ds.h>
+#include "trace.h"
+
+
+#ifdef ENABLE_TRACE
+
+namespace trace
+{
+	static TraceRecord *records = nullptr;
+	static u32 capacity = 0;
+	static u32 count = 0;
+	static u32 dropped = 0;
+
+
+	void init(u32 cap)
+	{
+		if(records) return;
+
+		records = (TraceRecord*)malloc(cap * sizeof(TraceRecord));
+		capacity = (records ? cap : 0);
+		count = 0;
+		dropped = 0;
+	}
+
+
+	void exit()
+	{
+		if(!records) return;
+
+		// Records reserved but not yet filled in by another thread are still written
+		const u32 n = (count<capacity ? count : capacity);
+		const TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), SYSCLOCK_ARM11, n, dropped};
+
+		FILE *f = fopen(TRACE_FILE_PATH, "wb");
+		if(f)
+		{
+			fwrite(&header, sizeof(TraceHeader), 1, f);
+			fwrite(records, sizeof(TraceRecord), n, f);
+			fclose(f);
+		}
+
+		free(records);
+		records = nullptr;
+		capacity = 0;
+	}
+
+
+	// Lock-free. Every thread gets its own record through one atomic add.
+	void record(u16 id, u8 phase, u32 payload)
+	{
+		static __thread u32 threadId = 0xFFFFFFFF;
+
+		if(!records) return;
+
+		const u32 index = __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED);
+		if(index>=capacity)
+		{
+			__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+
+		if(threadId==0xFFFFFFFF) svcGetThreadId(&threadId, CUR_THREAD_HANDLE);
+
+		TraceRecord& r = records[index];
+		r.tick    = svcGetSystemTick();
+		r.id      = id;
+		r.phase   = phase;
+		r.thread  = (u8)threadId;
+		r.payload = payload;
+	}
+}
+
+#endif // ENABLE_TRACE